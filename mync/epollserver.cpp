@@ -9,6 +9,11 @@ void stop_signal_handler(int signal) {
     g_should_stop = true; //
 }
 
+std::atomic<bool> g_dump_clients{false};
+void dump_signal_handler(int) {
+    g_dump_clients.store(true, std::memory_order_relaxed);
+}
+
 Epoll::Epoll(int sock, bool listen, int show_timer_stats) :
     sockfd(sock), is_listen(listen), show_timer_stats(show_timer_stats)
 {
@@ -60,6 +65,7 @@ void Epoll::fullstop()
             auto& [fd, stats] = pending_new_socks_.front();
             // Сокет, находящийся в очереди, должен быть закрыт и его ресурсы освобождены
             close(fd); // Закрываем сокет, который не был добавлен в epoll
+            bump(counters_.gone);
             // Stats объект (stats) будет уничтожен при удалении из очереди
             pending_new_socks_.pop();
         }
@@ -79,7 +85,6 @@ void Epoll::fullstop()
     }
     stdin_closed = true;
     socket_closed = true;
-    size_clients = 0;
 }
 
 void Epoll::exec()
@@ -88,6 +93,11 @@ void Epoll::exec()
     epoll_event events[MAX_EVENTS];
     const int EPOLL_TIMEOUT = 100;
 
+    // счетчики на поток, поэтому открываем здесь, а не в конструкторе
+    if (PERF_COUNTERS && !perf_.open()) {
+        perror("perf_event_open");
+    }
+
     while (!stdin_closed && !socket_closed) {
         if (g_should_stop.load()){
             break;
@@ -97,10 +107,13 @@ void Epoll::exec()
             if (errno == EINTR) continue;
             throw std::runtime_error("epoll_wait");
         }
+        // один замер на итерацию: Stats и обработчики берут время из LoopClock
+        uint64_t wake = LoopClock::tick();
 
         for (int i = 0; i < nfds; ++i) {
             int fd = events[i].data.fd;
             uint32_t evs = events[i].events;
+            wakeup_latency_.record(elapsedSince(FastClock::nowNs(), wake));
 
             // close socket
             if (evs & (EPOLLHUP | EPOLLRDHUP | EPOLLERR)) {
@@ -133,6 +146,7 @@ void Epoll::exec()
                         // epoll_ctl(wakeup_fd, EPOLL_CTL_ADD, fd, &ev);
                         // ++count_socks;
                     }
+                    migrate_clients();
                 }else
                     if (fd == STDIN_FILENO) handle_stdin();
                     else if (fd == timerfd) handle_timer();
@@ -140,6 +154,7 @@ void Epoll::exec()
                     else if (clients.count(fd)) handle_client_data(fd);
             }
         }
+        busy_ns += elapsedSince(FastClock::nowNs(), wake);
     }
 }
 
@@ -243,6 +258,8 @@ void Epoll::handle_client_data(int fd) {
             // std::unique_lock lock(mtx_clients); // чтение - Запись? unique_lock
             clients[fd].addBytes(n);
         }
+        bump(counters_.rx_bytes, n);
+        ++rx_calls_;
         if (write_to_stdout(buffer, SERVER_WRITE_STDOUT?n:0) != 0) {
             throw std::runtime_error("write to stdout");
         }
@@ -336,13 +353,13 @@ void Epoll::accept_connections()
         st.ip = std::string(ip_str) + ":" + std::to_string(ntohs(client_addr.sin_port));
 
         // тут надо распределять это все по потокам
-        if (!balance_socket(client_fd, st)){
+        if (!balance_socket(client_fd, st, client_addr.sin_addr.s_addr)){
             // если надо добавить все в текущем потоке, то очередь для сокетов не нужна
             // std::cout << "not balance_socket " << std::endl;
             if (!add_fd(client_fd, EPOLLIN | EPOLLRDHUP )){
                 close(client_fd);
             }else{
-                size_clients++;
+                inbox_.handed_in.fetch_add(1, std::memory_order_relaxed);
                 clients.emplace(client_fd, std::move(st));
                 // std::cout << "Added socket: " << client_fd << " (" << clients[client_fd].ip << ")" << std::endl;
             }
@@ -358,19 +375,34 @@ void Epoll::handle_timer()
     uint64_t expirations;
     if (read(timerfd, &expirations, sizeof(expirations)) != sizeof(expirations)) return;
 
+    // занятость цикла за интервал
+    uint64_t now_busy = LoopClock::nowNs();
+    uint64_t window_ns = elapsedSince(now_busy, busy_window_start);
+    double busy = 0;
+    if (window_ns > 0) {
+        busy = std::min(1.0, double(busy_ns) / window_ns);
+    }
+    busy_ns = 0;
+    busy_window_start = now_busy;
+
     // update stats
     {
+        double bps = 0;
         // std::unique_lock lock(mtx_clients); // чтение (запись)
         for (auto& [fd, stats] : clients) {
             stats.updateBps();
+            bps += stats.current_bps;
             std::string stats_msg;
             if (stats.checkFourGigabytes(stats_msg)) {
                 send(fd, stats_msg.c_str(), stats_msg.size(), MSG_NOSIGNAL);
             }
         }
+        publish_stats(bps, busy);
     }
 
 
+    rebalance();
+
     if (show_timer_stats){
         std::cout << "========\n";
         show_shared_stats();
@@ -381,6 +413,12 @@ void Epoll::handle_timer()
 }
 
 void Epoll::remove_client(int fd) {
+    // мог уехать в другой воркер в этой же пачке событий, тогда fd уже не наш:
+    // только снимаем со своего epoll, не закрываем
+    if (!clients.count(fd)) {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+        return;
+    }
     // count_fd--;
     epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
     {
@@ -388,19 +426,72 @@ void Epoll::remove_client(int fd) {
         clients.erase(fd);
     }
 
-    size_clients--;
+    bump(counters_.gone);
     close(fd);
 }
 
-uint64_t Epoll::print_clients_stats()
+void Epoll::publish_stats(double bps, double busy)
 {
-    uint64_t total_bps = 0;
-    // std::shared_lock lock(mtx_clients);// чтение
+    WorkerSummary s;
+    s.clients = clients.size();
+    s.rx_bytes = counters_.rx_bytes.load(std::memory_order_relaxed);
+    s.bps = bps;
+    s.busy = busy;
+    {
+        std::lock_guard lock(mtx_pending_new_socks_);
+        s.pending = pending_new_socks_.size();
+    }
+    if (perf_.isOpen()) {
+        s.perf = perf_.sample(s.rx_bytes - perf_rx_bytes_, rx_calls_);
+        perf_rx_bytes_ = s.rx_bytes;
+        rx_calls_ = 0;
+    }
+    summary_.store(s);
+
+    // раз в тик, непрочитанный прошлый выкидывается.
+    // строки (Stats с ip) копируем только для top, остальным хватает bps
+    auto snap = std::make_unique<ClientsSnapshot>();
+    snap->detailed = g_dump_clients.load(std::memory_order_relaxed);
+    snap->bps.reserve(clients.size());
+    std::vector<const Stats*> order;
+    order.reserve(clients.size());
     for (auto& c: clients){
-        std::cout << "\n" << c.second.get_stats();
-        total_bps += c.second.current_bps;
+        snap->bps.push_back(c.second.current_bps);
+        order.push_back(&c.second);
+    }
+    size_t n = snap->detailed ? order.size() : std::min<size_t>(STATS_TOP_N, order.size());
+    ShmWorker* shm = shm_.load(std::memory_order_acquire);
+    size_t listed = shm ? std::min<size_t>(shm->capacity, order.size()) : 0;
+    std::partial_sort(order.begin(), order.begin() + std::max(n, listed), order.end(), [](const Stats* a, const Stats* b) {
+        return a->current_bps > b->current_bps;
+    });
+    snap->top.reserve(n);
+    for (size_t i = 0; i < n; ++i){
+        snap->top.push_back(*order[i]);
+    }
+    clients_snapshot_.publish(std::move(snap));
+
+    if (shm) {
+        uint64_t now = LoopClock::nowNs();
+        shm_write_begin(shm);
+        shm->tick++;
+        shm->clients = s.clients;
+        shm->rx_bytes = s.rx_bytes;
+        shm->bps = s.bps;
+        shm->busy = s.busy;
+        shm->pending = s.pending;
+        ShmClient* list = shm_clients(shm);
+        for (size_t i = 0; i < listed; ++i){
+            const Stats& st = *order[i];
+            std::strncpy(list[i].ip, st.ip.c_str(), SHM_IP_LEN - 1);
+            list[i].ip[SHM_IP_LEN - 1] = 0;
+            list[i].bps = st.current_bps;
+            list[i].total_bytes = st.total_bytes;
+            list[i].age_ms = elapsedSince(now, st.start_ns) / 1000000;
+        }
+        shm->listed = static_cast<uint32_t>(listed);
+        shm_write_end(shm);
     }
-    return total_bps;
 }
 
 void Epoll::push_external_socket(int client_fd, const Stats &st) {
@@ -408,12 +499,58 @@ void Epoll::push_external_socket(int client_fd, const Stats &st) {
         std::lock_guard lock(mtx_pending_new_socks_);
         pending_new_socks_.push(std::make_pair(client_fd, std::move(st)));
         // добавляем тут, чтобы балансировка проходила корректно
-        size_clients++;
+        inbox_.handed_in.fetch_add(1, std::memory_order_relaxed);
     }
     uint64_t one = 1;
     write(wakeup_fd, &one, sizeof(one)); // разбудить epoll
 }
 
+void Epoll::request_migration(Epoll* to, double bps) {
+    {
+        std::lock_guard lock(mtx_migrate_);
+        migrate_to_ = to;
+        migrate_bps_ = bps;
+    }
+    uint64_t one = 1;
+    write(wakeup_fd, &one, sizeof(one));
+}
+
+void Epoll::migrate_clients() {
+    Epoll* to;
+    double want;
+    {
+        std::lock_guard lock(mtx_migrate_);
+        to = migrate_to_;
+        want = migrate_bps_;
+        migrate_to_ = nullptr;
+    }
+    if (!to || to == this) return;
+
+    // сначала тяжелые, меньше переносов; клиент тяжелее want только перевернет перекос
+    std::vector<std::pair<double, int>> candidates;
+    for (auto& [fd, stats] : clients) {
+        if (stats.current_bps > 0 && stats.current_bps <= want) {
+            candidates.emplace_back(stats.current_bps, fd);
+        }
+    }
+    std::sort(candidates.begin(), candidates.end(), std::greater<>());
+
+    int moved = 0;
+    for (auto& [bps, fd] : candidates) {
+        if (moved >= MAX_MIGRATE_PER_ROUND || want <= 0) break;
+        if (bps > want) continue;
+        // непрочитанное остается в сокете, level-triggered epoll на новом месте сразу его отдаст
+        epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+        auto node = clients.extract(fd);
+        bump(counters_.gone);
+        to->push_external_socket(fd, node.mapped());
+        want -= bps;
+        moved++;
+    }
+    if (moved) {
+        d("migrated " << moved << " clients")
+    }
+}
 
 void listen_mode_epoll(int port)
 {
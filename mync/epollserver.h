@@ -3,20 +3,44 @@
 
 #include <algorithm>
 #include <atomic>
+#include <future>
 #include <mutex>
 #include <shared_mutex>
 #include <queue>
 #include <sys/epoll.h>
+#include <arpa/inet.h>
 #include <sys/eventfd.h>
 #include <unordered_map>
 #include <vector>
 #include "stats.h"
+#include "balancer.h"
+#include "topology.h"
+#include "arena.h"
+#include "statsnap.h"
+#include "histogram.h"
+#include "metrics.h"
+#include "shmstats.h"
+#include "perfcounters.h"
 
 #define ONE_THREAD_MODE 0
 #define COUNT_HANDLER_THREADS 4
 #define SERVER_WRITE_STDOUT 0
 #define CLIENT_SELF_SEND_1gbps 0
 #define TIMER_STATS_TIMEOUT_SECS 1 // 1s
+#define BALANCE_POLICY BalancePolicy::LEAST_CONN // LEAST_BPS - по трафику, метрика отстает на интервал
+#define WORKER_PLACEMENT Placement::NUMA
+#define NIC_IRQ_NAME ""             // подстрока в /proc/interrupts для Placement::IRQ, например "eth0" или "mlx5"
+// перенос соединений с горячего воркера на холодный
+#define REBALANCE_EVERY_TICKS 5     // раз в 5 тиков таймера статистики, метрики успевают устояться
+#define REBALANCE_HOT_RATIO 1.5     // горячий - больше среднего в 1.5 раза
+#define REBALANCE_MIN_BPS 100e6     // и больше 100 mbps, мелочь не двигаем
+#define MAX_MIGRATE_PER_ROUND 16
+#define METRICS_PORT 0              // http /metrics для Prometheus, 0 - выключено
+#define METRICS_HOST "127.0.0.1"    // только локально; "0.0.0.0" - скрейпер с другой машины
+#define SHM_STATS 0                 // 1 - снимки воркеров в /dev/shm/mync-<port>, смотреть mynctop <port>
+#define SHM_MAX_CLIENTS 256         // клиентов на воркер в сегменте, самые быстрые
+#define PERF_COUNTERS 0             // 1 - perf_event_open в каждом воркере: IPC, такты на байт и на recv в отчете
+#define STATS_TOP_N 10              // в отчете раз в секунду только самые быстрые, все клиенты - по SIGUSR1
 
 #define d(x) std::cout << x << std::endl;
 const size_t BUF_SIZE = 65536;//1024;
@@ -24,6 +48,25 @@ const size_t BUF_SIZE = 65536;//1024;
 
 
 void stop_signal_handler(int signal);
+// SIGUSR1: в следующем отчете все клиенты, а не только STATS_TOP_N
+void dump_signal_handler(int signal);
+extern std::atomic<bool> g_dump_clients;
+
+// сводка воркера за тик таймера статистики
+struct WorkerSummary {
+    uint64_t clients = 0;
+    uint64_t rx_bytes = 0;
+    double bps = 0;  // сумма current_bps клиентов
+    double busy = 0; // доля времени exec в обработчиках, 0..1
+    uint64_t pending = 0; // сокеты в pending_new_socks_, еще не в epoll
+    PerfReport perf; // PERF_COUNTERS, packets - вызовы recv
+};
+// клиенты воркера на момент тика: bps всех для перцентилей, строки - только у быстрых
+struct ClientsSnapshot {
+    std::vector<double> bps;
+    std::vector<Stats> top; // STATS_TOP_N по убыванию bps, все клиенты если detailed
+    bool detailed = false;
+};
 
 
 class Epoll {
@@ -37,9 +80,14 @@ class Epoll {
     int timerfd = -1;
 
     //c
-    std::unordered_map<int, Stats> clients;// todo переделать id?
+    // узлы из арены своего потока: accept и удаление идут в нем же
+    std::unordered_map<int, Stats, std::hash<int>, std::equal_to<int>,
+                       ArenaAllocator<std::pair<const int, Stats>>> clients;// todo переделать id?
 
     time_t start_time;
+    // время в обработчиках с начала окна, окно = интервал таймера статистики
+    int64_t busy_ns = 0;
+    uint64_t busy_window_start = FastClock::nowNs();
 
     char buffer[BUF_SIZE];// 65536 65Kb
     bool stdin_closed = false;
@@ -58,6 +106,25 @@ class Epoll {
     inline void handle_timer();
 
     void remove_client(int fd);
+    void migrate_clients();
+    // раз в тик: сводка и список клиентов для агрегатора
+    void publish_stats(double bps, double busy);
+
+    // пишет только свой поток, остальные читают
+    WorkerCounters counters_;
+    InboxCounter inbox_;
+    SeqLock<WorkerSummary> summary_;
+    SnapshotMailbox<ClientsSnapshot> clients_snapshot_;
+    LatencyHistogram wakeup_latency_; // epoll_wait вернулся -> обработчик события
+    std::atomic<ShmWorker*> shm_{nullptr}; // слот в сегменте mynctop, если включен
+    PerfCounters perf_; // счетчики PMU потока exec
+    uint64_t perf_rx_bytes_ = 0; // rx_bytes на прошлом тике
+    uint64_t rx_calls_ = 0; // recv с прошлого тика
+
+    // запрос на перенос от MainEpoll, забираем по wakeup_fd
+    std::mutex mtx_migrate_;
+    Epoll* migrate_to_ = nullptr;
+    double migrate_bps_ = 0;
 
 public:
     Epoll(int sock, bool listen, int show_timer_stats);
@@ -66,22 +133,47 @@ public:
 
     void exec();
 
-    virtual bool balance_socket(int client_fd, Stats &st){return false;};
+    // ip - адрес клиента в сетевом порядке, для BalancePolicy::IP_HASH
+    virtual bool balance_socket(int client_fd, Stats &st, uint32_t ip){return false;};
     virtual void show_shared_stats(){};
+    // из handle_timer, MainEpoll двигает соединения между воркерами
+    virtual void rebalance(){};
 
-    // тут только читаем это, не нужен атомик?
-    std::atomic_int size_clients = 0;
+    // соединений сейчас, из любого потока: отданные минус ушедшие.
+    // два relaxed счетчика читаются не атомарно вместе - разница может на миг уйти в минус, зажимаем в 0
     int count_clients(){
-        return size_clients;
+        uint64_t gone = counters_.gone.load(std::memory_order_relaxed);
+        uint64_t in = inbox_.handed_in.load(std::memory_order_relaxed);
+        return in > gone ? int(in - gone) : 0;
+    }
+    // нагрузка за последний тик TIMER_STATS_TIMEOUT_SECS, из любого потока
+    WorkerSummary summary() const {
+        return summary_.load();
+    }
+    // живые счетчики, из любого потока
+    uint64_t rx_bytes() const {
+        return counters_.rx_bytes.load(std::memory_order_relaxed);
+    }
+    LatencySnapshot wakeup_latency() const {
+        return wakeup_latency_.snapshot();
+    }
+    // с этого тика снимки идут и в разделяемую память
+    void set_shm_slot(ShmWorker* w){
+        shm_.store(w, std::memory_order_release);
+    }
+    // последний опубликованный снимок клиентов, только поток агрегатора; nullptr - еще не было тика
+    const ClientsSnapshot* latest_clients(){
+        return clients_snapshot_.latest();
     }
-    // std::shared_mutex mtx_clients;
-    // return total bps
-    uint64_t print_clients_stats();
 
     // очередь для передачи сокетов между потоками
     void push_external_socket(int client_fd, const Stats &st);
+    // можно из любого потока: отдать to соединений примерно на bps трафика.
+    // переносит свой поток: снимает fd со своего epoll и кладет в очередь to
+    void request_migration(Epoll* to, double bps);
     int wakeup_fd = -1; // для пробуждения epoll
-    std::queue<std::pair<int, Stats>> pending_new_socks_; // новые сокеты от MainEpoll
+    // новые сокеты от MainEpoll; кладет MainEpoll из своей арены, освобождает воркер через remote-free
+    std::queue<std::pair<int, Stats>, std::deque<std::pair<int, Stats>, ArenaAllocator<std::pair<int, Stats>>>> pending_new_socks_;
     std::mutex mtx_pending_new_socks_; // защищает очередь
 
 };
@@ -98,18 +190,31 @@ inline static int SetAffinityMask(int core_id) noexcept {
 }
 
 struct ThreadData {
-    Epoll* subepoll;
     int core_id;
+    int node; // -1 - память как получится
+    std::promise<Epoll*> ready;
 
     static void* worker_thread_func(void* arg) {
         ThreadData* data = static_cast<ThreadData*>(arg);
 
         // Привязываем поток к конкретному ядру
         SetAffinityMask(data->core_id);
+        bindMemoryToNode(data->node);
+
+        // создаем уже на своем ядре: буфер и таблица клиентов попадут в память своего узла.
+        // исключение из потока - std::terminate, поэтому отдаем его в future ждущему MainEpoll
+        Epoll* subepoll;
+        try {
+            subepoll = new Epoll(-1, false, false);
+        } catch (...) {
+            data->ready.set_exception(std::current_exception());
+            delete data;
+            return nullptr;
+        }
+        data->ready.set_value(subepoll);
+        subepoll->exec();
 
-        data->subepoll->exec();
-
-        delete data->subepoll;
+        // subepoll удаляет MainEpoll после join: его могут читать метрики
         delete data;
 
         return nullptr;
@@ -121,54 +226,158 @@ class MainEpoll : public Epoll{
 public:
     MainEpoll(int sock, bool isl) : Epoll(sock, isl, true)
     {
-        if (SetAffinityMask(0) < 0){
-            std::cout << "fail set main process to 1 core" << std::endl;
-        }
         size_t num_workers = ONE_THREAD_MODE?0:COUNT_HANDLER_THREADS;
 
+        topo_ = Topology::discover(NIC_IRQ_NAME);
+        const Topology& topo = topo_;
+        int main_cpu = 0;
+        std::vector<int> cores = topo.placeWorkers(WORKER_PLACEMENT, num_workers, main_cpu);
+        if (SetAffinityMask(main_cpu) < 0){
+            std::cout << "fail set main process to core " << main_cpu << std::endl;
+        }
+
         pthread_t thread;
         pthread_attr_t attr;
         pthread_attr_init(&attr);
 
         for (size_t i = 0; i < num_workers; ++i) {
-            Epoll* subepoll = new Epoll(-1, false, false);
+            int node = WORKER_PLACEMENT == Placement::LEGACY ? -1 : topo.nodeOf(cores[i]);
 
             // Создаем поток с привязкой к ядру
-            ThreadData* thread_data = new ThreadData{subepoll, static_cast<int>(i + 1)};
+            ThreadData* thread_data = new ThreadData{cores[i], node, {}};
+            std::future<Epoll*> subepoll = thread_data->ready.get_future();
             if (pthread_create(&thread, &attr, &ThreadData::worker_thread_func, thread_data) == 0) {
+                Epoll* worker;
+                try {
+                    worker = subepoll.get();
+                } catch (const std::exception& e) {
+                    // воркер не поднялся (epoll/eventfd), работаем на оставшихся
+                    pthread_join(thread, nullptr);
+                    std::cerr << "worker " << i << " failed: " << e.what() << std::endl;
+                    continue;
+                }
                 workers_.emplace_back(thread);
-                subepolls_.emplace_back(subepoll);
+                subepolls_.emplace_back(worker);
+                worker_node_.emplace_back(std::max(node, 0));
+                std::cout << "worker " << subepolls_.size() << ": cpu " << cores[i] << ", node " << node << std::endl;
                 // thread_data_storage_.emplace_back(thread_data);
             } else {
-                delete subepoll;
                 delete thread_data;
                 std::cerr << "Failed to create thread " << i << std::endl;
             }
         }
+        balancer_.setWorkers(subepolls_.size());
+
+        // группы воркеров по узлам, в каждой свой балансировщик
+        for (size_t i = 0; i < subepolls_.size(); ++i) {
+            if ((size_t)worker_node_[i] >= node_groups_.size()) {
+                node_groups_.resize(worker_node_[i] + 1);
+            }
+            node_groups_[worker_node_[i]].workers.push_back(i);
+        }
+        for (NodeGroup& g : node_groups_) {
+            g.balancer.setPolicy(BALANCE_POLICY);
+            g.balancer.setWorkers(g.workers.size());
+        }
+        for (int c : cores) {
+            if (topo.nodeOf(c) > 0) {
+                numa_ = true; // воркеры больше чем на одном узле
+            }
+        }
 
         pthread_attr_destroy(&attr);
+
+        if (SHM_STATS) {
+            sockaddr_in addr{};
+            socklen_t len = sizeof(addr);
+            getsockname(sock, (sockaddr*)&addr, &len);
+            shm_segment_ = ShmStatsSegment::create(ntohs(addr.sin_port), subepolls_.size() + 1, SHM_MAX_CLIENTS);
+            if (shm_segment_) {
+                set_shm_slot(shm_segment_->worker(0));
+                for (size_t i = 0; i < subepolls_.size(); ++i) {
+                    subepolls_[i]->set_shm_slot(shm_segment_->worker(i + 1));
+                }
+                std::cout << "stats in /dev/shm" << shm_segment_->name() << std::endl;
+            } else {
+                perror("shm stats");
+            }
+        }
+
+        if (METRICS_PORT > 0) {
+            metrics_ = std::make_unique<MetricsServer>(METRICS_HOST, METRICS_PORT, [this]{ return render_metrics(); });
+            if (!metrics_->start()) {
+                metrics_.reset();
+            }
+        }
     }
 
     // true отдали, false забирай себе на обработку
     // это тормозит, но только на 1 listener
-    bool balance_socket(int client_fd, Stats &st){
-        // нужен мутекс на балансере
+    bool balance_socket(int client_fd, Stats &st, uint32_t ip){
+        // balancer_ трогает только этот поток (accept), мутекс не нужен
 
-        if (ONE_THREAD_MODE){
+        if (ONE_THREAD_MODE || subepolls_.empty()){
             return false;
         }
 
-        Epoll* min_subepoll = *std::min_element (subepolls_.begin(), subepolls_.end(), [](Epoll* a, Epoll* b) {
-            return a->count_clients() < b->count_clients();
-        });
+        auto load = [this](size_t i){
+            Epoll* e = subepolls_[i];
+            WorkerSummary s = e->summary();
+            return WorkerLoad{e->count_clients(), s.bps, s.busy};
+        };
+        size_t i;
+        // пакеты соединения уже пришли на узел, где сетевуха отдала прерывание - туда и воркер
+        int node = numa_ ? node_of_cpu(incomingCpu(client_fd)) : -1;
+        if (node >= 0 && (size_t)node < node_groups_.size() && !node_groups_[node].workers.empty()) {
+            const std::vector<size_t>& w = node_groups_[node].workers;
+            i = w[node_groups_[node].balancer.pick([&](size_t j){ return load(w[j]); }, ip)];
+        } else {
+            i = balancer_.pick(load, ip);
+        }
 
         // if (count_clients() < min_subepoll->count_clients()){
         //     return false;// тут делаем
         // }
-        min_subepoll->push_external_socket(client_fd, st);
+        subepolls_[i]->push_external_socket(client_fd, st);
         return true;
     }
 
+    // горячий воркер отдает часть соединений холодному, в пределах своего узла NUMA
+    void rebalance(){
+        if (ONE_THREAD_MODE || subepolls_.size() < 2) {
+            return;
+        }
+        if (++rebalance_ticks_ < REBALANCE_EVERY_TICKS) {
+            return;
+        }
+        rebalance_ticks_ = 0;
+
+        std::vector<double> load(subepolls_.size());
+        for (size_t i = 0; i < subepolls_.size(); ++i) {
+            load[i] = subepolls_[i]->summary().bps;
+        }
+        auto bps = [&load](size_t i){ return load[i]; };
+        for (const NodeGroup& g : node_groups_) {
+            if (g.workers.size() < 2) {
+                continue;
+            }
+            double total = 0;
+            for (size_t i : g.workers) {
+                total += bps(i);
+            }
+            auto [cold, hot] = std::minmax_element(g.workers.begin(), g.workers.end(), [&](size_t a, size_t b) {
+                return bps(a) < bps(b);
+            });
+            double hot_bps = bps(*hot);
+            double avg = total / g.workers.size();
+            if (hot_bps < REBALANCE_MIN_BPS || hot_bps < avg * REBALANCE_HOT_RATIO) {
+                continue;
+            }
+            // половина разницы: оба окажутся около середины
+            subepolls_[*hot]->request_migration(subepolls_[*cold], (hot_bps - bps(*cold)) / 2);
+        }
+    }
+
     void show_shared_stats(){
 
         int c = 1;
@@ -182,10 +391,59 @@ public:
         }
         std::cout  << " = " << all_clients << std::endl;
 
-        uint64_t total_bps = 0;
-        total_bps += print_clients_stats();
+        if (PERF_COUNTERS) {
+            PerfReport total = summary().perf;
+            std::cout << "\t\tperf main: " << total.toString() << "\n";
+            for (size_t i = 0; i < subepolls_.size(); ++i) {
+                PerfReport p = subepolls_[i]->summary().perf;
+                std::cout << "\t\tperf " << i + 1 << ": " << p.toString() << "\n";
+                total.merge(p);
+            }
+            std::cout << "\t\tperf total: " << total.toString() << "\n";
+        }
+
+        // только снимки воркеров с их последнего тика, их clients отсюда не трогаем
+        double total_bps = summary().bps;
+        std::vector<const ClientsSnapshot*> snaps{latest_clients()};
         for (Epoll* e: subepolls_){
-            total_bps += e->print_clients_stats();
+            snaps.push_back(e->latest_clients());
+            total_bps += e->summary().bps;
+        }
+
+        std::vector<double> bps;
+        std::vector<const Stats*> top;
+        bool detailed = g_dump_clients.load(std::memory_order_relaxed);
+        bool all_detailed = true;
+        for (const ClientsSnapshot* s: snaps){
+            if (!s) {
+                continue;
+            }
+            bps.insert(bps.end(), s->bps.begin(), s->bps.end());
+            for (const Stats& st: s->top){
+                top.push_back(&st);
+            }
+            all_detailed = all_detailed && s->detailed;
+        }
+        // лучшие среди лучших каждого воркера - это общий top
+        size_t n = detailed ? top.size() : std::min<size_t>(STATS_TOP_N, top.size());
+        std::partial_sort(top.begin(), top.begin() + n, top.end(), [](const Stats* a, const Stats* b) {
+            return a->current_bps > b->current_bps;
+        });
+
+        if (!bps.empty()) {
+            std::cout << "\t\tclients bps:"
+                      << "\tp50 " << Stats::formatValue(Stats::percentile(bps, 0.50), "bps")
+                      << "\tp90 " << Stats::formatValue(Stats::percentile(bps, 0.90), "bps")
+                      << "\tp99 " << Stats::formatValue(Stats::percentile(bps, 0.99), "bps")
+                      << "\tmax " << Stats::formatValue(Stats::percentile(bps, 1.0), "bps") << "\n";
+            std::cout << (detailed && all_detailed ? "all clients:" : "top " + std::to_string(n) + ":");
+        }
+        for (size_t i = 0; i < n; ++i){
+            std::cout << "\n" << top[i]->get_stats();
+        }
+        // воркеры прислали полные списки - запрос выполнен
+        if (detailed && all_detailed) {
+            g_dump_clients.store(false, std::memory_order_relaxed);
         }
 
         // total
@@ -193,7 +451,54 @@ public:
         std::cout << std::endl;
     }
 
+    // из потока MetricsServer: только снимки и relaxed счетчики, воркеров не ждем
+    std::string render_metrics(){
+        std::vector<Epoll*> all{this};
+        all.insert(all.end(), subepolls_.begin(), subepolls_.end());
+        std::vector<WorkerSummary> sum;
+        for (Epoll* e: all){
+            sum.push_back(e->summary());
+        }
+        // main - воркер 0, он же принимает соединения
+        auto label = [](size_t i){ return "worker=\"" + std::to_string(i) + "\""; };
+
+        PromWriter w;
+        w.family("mync_clients", "gauge", "Open connections per worker.");
+        for (size_t i = 0; i < all.size(); ++i){
+            w.sample("mync_clients", label(i), uint64_t(all[i]->count_clients()));
+        }
+        w.family("mync_rx_bytes_total", "counter", "Bytes received from clients.");
+        for (size_t i = 0; i < all.size(); ++i){
+            w.sample("mync_rx_bytes_total", label(i), all[i]->rx_bytes());
+        }
+        w.family("mync_rx_bits_per_second", "gauge", "Receive rate over the last stats tick.");
+        for (size_t i = 0; i < all.size(); ++i){
+            w.sample("mync_rx_bits_per_second", label(i), sum[i].bps);
+        }
+        w.family("mync_loop_utilization", "gauge", "Share of the last tick spent in event handlers, 0..1.");
+        for (size_t i = 0; i < all.size(); ++i){
+            w.sample("mync_loop_utilization", label(i), sum[i].busy);
+        }
+        w.family("mync_pending_sockets", "gauge", "Accepted sockets queued for the worker at the last tick.");
+        for (size_t i = 0; i < all.size(); ++i){
+            w.sample("mync_pending_sockets", label(i), sum[i].pending);
+        }
+        w.family("mync_wakeup_latency_seconds", "summary", "Time from epoll_wait return to the event handler.");
+        for (size_t i = 0; i < all.size(); ++i){
+            LatencySnapshot s = all[i]->wakeup_latency();
+            for (double q: {0.5, 0.99, 0.999}){
+                char qs[16];
+                snprintf(qs, sizeof(qs), "%g", q);
+                w.sample("mync_wakeup_latency_seconds", label(i) + ",quantile=\"" + qs + "\"", s.percentile(q) / 1e9);
+            }
+            w.sample("mync_wakeup_latency_seconds_sum", label(i), s.sum() / 1e9);
+            w.sample("mync_wakeup_latency_seconds_count", label(i), s.count());
+        }
+        return w.take();
+    }
+
     ~MainEpoll() {
+        metrics_.reset();
         // this->Epoll::fullstop();
         // for (auto* subepoll : subepolls_) {
         //     if (subepoll) {
@@ -204,6 +509,9 @@ public:
         for (auto& thread : workers_) {
             pthread_join(thread, nullptr);
         }
+        for (Epoll* e : subepolls_) {
+            delete e;
+        }
 
         // for (auto* data : thread_data_storage_) {
         //     delete data;
@@ -217,6 +525,23 @@ public:
 private:
     std::vector<pthread_t> workers_;
     std::vector<Epoll*> subepolls_;
+    std::vector<int> worker_node_; // узел NUMA воркера i
+    Balancer balancer_{BALANCE_POLICY};
+
+    struct NodeGroup {
+        std::vector<size_t> workers; // индексы в subepolls_
+        Balancer balancer;
+    };
+    std::vector<NodeGroup> node_groups_; // по номеру узла
+    bool numa_ = false;
+
+    int node_of_cpu(int cpu) const {
+        return cpu < 0 ? -1 : topo_.nodeOf(cpu);
+    }
+    Topology topo_;
+    int rebalance_ticks_ = 0;
+    std::unique_ptr<MetricsServer> metrics_;
+    std::unique_ptr<ShmStatsSegment> shm_segment_; // после join воркеров, они в него пишут
     // std::vector<ThreadData*> thread_data_storage_;
 };
 
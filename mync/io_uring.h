@@ -5,6 +5,7 @@
 #include <sys/timerfd.h>
 #include <unordered_map>
 #include "stats.h"
+#include "../netlib/bufpool.h"
 /*
 static void bidirectional_relay_io_uring(int sockfd, bool islisten) {
     const size_t BUF_SIZE = 65536;
@@ -179,8 +180,25 @@ class UringBidirectionalRelay {
         // Для accept храним информацию о клиенте
         sockaddr_in* client_addr = nullptr;
         socklen_t* addr_len = nullptr;
+        PoolBuffer pooled; // буфер чтения из пула, вернется туда вместе с delete req
     };
 
+    // чтение на 64 КБ: буфер из huge page пула вместо new char[] на каждый запрос
+    static Request* new_read_request(OpType type, int fd) {
+        auto* req = new Request{type, fd, nullptr, 0};
+        req->pooled = BufferPool::recvPool().acquire();
+        req->buffer = req->pooled.data();
+        req->buffer_size = req->pooled.capacity();
+        return req;
+    }
+
+    static void free_request(Request* req) {
+        if (!req->pooled) {
+            delete[] req->buffer; // у таймера свой маленький буфер
+        }
+        delete req;
+    }
+
     void setup_uring() {
         if (io_uring_queue_init(64, &ring, 0) < 0) {
             throw std::runtime_error("io_uring_queue_init failed");
@@ -208,7 +226,7 @@ class UringBidirectionalRelay {
             if (!sqe) return;
         }
 
-        auto *req = new Request{OpType::STDIN_READ, STDIN_FILENO, new char[65536], 65536};
+        auto *req = new_read_request(OpType::STDIN_READ, STDIN_FILENO);
         io_uring_prep_read(sqe, STDIN_FILENO, req->buffer, req->buffer_size, 0);
         io_uring_sqe_set_data(sqe, req);
     }
@@ -223,7 +241,7 @@ class UringBidirectionalRelay {
             if (!sqe) return;
         }
 
-        auto *req = new Request{OpType::SOCKET_READ, sockfd, new char[65536], 65536};
+        auto *req = new_read_request(OpType::SOCKET_READ, sockfd);
         io_uring_prep_recv(sqe, sockfd, req->buffer, req->buffer_size, 0);
         io_uring_sqe_set_data(sqe, req);
     }
@@ -295,7 +313,7 @@ class UringBidirectionalRelay {
             if (!sqe) return;
         }
 
-        auto *req = new Request{OpType::CLIENT_READ, client_fd, new char[65536], 65536};
+        auto *req = new_read_request(OpType::CLIENT_READ, client_fd);
         io_uring_prep_recv(sqe, client_fd, req->buffer, req->buffer_size, 0);
         io_uring_sqe_set_data(sqe, req);
     }
@@ -332,8 +350,7 @@ class UringBidirectionalRelay {
             stdin_closed = true;
         }
 
-        delete[] req->buffer;
-        delete req;
+        free_request(req);
 
         if (!stdin_closed) {
             submit_stdin_read();
@@ -353,8 +370,7 @@ class UringBidirectionalRelay {
             socket_closed = true;
         }
 
-        delete[] req->buffer;
-        delete req;
+        free_request(req);
 
         if (!socket_closed) {
             submit_socket_read();
@@ -416,8 +432,7 @@ class UringBidirectionalRelay {
         }
 
         // Resubmit timer
-        delete[] req->buffer;
-        delete req;
+        free_request(req);
 
         if (timerfd >= 0) {
             struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
@@ -435,8 +450,7 @@ class UringBidirectionalRelay {
         auto it = clients.find(client_fd);
 
         if (it == clients.end()) {
-            delete[] req->buffer;
-            delete req;
+            free_request(req);
             return;
         }
 
@@ -446,22 +460,19 @@ class UringBidirectionalRelay {
                 std::cerr << "write to stdout failed" << std::endl;
             }
 
-            delete[] req->buffer;
-            delete req;
+            free_request(req);
             submit_client_read(client_fd);
             io_uring_submit(&ring);
 
         } else if (res == 0) {
             // Client disconnected
             std::cout << "Client " << client_fd << " disconnected" << std::endl;
-            delete[] req->buffer;
-            delete req;
+            free_request(req);
             remove_client(client_fd);
         } else {
             // Error
             std::cerr << "Client " << client_fd << " read error: " << strerror(-res) << std::endl;
-            delete[] req->buffer;
-            delete req;
+            free_request(req);
             remove_client(client_fd);
         }
     }
@@ -31,6 +31,7 @@ int main(int argc, char* argv[])
         return 0;
     }
 
+    FastClock::calibrate(); // ~10 мс здесь, а не в первом воркере
     int count = 1;
     bool is_listen = false;
     string host = "127.0.0.1";
@@ -88,6 +89,8 @@ int main(int argc, char* argv[])
     sa.sa_flags = SA_RESTART; // Перезапуск системных вызовов при сигнале
     sigaction(SIGINT, &sa, NULL);
     sigaction(SIGTERM, &sa, NULL);
+    sa.sa_handler = dump_signal_handler;
+    sigaction(SIGUSR1, &sa, NULL);
 
     if (is_listen){
         listen_mode_epoll(port);
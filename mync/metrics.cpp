@@ -0,0 +1,169 @@
+#include "metrics.h"
+#include <arpa/inet.h>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+MetricsServer::MetricsServer(const std::string& host, int port, RenderFn render)
+    : host_(host), port_(port), render_(std::move(render)) {}
+
+MetricsServer::~MetricsServer(){
+    stop();
+}
+
+bool MetricsServer::start(){
+    listen_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd_ < 0) {
+        perror("metrics socket");
+        return false;
+    }
+    int one = 1;
+    setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port_);
+    if (inet_pton(AF_INET, host_.c_str(), &addr.sin_addr) != 1) {
+        std::cerr << "metrics: bad host " << host_ << std::endl;
+        close(listen_fd_);
+        listen_fd_ = -1;
+        return false;
+    }
+    if (bind(listen_fd_, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(listen_fd_, 16) < 0) {
+        perror("metrics bind");
+        close(listen_fd_);
+        listen_fd_ = -1;
+        return false;
+    }
+    stop_fd_ = eventfd(0, EFD_CLOEXEC);
+    th_ = std::thread([this]{ run(); });
+    std::cout << "metrics on http://" << host_ << ":" << port_ << "/metrics" << std::endl;
+    return true;
+}
+
+void MetricsServer::stop(){
+    if (th_.joinable()) {
+        uint64_t one = 1;
+        write(stop_fd_, &one, sizeof(one));
+        th_.join();
+    }
+    if (listen_fd_ >= 0) {
+        close(listen_fd_);
+        listen_fd_ = -1;
+    }
+    if (stop_fd_ >= 0) {
+        close(stop_fd_);
+        stop_fd_ = -1;
+    }
+}
+
+void MetricsServer::run(){
+    // только простой ядра; не вышло (нет прав/ядро не умеет) - просто самый низкий nice
+    sched_param sp{};
+    if (pthread_setschedparam(pthread_self(), SCHED_IDLE, &sp) != 0) {
+        setpriority(PRIO_PROCESS, 0, 19); // 0 - этот поток
+    }
+    pollfd fds[2] = {{listen_fd_, POLLIN, 0}, {stop_fd_, POLLIN, 0}};
+    while (true) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (fds[1].revents) {
+            break;
+        }
+        if (fds[0].revents & POLLIN) {
+            int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd >= 0) {
+                serve(fd);
+                close(fd);
+            }
+        }
+    }
+}
+
+static bool send_all(int fd, const char* p, size_t n){
+    while (n > 0) {
+        ssize_t sent = send(fd, p, n, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0) return false;
+        p += sent;
+        n -= sent;
+    }
+    return true;
+}
+
+void MetricsServer::serve(int fd){
+    // медленный клиент не держит поток дольше секунды
+    timeval tv{1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    char req[2048];
+    size_t len = 0;
+    while (len < sizeof(req) - 1) {
+        ssize_t n = recv(fd, req + len, sizeof(req) - 1 - len, 0);
+        if (n <= 0) return;
+        len += n;
+        req[len] = 0;
+        if (strstr(req, "\r\n\r\n")) break;
+    }
+    req[len] = 0;
+
+    std::string body;
+    const char* status = "200 OK";
+    if (strncmp(req, "GET /metrics ", 13) == 0 || strncmp(req, "GET / ", 6) == 0) {
+        body = render_();
+    } else {
+        status = "404 Not Found";
+        body = "try /metrics\n";
+    }
+    char head[160];
+    int hn = snprintf(head, sizeof(head),
+                      "HTTP/1.1 %s\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                      "Content-Length: %zu\r\nConnection: close\r\n\r\n", status, body.size());
+    if (send_all(fd, head, hn)) {
+        send_all(fd, body.data(), body.size());
+    }
+}
+
+void PromWriter::family(const char* name, const char* type, const char* help){
+    out_ += "# HELP ";
+    out_ += name;
+    out_ += ' ';
+    out_ += help;
+    out_ += "\n# TYPE ";
+    out_ += name;
+    out_ += ' ';
+    out_ += type;
+    out_ += '\n';
+}
+
+static void put_labels(std::string& out, const char* name, const std::string& labels){
+    out += name;
+    if (!labels.empty()) {
+        out += '{';
+        out += labels;
+        out += '}';
+    }
+    out += ' ';
+}
+
+void PromWriter::sample(const char* name, const std::string& labels, double value){
+    put_labels(out_, name, labels);
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.9g\n", value);
+    out_ += buf;
+}
+
+void PromWriter::sample(const char* name, const std::string& labels, uint64_t value){
+    put_labels(out_, name, labels);
+    out_ += std::to_string(value);
+    out_ += '\n';
+}
@@ -0,0 +1,53 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <thread>
+
+/*
+ * http GET /metrics в текстовом формате Prometheus (0.0.4).
+ * свой поток с SCHED_IDLE: работает, только когда ядро простаивает, воркеров не вытесняет.
+ * одно соединение за раз, ответ и close - скрейперу больше не нужно.
+ * render зовется в этом потоке на каждый запрос и должен читать только снимки.
+ */
+class MetricsServer {
+public:
+    using RenderFn = std::function<std::string()>;
+
+    // host - адрес для bind, наружу (0.0.0.0) только явно: метрики без авторизации
+    MetricsServer(const std::string& host, int port, RenderFn render);
+    ~MetricsServer();
+    MetricsServer(const MetricsServer&) = delete;
+    MetricsServer& operator=(const MetricsServer&) = delete;
+
+    bool start();
+    void stop();
+
+private:
+    void run();
+    void serve(int fd);
+
+    std::string host_;
+    int port_;
+    RenderFn render_;
+    int listen_fd_ = -1;
+    int stop_fd_ = -1; // eventfd, будит poll в run
+    std::thread th_;
+};
+
+// сборка текста: заголовок семейства один раз, потом строки с метками
+class PromWriter {
+public:
+    void family(const char* name, const char* type, const char* help);
+    // labels уже в виде worker="1",quantile="0.99" или пусто
+    void sample(const char* name, const std::string& labels, double value);
+    void sample(const char* name, const std::string& labels, uint64_t value);
+    std::string take() { return std::move(out_); }
+
+private:
+    std::string out_;
+};
+
+#endif // METRICS_H
@@ -0,0 +1,115 @@
+// живая статистика запущенного mync -l <port> из разделяемой памяти (SHM_STATS 1)
+// mynctop <port> [-1]   -1 - один снимок без очистки экрана, для скриптов
+
+#include "shmstats.h"
+#include "stats.h"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+
+static std::string format_ms(uint64_t ms){
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%02lu:%02lu:%02lu", (unsigned long)(ms / 3600000),
+             (unsigned long)(ms / 60000 % 60), (unsigned long)(ms / 1000 % 60));
+    return buf;
+}
+
+struct Row {
+    uint32_t worker;
+    ShmClient client;
+};
+
+static bool render(const char* base, bool once){
+    const ShmHeader* h = reinterpret_cast<const ShmHeader*>(base);
+    std::vector<char> slot;
+    std::vector<Row> rows;
+    double total_bps = 0;
+    uint64_t total_clients = 0;
+
+    std::ostringstream out;
+    if (!once) {
+        out << "\033[H\033[2J";
+    }
+    uint64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    out << "mync pid " << h->pid << "  up " << format_ms(now_ms - h->start_unix_ms)
+        << "  workers " << h->workers << "\n\n";
+    out << std::setw(6) << "worker" << std::setw(10) << "clients" << std::setw(16) << "rx"
+        << std::setw(10) << "busy" << std::setw(10) << "pending" << std::setw(16) << "rx total" << "\n";
+    for (uint32_t i = 0; i < h->workers; ++i) {
+        if (!shm_read_worker(base, i, slot)) {
+            out << std::setw(6) << i << "  (busy, skipped)\n";
+            continue;
+        }
+        const ShmWorker* w = reinterpret_cast<const ShmWorker*>(slot.data());
+        out << std::setw(6) << i << std::setw(10) << w->clients
+            << std::setw(16) << Stats::formatValue(w->bps, "bps")
+            << std::setw(9) << std::fixed << std::setprecision(1) << w->busy * 100 << "%"
+            << std::setw(10) << w->pending
+            << std::setw(16) << Stats::formatValue(double(w->rx_bytes), "B") << "\n";
+        total_bps += w->bps;
+        total_clients += w->clients;
+        const ShmClient* list = shm_clients(w);
+        for (uint32_t j = 0; j < std::min({w->listed, w->capacity, h->capacity}); ++j) {
+            rows.push_back(Row{i, list[j]});
+        }
+    }
+    out << std::setw(6) << "total" << std::setw(10) << total_clients
+        << std::setw(16) << Stats::formatValue(total_bps, "bps") << "\n\n";
+
+    std::sort(rows.begin(), rows.end(), [](const Row& a, const Row& b) { return a.client.bps > b.client.bps; });
+    out << std::setw(10) << "age" << "  " << std::setw(6) << "worker" << "  " << std::left << std::setw(24) << "client"
+        << std::right << std::setw(16) << "rx" << std::setw(16) << "rx total" << "\n";
+    for (const Row& r : rows) {
+        out << std::setw(10) << format_ms(r.client.age_ms) << "  " << std::setw(6) << r.worker << "  "
+            << std::left << std::setw(24) << r.client.ip << std::right
+            << std::setw(16) << Stats::formatValue(r.client.bps, "bps")
+            << std::setw(16) << Stats::formatValue(double(r.client.total_bytes), "B") << "\n";
+    }
+    std::cout << out.str() << std::flush;
+    return true;
+}
+
+int main(int argc, char* argv[]){
+    if (argc < 2) {
+        std::cout << "Usage: " << argv[0] << " <port> [-1]\n";
+        return 0;
+    }
+    std::string name = shm_stats_name(std::atoi(argv[1]));
+    bool once = argc > 2 && std::string(argv[2]) == "-1";
+
+    int fd = shm_open(name.c_str(), O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0) {
+        perror(("shm_open " + name + " (mync -l с SHM_STATS 1?)").c_str());
+        return 1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || size_t(st.st_size) < sizeof(ShmHeader)) {
+        std::cerr << name << ": too small\n";
+        return 1;
+    }
+    const char* base = static_cast<const char*>(mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0));
+    close(fd);
+    if (base == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+
+    const ShmHeader* h = reinterpret_cast<const ShmHeader*>(base);
+    if (!shm_layout_ok(base, size_t(st.st_size))) {
+        std::cerr << name << ": unknown layout (version " << h->version << ", want " << SHM_STATS_VERSION << ")\n";
+        return 1;
+    }
+
+    while (true) {
+        render(base, once);
+        if (once) {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+    return 0;
+}
@@ -0,0 +1,186 @@
+#ifndef SHMSTATS_H
+#define SHMSTATS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <new>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+/*
+ * статистика в разделяемой памяти /dev/shm/mync-<port> для mynctop.
+ * воркер раз в тик пишет свой слот под seqlock, читатель (другой процесс)
+ * копирует слот и проверяет seq - ни системных вызовов, ни форматирования на стороне сервера.
+ * раскладка версионная: читатель проверяет magic, version и размеры структур.
+ *
+ * [ShmHeader][слот воркера 0][слот 1]...  слот = ShmWorker + capacity * ShmClient, шаг worker_stride
+ */
+
+static constexpr uint32_t SHM_STATS_MAGIC = 0x434e594d; // "MYNC"
+static constexpr uint32_t SHM_STATS_VERSION = 1;
+static constexpr uint32_t SHM_STATS_MAX_WORKERS = 4096; // больше - заголовок битый
+static constexpr size_t SHM_IP_LEN = 48;
+
+struct ShmHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t worker_size;   // sizeof(ShmWorker)
+    uint32_t client_size;   // sizeof(ShmClient)
+    uint32_t worker_stride; // байт между слотами
+    uint32_t workers;       // 0 - main (accept), дальше воркеры
+    uint32_t capacity;      // клиентов на слот
+    int64_t pid;
+    uint64_t start_unix_ms;
+};
+static_assert(sizeof(ShmHeader) <= 64, "header takes the first cache line");
+
+struct ShmClient {
+    char ip[SHM_IP_LEN];
+    double bps;
+    uint64_t total_bytes;
+    uint64_t age_ms; // с подключения
+};
+
+struct alignas(64) ShmWorker {
+    std::atomic<uint64_t> seq; // нечетный - воркер пишет
+    uint64_t tick;
+    uint64_t clients;
+    uint64_t rx_bytes;
+    double bps;
+    double busy;
+    uint64_t pending;
+    uint32_t capacity; // задает создатель, дальше не меняется
+    uint32_t listed;   // заполнено ShmClient, самые быстрые первыми
+};
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "seq must work across processes");
+
+inline ShmClient* shm_clients(ShmWorker* w){
+    return reinterpret_cast<ShmClient*>(w + 1);
+}
+inline const ShmClient* shm_clients(const ShmWorker* w){
+    return reinterpret_cast<const ShmClient*>(w + 1);
+}
+
+inline std::string shm_stats_name(int port){
+    return "/mync-" + std::to_string(port);
+}
+
+// запись слота: begin, поля, end. один писатель - поток воркера
+inline void shm_write_begin(ShmWorker* w){
+    w->seq.store(w->seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+inline void shm_write_end(ShmWorker* w){
+    w->seq.store(w->seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+// сегмент со стороны сервера: создает, отдает слоты, при разрушении убирает имя
+class ShmStatsSegment {
+public:
+    static std::unique_ptr<ShmStatsSegment> create(int port, uint32_t workers, uint32_t capacity){
+        std::string name = shm_stats_name(port);
+        int fd = shm_open(name.c_str(), O_CREAT | O_RDWR | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd < 0) {
+            return nullptr;
+        }
+        fchmod(fd, 0600); // сегмент от прошлого запуска мог остаться с другими правами
+        size_t stride = (sizeof(ShmWorker) + capacity * sizeof(ShmClient) + 63) / 64 * 64;
+        size_t size = 64 + workers * stride; // заголовок занимает одну линию
+        void* p = MAP_FAILED;
+        if (ftruncate(fd, size) == 0) {
+            p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+        if (p == MAP_FAILED) {
+            shm_unlink(name.c_str());
+            return nullptr;
+        }
+        std::unique_ptr<ShmStatsSegment> seg(new ShmStatsSegment(name, static_cast<char*>(p), size));
+        for (uint32_t i = 0; i < workers; ++i) {
+            ShmWorker* w = new (seg->base_ + 64 + i * stride) ShmWorker{};
+            w->capacity = capacity;
+        }
+        ShmHeader h{};
+        h.magic = SHM_STATS_MAGIC;
+        h.version = SHM_STATS_VERSION;
+        h.header_size = sizeof(ShmHeader);
+        h.worker_size = sizeof(ShmWorker);
+        h.client_size = sizeof(ShmClient);
+        h.worker_stride = static_cast<uint32_t>(stride);
+        h.workers = workers;
+        h.capacity = capacity;
+        h.pid = getpid();
+        h.start_unix_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        std::memcpy(seg->base_, &h, sizeof(h));
+        return seg;
+    }
+
+    ~ShmStatsSegment(){
+        munmap(base_, size_);
+        shm_unlink(name_.c_str());
+    }
+
+    ShmWorker* worker(uint32_t i){
+        const ShmHeader* h = reinterpret_cast<const ShmHeader*>(base_);
+        return reinterpret_cast<ShmWorker*>(base_ + 64 + size_t(i) * h->worker_stride);
+    }
+    const std::string& name() const { return name_; }
+
+private:
+    ShmStatsSegment(std::string name, char* base, size_t size) : name_(std::move(name)), base_(base), size_(size) {}
+    std::string name_;
+    char* base_;
+    size_t size_;
+};
+
+// проверка заголовка чужого сегмента до любого индексирования; mapped - сколько байт отображено
+inline bool shm_layout_ok(const char* base, size_t mapped){
+    if (mapped < 64) {
+        return false;
+    }
+    const ShmHeader* h = reinterpret_cast<const ShmHeader*>(base);
+    if (h->magic != SHM_STATS_MAGIC || h->version != SHM_STATS_VERSION
+        || h->header_size != sizeof(ShmHeader) || h->worker_size != sizeof(ShmWorker)
+        || h->client_size != sizeof(ShmClient)) {
+        return false;
+    }
+    if (h->workers == 0 || h->workers > SHM_STATS_MAX_WORKERS) {
+        return false;
+    }
+    // все в uint64_t: uint32 * uint32 не переполняется
+    if (uint64_t(h->worker_stride) < sizeof(ShmWorker) + uint64_t(h->capacity) * sizeof(ShmClient)) {
+        return false;
+    }
+    return 64 + uint64_t(h->workers) * h->worker_stride <= mapped;
+}
+
+// чтение из другого процесса: копия слота, согласованная по seq. false - сегмент не наш или воркер все время пишет
+inline bool shm_read_worker(const char* base, uint32_t i, std::vector<char>& out){
+    const ShmHeader* h = reinterpret_cast<const ShmHeader*>(base);
+    const char* slot = base + 64 + size_t(i) * h->worker_stride;
+    const ShmWorker* w = reinterpret_cast<const ShmWorker*>(slot);
+    out.resize(h->worker_stride);
+    for (int attempt = 0; attempt < 1000; ++attempt) {
+        uint64_t s = w->seq.load(std::memory_order_acquire);
+        if (s & 1) {
+            continue;
+        }
+        std::memcpy(out.data(), slot, out.size());
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (w->seq.load(std::memory_order_relaxed) == s) {
+            return true;
+        }
+    }
+    return false;
+}
+
+#endif // SHMSTATS_H
@@ -6,7 +6,10 @@
 #include <iomanip>
 #include <iostream>
 #include <cstdint>
+#include <algorithm>
+#include <vector>
 #include <sstream>
+#include "fastclock.h"
 
 class Stats {
 private:
@@ -14,24 +17,25 @@ private:
     static constexpr uint64_t FOUR_GB = 4ULL * 1000 * 1000 * 1000;
 
 public:
-    std::chrono::steady_clock::time_point start_time;
+    // наносекунды LoopClock: в воркере - время текущей итерации, часы не трогаем
+    uint64_t start_ns = 0;
 
     // для битрейта
     uint64_t total_bytes = 0;
     uint64_t last_update_bytes = 0;
-    std::chrono::steady_clock::time_point last_update_time;
+    uint64_t last_update_ns = 0;
     // uint64_t total_packets = 0;
 
     // для определения 4gb
     uint64_t interval_bytes = 0;
-    std::chrono::steady_clock::time_point last_interval_time;
+    uint64_t last_interval_ns = 0;
 
     std::string ip;
     double current_bps = 0.0;
     // double current_pps = 0.0;
 
     Stats() {
-        last_update_time = last_interval_time = start_time = std::chrono::steady_clock::now();
+        last_update_ns = last_interval_ns = start_ns = LoopClock::nowNs();
     }
 
     void addBytes(size_t bytes) {
@@ -41,8 +45,9 @@ public:
     }
 
     void updateBps() {
-        auto now = std::chrono::steady_clock::now();
-        auto elapsed_ns = std::chrono::duration<double, std::nano>(now - last_update_time).count();
+        // Stats мог приехать из потока accept со свежей меткой
+        uint64_t now = LoopClock::nowNs();
+        double elapsed_ns = double(elapsedSince(now, last_update_ns));
 
         if (elapsed_ns <= 0) return;
 
@@ -52,21 +57,20 @@ public:
         // current_pps = static_cast<double>(total_packets) / (std::chrono::duration<double>(now - last_update_time).count());
 
         last_update_bytes = total_bytes;
-        last_update_time = now;
+        last_update_ns = now;
     }
 
     bool checkFourGigabytes(std::string& message) {
         if (interval_bytes >= FOUR_GB) {
-            auto now = std::chrono::steady_clock::now();
-            auto elapsed = std::chrono::duration<double>(now - last_interval_time).count();
-            // auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - last_interval_time).count();
-            last_interval_time = now;
+            uint64_t now = LoopClock::nowNs();
+            double elapsed = elapsedSince(now, last_interval_ns) / 1e9;
+            last_interval_ns = now;
 
             double estimated_time_for_4gb = (static_cast<double>(FOUR_GB) * elapsed) / static_cast<double>(interval_bytes);
 
 
             std::ostringstream oss;
-            oss << "\n" << format_duration_since(start_time) << " " << ip << " "  << std::fixed << std::setprecision(2)
+            oss << "\n" << format_duration_since(start_ns) << " " << ip << " "  << std::fixed << std::setprecision(2)
                 << interval_bytes/1e9 << "GB " << elapsed << "s"
                 << " (4gb ~" << estimated_time_for_4gb << "s) "
                 << "\n";
@@ -81,13 +85,21 @@ public:
 
     std::string get_stats() const {
         std::ostringstream oss;
-        oss << format_duration_since(start_time)
+        oss << format_duration_since(start_ns)
             << "\t" << ip
             << "\t" << formatValue(current_bps, "bps");
             // << " " << formatValue(current_pps, "pps");
         return oss.str();
     }
 
+    // q из 0..1, ближайший ранг; v переставляется
+    static double percentile(std::vector<double>& v, double q) {
+        if (v.empty()) return 0;
+        size_t k = std::min(v.size() - 1, static_cast<size_t>(q * v.size()));
+        std::nth_element(v.begin(), v.begin() + k, v.end());
+        return v[k];
+    }
+
     static std::string formatValue(double value, const std::string& unit) {
         if (value < 0) return "invalid";
 
@@ -105,11 +117,8 @@ public:
         return oss.str();
     }
 
-    static std::string format_duration_since(std::chrono::steady_clock::time_point start_time) {
-        auto now = std::chrono::steady_clock::now();
-        auto dur = std::chrono::duration_cast<std::chrono::milliseconds>(now - start_time);
-
-        auto total_ms = dur.count();
+    static std::string format_duration_since(uint64_t start_ns) {
+        auto total_ms = elapsedSince(LoopClock::nowNs(), start_ns) / 1000000;
         auto hours = total_ms / (3600 * 1000);
         total_ms %= (3600 * 1000);
         auto minutes = total_ms / (60 * 1000);
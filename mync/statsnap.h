@@ -0,0 +1,113 @@
+#ifndef STATSNAP_H
+#define STATSNAP_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <type_traits>
+
+/*
+ * статистика воркеров без блокировок и без гонок.
+ * воркер пишет только свое, каждый счетчик - на своей линии кэша,
+ * агрегатор (таймер MainEpoll) читает снимки и не трогает clients воркеров.
+ */
+
+// константа, а не #define: не протекает во все, что включает этот заголовок
+inline constexpr size_t CACHE_LINE = 64;
+
+// один писатель: без lock-префикса, читатели видят значение целиком (relaxed)
+inline void bump(std::atomic<uint64_t>& c, uint64_t n = 1){
+    c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+// счетчики горячего пути, пишет только поток воркера
+struct alignas(CACHE_LINE) WorkerCounters {
+    std::atomic<uint64_t> rx_bytes{0};
+    std::atomic<uint64_t> gone{0}; // закрытые и перенесенные в другой воркер
+};
+
+// отдано воркеру: пишут MainEpoll (accept) и соседи (миграция), поэтому fetch_add
+struct alignas(CACHE_LINE) InboxCounter {
+    std::atomic<uint64_t> handed_in{0};
+};
+
+/*
+ * seqlock для маленькой POD-структуры: один писатель, сколько угодно читателей.
+ * писатель не ждет никогда, читатель повторяет, если попал на запись.
+ * данные хранятся словами в atomic - никакого UB на гонке, как у memcpy по T.
+ */
+template <typename T>
+class alignas(CACHE_LINE) SeqLock {
+    static_assert(std::is_trivially_copyable<T>::value, "SeqLock: T must be trivially copyable");
+    static constexpr size_t WORDS = (sizeof(T) + 7) / 8;
+
+    std::atomic<uint64_t> seq_{0};
+    std::atomic<uint64_t> words_[WORDS] = {};
+
+public:
+    void store(const T& v){
+        uint64_t tmp[WORDS] = {};
+        std::memcpy(tmp, &v, sizeof(T));
+        uint64_t s = seq_.load(std::memory_order_relaxed);
+        seq_.store(s + 1, std::memory_order_relaxed); // нечетный - идет запись
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t i = 0; i < WORDS; ++i) {
+            words_[i].store(tmp[i], std::memory_order_relaxed);
+        }
+        seq_.store(s + 2, std::memory_order_release);
+    }
+
+    T load() const {
+        uint64_t tmp[WORDS];
+        for (;;) {
+            uint64_t s = seq_.load(std::memory_order_acquire);
+            if (s & 1) {
+                continue;
+            }
+            for (size_t i = 0; i < WORDS; ++i) {
+                tmp[i] = words_[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (seq_.load(std::memory_order_relaxed) == s) {
+                break;
+            }
+        }
+        T v;
+        std::memcpy(&v, tmp, sizeof(T));
+        return v;
+    }
+};
+
+/*
+ * последний снимок переменного размера (список клиентов) от одного писателя одному читателю.
+ * владение передается через exchange: писатель выкидывает непрочитанный старый,
+ * читатель забирает новый и держит его, пока не придет следующий. как RCU, только без эпох:
+ * на снимок в каждый момент ссылается ровно один поток.
+ */
+template <typename T>
+class SnapshotMailbox {
+    std::atomic<T*> slot_{nullptr};
+    std::unique_ptr<T> seen_; // только поток читателя
+
+public:
+    SnapshotMailbox() = default;
+    SnapshotMailbox(const SnapshotMailbox&) = delete;
+    SnapshotMailbox& operator=(const SnapshotMailbox&) = delete;
+    ~SnapshotMailbox(){ delete slot_.load(std::memory_order_acquire); }
+
+    void publish(std::unique_ptr<T> v){
+        delete slot_.exchange(v.release(), std::memory_order_acq_rel);
+    }
+
+    // новый снимок или прошлый, если писатель еще не обновил; nullptr - не было ни одного
+    const T* latest(){
+        if (T* p = slot_.exchange(nullptr, std::memory_order_acq_rel)) {
+            seen_.reset(p);
+        }
+        return seen_.get();
+    }
+};
+
+#endif // STATSNAP_H
@@ -0,0 +1,301 @@
+#include "topology.h"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <fstream>
+#include <linux/mempolicy.h>
+#include <map>
+#include <sched.h>
+#include <set>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static std::string read_line(const std::string& path)
+{
+    std::ifstream f(path);
+    std::string line;
+    std::getline(f, line);
+    return line;
+}
+
+// без исключений: sysfs и /proc бывают любыми (контейнеры, старые ядра)
+static bool parse_int(const std::string& s, int& out)
+{
+    if (s.empty()) {
+        return false;
+    }
+    errno = 0;
+    char* end = nullptr;
+    long v = strtol(s.c_str(), &end, 10);
+    if (end == s.c_str() || errno == ERANGE || v < INT_MIN || v > INT_MAX) {
+        return false;
+    }
+    out = static_cast<int>(v);
+    return true;
+}
+
+static int read_int(const std::string& path, int def)
+{
+    int v;
+    return parse_int(read_line(path), v) ? v : def;
+}
+
+std::vector<int> Topology::parseCpuList(const std::string& list)
+{
+    std::vector<int> out;
+    std::stringstream ss(list);
+    std::string part;
+    while (std::getline(ss, part, ',')) {
+        if (part.empty() || !isdigit((unsigned char)part[0])) {
+            continue;
+        }
+        size_t dash = part.find('-');
+        int from, to;
+        if (!parse_int(part.substr(0, dash), from)) {
+            continue;
+        }
+        if (dash == std::string::npos) {
+            to = from;
+        } else if (!parse_int(part.substr(dash + 1), to)) {
+            continue;
+        }
+        for (int c = from; c <= to; ++c) {
+            out.push_back(c);
+        }
+    }
+    return out;
+}
+
+// cpu -> сколько прерываний сетевухи на него направлено
+static std::map<int, int> nic_irq_cpus(const std::string& nic)
+{
+    std::map<int, int> out;
+    if (nic.empty()) {
+        return out;
+    }
+    std::ifstream f("/proc/interrupts");
+    std::string line;
+    // шапка: CPU0 CPU1 ... - номера колонок
+    std::vector<int> columns;
+    if (std::getline(f, line)) {
+        std::stringstream ss(line);
+        std::string col;
+        int cpu;
+        while (ss >> col) {
+            if (col.compare(0, 3, "CPU") == 0 && parse_int(col.substr(3), cpu)) {
+                columns.push_back(cpu);
+            }
+        }
+    }
+    while (std::getline(f, line)) {
+        if (line.find(nic) == std::string::npos) {
+            continue;
+        }
+        std::stringstream ss(line);
+        std::string irq;
+        ss >> irq;
+        if (irq.size() < 2 || irq.back() != ':') {
+            continue;
+        }
+        irq.pop_back(); // "45:"
+        // куда направлено сейчас; если не прочитать - куда приходило
+        std::vector<int> cpus = Topology::parseCpuList(read_line("/proc/irq/" + irq + "/effective_affinity_list"));
+        if (cpus.empty()) {
+            cpus = Topology::parseCpuList(read_line("/proc/irq/" + irq + "/smp_affinity_list"));
+        }
+        if (cpus.empty() || cpus.size() == columns.size()) {
+            // на все ядра - смотрим по счетчикам
+            cpus.clear();
+            for (int col : columns) {
+                uint64_t count = 0;
+                if (ss >> count && count > 0) {
+                    cpus.push_back(col);
+                }
+            }
+        }
+        for (int c : cpus) {
+            out[c]++;
+        }
+    }
+    return out;
+}
+
+Topology Topology::discover(const std::string& nic)
+{
+    Topology t;
+    const std::string sys = "/sys/devices/system/";
+
+    std::vector<int> online = parseCpuList(read_line(sys + "cpu/online"));
+    if (online.empty()) {
+        for (long c = 0; c < sysconf(_SC_NPROCESSORS_ONLN); ++c) {
+            online.push_back(static_cast<int>(c));
+        }
+    }
+    std::vector<int> isolated = parseCpuList(read_line(sys + "cpu/isolated"));
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    bool has_mask = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+    std::map<int, int> node_of;
+    if (DIR* dir = opendir((sys + "node").c_str())) {
+        while (dirent* e = readdir(dir)) {
+            int node;
+            if (sscanf(e->d_name, "node%d", &node) != 1) {
+                continue;
+            }
+            for (int c : parseCpuList(read_line(sys + "node/" + e->d_name + "/cpulist"))) {
+                node_of[c] = node;
+            }
+        }
+        closedir(dir);
+    }
+    std::map<int, int> irqs = nic_irq_cpus(nic);
+
+    for (int c : online) {
+        if (std::find(isolated.begin(), isolated.end(), c) != isolated.end()) {
+            continue;
+        }
+        if (has_mask && !CPU_ISSET(c, &allowed)) {
+            continue;
+        }
+        std::string topo = sys + "cpu/cpu" + std::to_string(c) + "/topology/";
+        CpuInfo info;
+        info.cpu = c;
+        info.core = read_int(topo + "core_id", c);
+        info.package = read_int(topo + "physical_package_id", 0);
+        info.node = node_of.count(c) ? node_of[c] : 0;
+        std::vector<int> siblings = parseCpuList(read_line(topo + "thread_siblings_list"));
+        info.smt_sibling = !siblings.empty() && siblings.front() != c;
+        info.irqs = irqs.count(c) ? irqs[c] : 0;
+        t.cpus_.push_back(info);
+    }
+    return t;
+}
+
+int Topology::nodeOf(int cpu) const
+{
+    for (const CpuInfo& c : cpus_) {
+        if (c.cpu == cpu) {
+            return c.node;
+        }
+    }
+    return -1;
+}
+
+int Topology::nodes() const
+{
+    std::set<int> n;
+    for (const CpuInfo& c : cpus_) {
+        n.insert(c.node);
+    }
+    return static_cast<int>(n.size());
+}
+
+std::vector<int> Topology::placeWorkers(Placement policy, size_t count, int& main_cpu) const
+{
+    std::vector<int> out;
+    if (policy == Placement::LEGACY || cpus_.empty()) {
+        main_cpu = 0;
+        for (size_t i = 0; i < count; ++i) {
+            out.push_back(static_cast<int>(i + 1));
+        }
+        return out;
+    }
+
+    // ядра каждого узла по предпочтению: сначала первые потоки физических ядер,
+    // для IRQ среди них вперед те, куда приходят прерывания
+    std::map<int, std::vector<CpuInfo>> by_node;
+    size_t physical = 0;
+    for (const CpuInfo& c : cpus_) {
+        by_node[c.node].push_back(c);
+        physical += !c.smt_sibling;
+    }
+    // SMT соседей берем, только если физических ядер не хватит на воркеры и main
+    bool use_smt = physical <= count;
+    std::vector<std::vector<int>> pools;
+    std::vector<int> node_irqs;
+    for (auto& [node, list] : by_node) {
+        std::stable_sort(list.begin(), list.end(), [policy](const CpuInfo& a, const CpuInfo& b) {
+            if (a.smt_sibling != b.smt_sibling) return !a.smt_sibling;
+            if (policy == Placement::IRQ && a.irqs != b.irqs) return a.irqs > b.irqs;
+            return a.cpu < b.cpu;
+        });
+        std::vector<int> pool;
+        int sum = 0;
+        for (const CpuInfo& c : list) {
+            if (!c.smt_sibling || use_smt) {
+                pool.push_back(c.cpu);
+            }
+            sum += c.irqs;
+        }
+        pools.push_back(pool);
+        node_irqs.push_back(sum);
+    }
+
+    // IRQ: узлы с прерываниями первыми, воркеры только на них, если их хватает
+    std::vector<size_t> order(pools.size());
+    for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+    size_t active = order.size();
+    if (policy == Placement::IRQ) {
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return node_irqs[a] > node_irqs[b]; });
+        size_t with_irq = std::count_if(node_irqs.begin(), node_irqs.end(), [](int n) { return n > 0; });
+        size_t cpus_there = 0;
+        for (size_t i = 0; i < with_irq; ++i) cpus_there += pools[order[i]].size();
+        if (with_irq > 0 && cpus_there > count) {
+            active = with_irq;
+        }
+    }
+
+    // main - последнее (наименее нужное) ядро первого узла, если ядер больше чем воркеров
+    std::vector<int>& first = pools[order[0]];
+    main_cpu = first.back();
+    size_t total = 0;
+    for (size_t i = 0; i < active; ++i) total += pools[order[i]].size();
+    if (total > count && first.size() > 1) {
+        first.pop_back();
+    }
+
+    // по кругу по узлам, внутри узла по порядку предпочтения
+    std::vector<size_t> next(pools.size(), 0);
+    while (out.size() < count) {
+        bool any = false;
+        for (size_t i = 0; i < active && out.size() < count; ++i) {
+            std::vector<int>& pool = pools[order[i]];
+            if (next[order[i]] < pool.size()) {
+                out.push_back(pool[next[order[i]]++]);
+                any = true;
+            }
+        }
+        if (!any) {
+            std::fill(next.begin(), next.end(), 0); // ядер меньше чем воркеров
+        }
+    }
+    return out;
+}
+
+bool bindMemoryToNode(int node)
+{
+    if (node < 0 || node >= 64) {
+        return false;
+    }
+    unsigned long mask = 1ul << node;
+    return syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask, sizeof(mask) * 8) == 0;
+}
+
+int incomingCpu(int fd)
+{
+#ifdef SO_INCOMING_CPU
+    int cpu = -1;
+    socklen_t len = sizeof(cpu);
+    if (getsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) == 0) {
+        return cpu;
+    }
+#endif
+    return -1;
+}
@@ -0,0 +1,54 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// как раскладывать MainEpoll и воркеры по ядрам
+enum class Placement : uint8_t {
+    LEGACY, // main на 0, воркер i на i+1 (как было)
+    NUMA,   // воркеры поровну по узлам NUMA, по одному на физическое ядро
+    IRQ,    // как NUMA, но сначала узлы и ядра, куда приходят прерывания сетевухи
+};
+
+struct CpuInfo {
+    int cpu = 0;
+    int core = 0;     // core_id внутри пакета
+    int package = 0;
+    int node = 0;
+    bool smt_sibling = false; // не первый поток своего физического ядра
+    int irqs = 0;     // сколько прерываний сетевухи направлено на это ядро
+};
+
+/*
+ * топология из /sys/devices/system/cpu, /sys/devices/system/node и /proc/interrupts.
+ * в cpus() только ядра, на которых можно работать: online, не isolcpus, в affinity процесса.
+ * если sysfs нет (контейнер), все ядра считаются одним узлом без SMT.
+ */
+class Topology {
+public:
+    // nic - подстрока имени прерывания в /proc/interrupts (eth0, mlx5...), пустая - без irq
+    static Topology discover(const std::string& nic);
+
+    const std::vector<CpuInfo>& cpus() const { return cpus_; }
+    int nodeOf(int cpu) const;
+    int nodes() const;
+
+    // ядра для count воркеров, в main_cpu - ядро для MainEpoll.
+    // ядер меньше чем воркеров - идем по кругу
+    std::vector<int> placeWorkers(Placement policy, size_t count, int& main_cpu) const;
+
+    // "0-3,8,10-11" -> {0,1,2,3,8,10,11}
+    static std::vector<int> parseCpuList(const std::string& list);
+
+private:
+    std::vector<CpuInfo> cpus_;
+};
+
+// новые страницы текущего потока брать с узла node (MPOL_PREFERRED), без libnuma
+bool bindMemoryToNode(int node);
+// ядро, на котором ядро ОС обработало последний входящий пакет сокета, -1 неизвестно
+int incomingCpu(int fd);
+
+#endif // TOPOLOGY_H
@@ -0,0 +1,119 @@
+#include "arena.h"
+#include <mutex>
+
+namespace {
+
+// арены завершившихся потоков, их забирают новые потоки
+std::mutex orphans_mtx;
+std::vector<SlabArena*>& orphans(){
+    static auto* v = new std::vector<SlabArena*>(); // не разрушаем: потоки могут выходить после main
+    return *v;
+}
+
+struct LocalArena {
+    SlabArena* arena = nullptr;
+    ~LocalArena(){
+        if (arena) {
+            std::lock_guard lock(orphans_mtx);
+            orphans().push_back(arena);
+            arena = nullptr; // освобождения из деструкторов после этого - как из чужого потока
+        }
+    }
+};
+thread_local LocalArena local_arena;
+
+uint32_t size_class(size_t size){
+    size_t block = SlabArena::MIN_BLOCK;
+    uint32_t cls = 0;
+    while (block < size) {
+        block <<= 1;
+        ++cls;
+    }
+    return cls;
+}
+
+} // namespace
+
+SlabArena& SlabArena::local(){
+    if (!local_arena.arena) {
+        {
+            std::lock_guard lock(orphans_mtx);
+            if (!orphans().empty()) {
+                local_arena.arena = orphans().back();
+                orphans().pop_back();
+            }
+        }
+        if (!local_arena.arena) {
+            local_arena.arena = new SlabArena();
+        }
+    }
+    return *local_arena.arena;
+}
+
+void* SlabArena::allocate(size_t size){
+    size_t total = size + sizeof(Header);
+    if (total > MAX_BLOCK) {
+        auto* h = static_cast<Header*>(::operator new(total));
+        h->owner = nullptr;
+        h->cls = 0;
+        return h + 1;
+    }
+    uint32_t cls = size_class(total);
+    void* block = free_[cls];
+    if (block) {
+        free_[cls] = free_[cls]->next;
+    } else {
+        block = refill(cls);
+    }
+    auto* h = static_cast<Header*>(block);
+    h->owner = this;
+    h->cls = cls;
+    return h + 1;
+}
+
+void* SlabArena::refill(uint32_t cls){
+    // сначала то, что вернули другие потоки: забираем весь стек разом, ABA нет
+    FreeBlock* remote = remote_[cls].exchange(nullptr, std::memory_order_acquire);
+    if (remote) {
+        free_[cls] = remote->next;
+        return remote;
+    }
+    size_t block = MIN_BLOCK << cls;
+    if (cur_ + block > end_) {
+        // хвост старого куска меньше блока, бросаем
+        cur_ = static_cast<char*>(::operator new(CHUNK_SIZE, std::align_val_t(64)));
+        end_ = cur_ + CHUNK_SIZE;
+        chunks_.push_back(cur_);
+    }
+    void* p = cur_;
+    cur_ += block;
+    return p;
+}
+
+void SlabArena::pushRemote(uint32_t cls, FreeBlock* b) noexcept {
+    FreeBlock* head = remote_[cls].load(std::memory_order_relaxed);
+    do {
+        b->next = head;
+    } while (!remote_[cls].compare_exchange_weak(head, b, std::memory_order_release, std::memory_order_relaxed));
+    remote_frees_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void SlabArena::deallocate(void* p) noexcept {
+    if (!p) {
+        return;
+    }
+    Header* h = static_cast<Header*>(p) - 1;
+    SlabArena* owner = h->owner;
+    if (!owner) {
+        ::operator delete(h);
+        return;
+    }
+    uint32_t cls = h->cls;
+    auto* b = reinterpret_cast<FreeBlock*>(h);
+    if (owner == local_arena.arena) {
+        b->next = owner->free_[cls];
+        owner->free_[cls] = b;
+    } else {
+        owner->pushRemote(cls, b);
+    }
+}
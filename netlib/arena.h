@@ -0,0 +1,90 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+/*
+ * slab-арена потока: блоки степеней двойки от MIN_BLOCK до MAX_BLOCK,
+ * нарезаются из кусков по CHUNK_SIZE, свободные - в списке своего класса.
+ * освобождать можно из любого потока: чужой блок уходит в remote-free список
+ * владельца (lock-free стек), владелец забирает его целиком, когда кончились свои.
+ * больше MAX_BLOCK - обычный operator new.
+ * арена живет до конца процесса: при выходе потока отдается следующему новому потоку,
+ * поэтому блоки, ушедшие в другие потоки, можно вернуть когда угодно.
+ */
+class SlabArena {
+public:
+    static constexpr size_t MIN_BLOCK = 64;
+    static constexpr size_t MAX_BLOCK = 64 * 1024;
+    static constexpr size_t CLASSES = 11; // 64 .. 64K
+    static constexpr size_t CHUNK_SIZE = 1024 * 1024;
+
+    // арена текущего потока, создается при первом обращении
+    static SlabArena& local();
+
+    void* allocate(size_t size);
+    // из любого потока, p от allocate любой арены
+    static void deallocate(void* p) noexcept;
+
+    // сколько блоков вернули другие потоки, для статистики
+    uint64_t remoteFrees() const { return remote_frees_.load(std::memory_order_relaxed); }
+
+    SlabArena(const SlabArena&) = delete;
+    SlabArena& operator=(const SlabArena&) = delete;
+
+private:
+    SlabArena() = default;
+    ~SlabArena() = default;
+
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+    // перед каждым блоком, 16 байт чтобы данные остались выровнены
+    struct alignas(16) Header {
+        SlabArena* owner; // nullptr - большой блок из operator new
+        uint32_t cls;
+    };
+
+    void* refill(uint32_t cls);
+    void pushRemote(uint32_t cls, FreeBlock* b) noexcept;
+
+    std::array<FreeBlock*, CLASSES> free_{};
+    std::array<std::atomic<FreeBlock*>, CLASSES> remote_{};
+    std::atomic<uint64_t> remote_frees_{0};
+    char* cur_ = nullptr;
+    char* end_ = nullptr;
+    std::vector<char*> chunks_;
+};
+
+// для контейнеров: память из арены потока, который выделяет.
+// без состояния - все экземпляры равны, контейнер можно отдать в другой поток
+template <typename T>
+struct ArenaAllocator {
+    using value_type = T;
+
+    ArenaAllocator() noexcept = default;
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>&) noexcept {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(SlabArena::local().allocate(n * sizeof(T)));
+    }
+    void deallocate(T* p, size_t) noexcept {
+        SlabArena::deallocate(p);
+    }
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U>&) const noexcept { return true; }
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U>&) const noexcept { return false; }
+};
+
+// буфер кадра на отправку: собирается в одном потоке, освобождается в потоке отправки
+using FrameBuffer = std::vector<char, ArenaAllocator<char>>;
+
+#endif // ARENA_H
@@ -0,0 +1,132 @@
+#ifndef BALANCER_H
+#define BALANCER_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+enum class BalancePolicy : uint8_t {
+    LEAST_CONN,  // меньше всего соединений, по умолчанию: счетчик точный на момент accept
+    // метрики ниже обновляются раз в интервал, до обновления все accept видят одну картину.
+    // только явно, когда соединения долгие и сильно разные по трафику
+    LEAST_BPS,   // меньше всего входящего трафика за последний интервал, при близких - соединений
+    LEAST_BUSY,  // меньше всего занят цикл epoll, при близких - соединений
+    TWO_CHOICES, // два случайных воркера, из них как LEAST_BPS; не сваливает пачку accept в один поток
+    IP_HASH,     // consistent hash по ip: клиент с одного адреса всегда в одном потоке
+};
+
+// нагрузка воркера на момент accept, метрики обновляются раз в интервал
+struct WorkerLoad {
+    int clients = 0;
+    double bps = 0;  // входящий трафик, единицы любые, лишь бы одни у всех воркеров
+    double busy = 0; // доля времени цикла в обработчиках, 0..1
+};
+
+/*
+ * выбор воркера для нового соединения.
+ * зовется только из потока accept, сам по себе не потокобезопасен.
+ */
+class Balancer {
+public:
+    static constexpr size_t VNODES = 64; // точек на воркер в кольце IP_HASH
+
+    explicit Balancer(BalancePolicy policy = BalancePolicy::LEAST_CONN) : policy_(policy) {}
+
+    void setPolicy(BalancePolicy policy) { policy_ = policy; }
+    BalancePolicy policy() const { return policy_; }
+
+    // кольцо для IP_HASH, при смене числа воркеров переезжает только ~1/n адресов
+    void setWorkers(size_t count) {
+        workers_ = count;
+        ring_.clear();
+        ring_.reserve(count * VNODES);
+        for (size_t w = 0; w < count; ++w) {
+            for (size_t v = 0; v < VNODES; ++v) {
+                ring_.emplace_back(mix(static_cast<uint32_t>(w * VNODES + v) ^ 0x9e3779b9u), w);
+            }
+        }
+        std::sort(ring_.begin(), ring_.end());
+    }
+
+    // load(i) -> WorkerLoad воркера i; ip - адрес клиента в сетевом порядке
+    template <typename LoadFn>
+    size_t pick(LoadFn&& load, uint32_t ip) {
+        if (workers_ <= 1) {
+            return 0;
+        }
+        switch (policy_) {
+        case BalancePolicy::IP_HASH: {
+            auto it = std::lower_bound(ring_.begin(), ring_.end(), std::make_pair(mix(ip), size_t(0)));
+            return it == ring_.end() ? ring_.front().second : it->second;
+        }
+        case BalancePolicy::TWO_CHOICES: {
+            size_t a = next() % workers_;
+            size_t b = next() % (workers_ - 1);
+            if (b >= a) ++b;
+            return less(BalancePolicy::LEAST_BPS, load(b), load(a)) ? b : a;
+        }
+        default: {
+            size_t best = 0;
+            WorkerLoad best_load = load(0);
+            for (size_t i = 1; i < workers_; ++i) {
+                WorkerLoad l = load(i);
+                if (less(policy_, l, best_load)) {
+                    best = i;
+                    best_load = l;
+                }
+            }
+            return best;
+        }
+        }
+    }
+
+private:
+    // метрики шумят: разница меньше NEAR_RATIO - не разница, решают соединения
+    static constexpr double NEAR_RATIO = 0.1;
+
+    static bool near(double a, double b) {
+        return std::abs(a - b) <= NEAR_RATIO * std::max(a, b);
+    }
+
+    static bool less(BalancePolicy policy, const WorkerLoad& a, const WorkerLoad& b) {
+        switch (policy) {
+        case BalancePolicy::LEAST_BPS:
+            if (!near(a.bps, b.bps)) return a.bps < b.bps;
+            break;
+        case BalancePolicy::LEAST_BUSY:
+            if (!near(a.busy, b.busy)) return a.busy < b.busy;
+            break;
+        default:
+            break;
+        }
+        return a.clients < b.clients;
+    }
+
+    // murmur3 finalizer: соседние ip расходятся по кольцу
+    static uint32_t mix(uint32_t h) {
+        h ^= h >> 16;
+        h *= 0x85ebca6bu;
+        h ^= h >> 13;
+        h *= 0xc2b2ae35u;
+        h ^= h >> 16;
+        return h;
+    }
+
+    // xorshift, криптостойкость тут не нужна
+    uint64_t next() {
+        rng_ ^= rng_ << 13;
+        rng_ ^= rng_ >> 7;
+        rng_ ^= rng_ << 17;
+        return rng_;
+    }
+
+    BalancePolicy policy_;
+    size_t workers_ = 0;
+    std::vector<std::pair<uint32_t, size_t>> ring_;
+    uint64_t rng_ = 0x2545F4914F6CDD1Dull;
+};
+
+#endif // BALANCER_H
@@ -0,0 +1,197 @@
+#include "bufpool.h"
+#include "slice.h"
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <sys/mman.h>
+
+PoolBuffer::PoolBuffer(const PoolBuffer& o) noexcept : slot_(o.slot_){
+    if (slot_) {
+        slot_->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void PoolBuffer::reset() noexcept {
+    if (slot_ && slot_->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        slot_->pool->release(slot_);
+    }
+    slot_ = nullptr;
+}
+
+// кусок с huge pages, если выйдет; nullptr - память кончилась совсем
+static void* map_slab(size_t size, bool& hugetlb){
+    void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) {
+        hugetlb = true;
+        return p;
+    }
+    hugetlb = false;
+    // THP складывается только из выровненных 2 МБ, берем с запасом и обрезаем края
+    size_t len = size + BufferPool::SLAB_SIZE;
+    p = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        return nullptr;
+    }
+    char* raw = static_cast<char*>(p);
+    uintptr_t mask = BufferPool::SLAB_SIZE - 1;
+    char* aligned = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(raw) + mask) & ~mask);
+    if (aligned > raw) {
+        munmap(raw, aligned - raw);
+    }
+    if (raw + len > aligned + size) {
+        munmap(aligned + size, raw + len - (aligned + size));
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(aligned, size, MADV_HUGEPAGE); // THP может быть выключен - не ошибка
+#endif
+    return aligned;
+}
+
+BufferPool::BufferPool(size_t buffer_size) : buffer_size_(std::max<size_t>(buffer_size, 64)) {}
+
+BufferPool::~BufferPool(){
+    for (Slab& s : slabs_) {
+        munmap(s.addr, s.size);
+    }
+}
+
+BufferPool& BufferPool::recvPool(){
+    // не разрушаем: буферы могут жить в thread_local запасах после main
+    static auto* pool = new BufferPool(64 * 1024);
+    return *pool;
+}
+
+void BufferPool::grow(){
+    size_t slab_size = (buffer_size_ + SLAB_SIZE - 1) / SLAB_SIZE * SLAB_SIZE;
+    bool hugetlb = false;
+    void* addr = map_slab(slab_size, hugetlb);
+    if (!addr) {
+        throw std::bad_alloc();
+    }
+    slabs_.push_back(Slab{addr, slab_size, hugetlb});
+
+    size_t count = slab_size / buffer_size_;
+    slots_.emplace_back(new PoolBuffer::Slot[count]);
+    PoolBuffer::Slot* slots = slots_.back().get();
+    for (size_t i = 0; i < count; ++i) {
+        slots[i].data = static_cast<char*>(addr) + i * buffer_size_;
+        slots[i].pool = this;
+        slots[i].next = free_;
+        free_ = &slots[i];
+    }
+    available_ += count;
+}
+
+PoolBuffer BufferPool::acquire(){
+    std::lock_guard lock(mtx_);
+    if (!free_) {
+        grow();
+    }
+    PoolBuffer::Slot* s = free_;
+    free_ = s->next;
+    --available_;
+    s->refs.store(1, std::memory_order_relaxed);
+    return PoolBuffer(s);
+}
+
+void BufferPool::release(PoolBuffer::Slot* s) noexcept {
+    std::lock_guard lock(mtx_);
+    s->next = free_;
+    free_ = s;
+    ++available_;
+}
+
+size_t BufferPool::slabs(){
+    std::lock_guard lock(mtx_);
+    return slabs_.size();
+}
+
+size_t BufferPool::hugetlbSlabs(){
+    std::lock_guard lock(mtx_);
+    return std::count_if(slabs_.begin(), slabs_.end(), [](const Slab& s) { return s.hugetlb; });
+}
+
+size_t BufferPool::available(){
+    std::lock_guard lock(mtx_);
+    return available_;
+}
+
+// запас потока: один пустой буфер для следующего recv
+static thread_local PoolBuffer spare_recv_buffer;
+
+char* RecvBuffer::prepare(size_t min){
+    if (!base_) {
+        pooled_ = spare_recv_buffer ? std::move(spare_recv_buffer) : BufferPool::recvPool().acquire();
+        base_ = pooled_.data();
+        cap_ = pooled_.capacity();
+    }
+    if (tailroom() >= min) {
+        return base_ + end_;
+    }
+    size_t used = size();
+    if (used + min <= cap_ && !shared()) {
+        // место есть, но в голове: сдвигаем недочитанный кадр
+        std::memmove(base_, base_ + begin_, used);
+    } else {
+        // кадр больше буфера или голову держат Slice - недочитанное в новый буфер
+        PoolBuffer pooled;
+        std::shared_ptr<char[]> large;
+        char* base;
+        size_t cap;
+        if (used + min <= BufferPool::recvPool().bufferSize()) {
+            pooled = BufferPool::recvPool().acquire();
+            base = pooled.data();
+            cap = pooled.capacity();
+        } else {
+            cap = std::max(cap_ * 2, used + min);
+            large.reset(new char[cap]);
+            base = large.get();
+        }
+        std::memcpy(base, base_ + begin_, used);
+        release();
+        pooled_ = std::move(pooled);
+        large_ = std::move(large);
+        base_ = base;
+        cap_ = cap;
+    }
+    begin_ = 0;
+    end_ = used;
+    return base_ + end_;
+}
+
+void RecvBuffer::consume(size_t n){
+    begin_ += n;
+    if (begin_ == end_) {
+        begin_ = end_ = 0;
+        trim();
+    }
+}
+
+void RecvBuffer::trim(){
+    if (size() > 0 || !base_) {
+        return;
+    }
+    release();
+    base_ = nullptr;
+    cap_ = begin_ = end_ = 0;
+}
+
+bool RecvBuffer::shared() const {
+    return pooled_ ? pooled_.useCount() > 1 : large_.use_count() > 1;
+}
+
+// свой буфер в запас потока, если его больше никто не держит
+void RecvBuffer::release(){
+    if (pooled_ && !shared() && !spare_recv_buffer) {
+        spare_recv_buffer = std::move(pooled_);
+    }
+    pooled_.reset();
+    large_.reset();
+}
+
+Slice RecvBuffer::slice(const char* data, size_t size) const {
+    if (pooled_) {
+        return Slice(pooled_, data, size);
+    }
+    return Slice(std::shared_ptr<const void>(large_, large_.get()), data, size);
+}
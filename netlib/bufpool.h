@@ -0,0 +1,135 @@
+#ifndef BUFPOOL_H
+#define BUFPOOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class BufferPool;
+class Slice;
+
+// буфер из пула со счетчиком ссылок, последняя копия возвращает его в пул
+class PoolBuffer {
+public:
+    PoolBuffer() = default;
+    PoolBuffer(const PoolBuffer& o) noexcept;
+    PoolBuffer(PoolBuffer&& o) noexcept : slot_(o.slot_) { o.slot_ = nullptr; }
+    PoolBuffer& operator=(PoolBuffer o) noexcept { std::swap(slot_, o.slot_); return *this; }
+    ~PoolBuffer() { reset(); }
+
+    void reset() noexcept;
+
+    char* data() const;
+    size_t capacity() const;
+    uint32_t useCount() const;
+    explicit operator bool() const { return slot_ != nullptr; }
+
+private:
+    friend class BufferPool;
+    struct Slot;
+    explicit PoolBuffer(Slot* s) : slot_(s) {}
+    Slot* slot_ = nullptr;
+};
+
+/*
+ * пул буферов одного размера. память - куски по SLAB_SIZE (одна huge page x86-64):
+ * сначала mmap(MAP_HUGETLB), если huge pages не зарезервированы - обычный mmap,
+ * выровненный на 2 МБ, + madvise(MADV_HUGEPAGE), чтобы ядро собрало THP.
+ * десятки ГБ/с через много мелких буферов - это промахи TLB, с 2 МБ страницами
+ * весь пул укладывается в несколько записей TLB.
+ * память в ОС не возвращается, пока жив пул.
+ */
+class BufferPool {
+public:
+    static constexpr size_t SLAB_SIZE = 2 * 1024 * 1024;
+
+    explicit BufferPool(size_t buffer_size);
+    ~BufferPool();
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    // общий пул приемных буферов по 64 КБ, живет до конца процесса
+    static BufferPool& recvPool();
+
+    PoolBuffer acquire();
+
+    size_t bufferSize() const { return buffer_size_; }
+    size_t slabs();
+    size_t hugetlbSlabs(); // сколько кусков получили из MAP_HUGETLB
+    size_t available();
+
+private:
+    friend class PoolBuffer;
+    void release(PoolBuffer::Slot* s) noexcept;
+    void grow(); // под mtx_
+
+    struct Slab {
+        void* addr;
+        size_t size;
+        bool hugetlb;
+    };
+
+    const size_t buffer_size_;
+    std::mutex mtx_;
+    PoolBuffer::Slot* free_ = nullptr;
+    size_t available_ = 0;
+    std::vector<Slab> slabs_;
+    std::vector<std::unique_ptr<PoolBuffer::Slot[]>> slots_;
+};
+
+struct PoolBuffer::Slot {
+    std::atomic<uint32_t> refs{0};
+    Slot* next = nullptr;
+    char* data = nullptr;
+    BufferPool* pool = nullptr;
+};
+
+inline char* PoolBuffer::data() const { return slot_ ? slot_->data : nullptr; }
+inline size_t PoolBuffer::capacity() const { return slot_ ? slot_->pool->bufferSize() : 0; }
+inline uint32_t PoolBuffer::useCount() const { return slot_ ? slot_->refs.load(std::memory_order_relaxed) : 0; }
+
+/*
+ * приемный буфер соединения: recv пишет прямо в него.
+ * пока данные влезают - буфер из recvPool, кадр больше буфера - обычная память.
+ * опустел - буфер уходит в запас потока и достается следующему соединению,
+ * поэтому молчащие соединения не держат по 64 КБ, а горячие не ходят в пул за мутексом.
+ * на разобранные байты можно взять Slice: пока он жив, буфер не сдвигается
+ * и не отдается в запас, новые данные пойдут в свежий буфер.
+ */
+class RecvBuffer {
+public:
+    RecvBuffer() = default;
+    RecvBuffer(const RecvBuffer&) = delete;
+    RecvBuffer& operator=(const RecvBuffer&) = delete;
+
+    const char* data() const { return base_ + begin_; }
+    size_t size() const { return end_ - begin_; }
+
+    // свободно в хвосте не меньше min, возвращает куда писать
+    char* prepare(size_t min);
+    size_t tailroom() const { return cap_ - end_; }
+    void commit(size_t n) { end_ += n; }
+    // выкинуть n разобранных байт из головы
+    void consume(size_t n);
+    // пустой - отдать память
+    void trim();
+
+    // [data, data + size) внутри data()..data()+size(), без копии
+    Slice slice(const char* data, size_t size) const;
+
+private:
+    bool shared() const;
+    void release();
+
+    PoolBuffer pooled_;
+    std::shared_ptr<char[]> large_;
+    char* base_ = nullptr;
+    size_t cap_ = 0;
+    size_t begin_ = 0;
+    size_t end_ = 0;
+};
+
+#endif // BUFPOOL_H
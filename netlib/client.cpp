@@ -1,5 +1,6 @@
 #include "client.h"
 #include "serialization.h"
+#include <netinet/tcp.h>
 
 int IClient::create_socket_connect()
 {
@@ -41,6 +42,10 @@ int IClient::create_socket_connect()
         return -1;
     }
 
+    // кадры уходят целиком одним send, Nagle только задерживает ping/rpc на миллисекунды
+    int nodelay = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
     return sock;
 }
 
@@ -57,6 +62,7 @@ string IClient::getClientState()
 }
 
 SinglethreadClient::SinglethreadClient(ClientConfig &&conf) : IClient(std::move(conf)), epoll_(this){
+    epoll_.set_heartbeat(conf_.heartbeat_interval_ms, conf_.heartbeat_misses, &stats_);
     // conf_ = std::move(conf);
     // loadUuid();
     // epoll_.on_event = onEvent
@@ -73,33 +79,43 @@ void SinglethreadClient::connect()
 
     state_ = ClientState::HANDSHAKE;
 
-    // if (!auth()){
-    //     close(sock);
-    //     return false;
-    // }
-
     // TODO: если в очереди есть данные отправляем
     // if (auto_send_ && !queue.empty()){
     //     // qsend()
     // }
 
-
-    state_ = ClientState::WAITING;
-    epoll_.start_handle(sock);
+    // WAITING после AUTH_RESPONSE, не дождались - ERROR
+    epoll_.start_handle(sock, conf_.handshake_timeout_ms);
+    rpc_.attach(epoll_.parser());
+    epoll_.parser()->setTimestamps(conf_.packet_timestamps);
+    epoll_.parser()->setCompression(conf_.compression, conf_.lz_dict_log2);
+    epoll_.parser()->setChecksum(conf_.checksum);
+    ParsedMessage auth;
+    epoll_.parser()->sendAuthRequest(auth, uuid_);
 }
 
 void SinglethreadClient::disconnect()
 {
     state_ = ClientState::DISCONNECTED;
+    rpc_.detach();
     epoll_.stop();
 }
 
 void SinglethreadClient::send(char *d, int sz){epoll_.send(d, sz);}
 
-void SinglethreadClient::queue_add(char *d, int sz){epoll_.queue_add(d, sz);}
+void SinglethreadClient::queue_add(char *d, int sz, SendLane lane){epoll_.queue_add(d, sz, lane);}
+bool SinglethreadClient::sendPacket(uint64_t seq_num, SliceChain payload){return epoll_.send_packet(seq_num, std::move(payload));}
 
 void SinglethreadClient::queue_send(){epoll_.queue_send();}
 
+uint32_t SinglethreadClient::openStream(){return epoll_.stream_open();}
+
+bool SinglethreadClient::streamWrite(uint32_t stream_id, const char *d, size_t sz, bool fin){return epoll_.stream_write(stream_id, d, sz, fin);}
+
+void SinglethreadClient::setLaneWeight(SendLane lane, uint32_t weight){epoll_.set_lane_weight(lane, weight);}
+
+LatencyReport SinglethreadClient::latency(){return epoll_.latency();}
+
 void SinglethreadClient::onEvent(EventType e){
 
     switch(e){
@@ -112,12 +128,29 @@ void SinglethreadClient::onEvent(EventType e){
     case EventType::Waiting:
         state_ = ClientState::WAITING;
         break;
+    case EventType::HandshakeTimeout:
+        last_error_ = "handshake timeout";
+        state_ = ClientState::ERROR;
+        break;
     default:
         break;
     }
+    if (state_ == ClientState::ERROR || state_ == ClientState::DISCONNECTED || state_ == ClientState::RECONNECTED){
+        rpc_.detach();
+    }
     d("cl onEvent " << (int)e << " state:" << (int)state_)
 }
 
+void SinglethreadClient::onMessage(ParsedMessage &msg){
+    switch(msg.type){
+    case MessageType::RPC_RESPONSE:
+        rpc_.onResponse(msg);
+        break;
+    default:
+        break;
+    }
+}
+
 // void MultithreadClient::connect()
 // {
 
@@ -130,6 +163,7 @@ void SinglethreadClient::onEvent(EventType e){
 
 MultithreadClient::MultithreadClient(ClientConfig &&conf) :
     IClient(std::move(conf)), epoll_(this){
+    epoll_.set_heartbeat(conf_.heartbeat_interval_ms, conf_.heartbeat_misses, &stats_);
     // conf_ = std::move(conf);
     // loadUuid();
 }
@@ -144,28 +178,71 @@ void MultithreadClient::connect(){
 
     state_ = ClientState::HANDSHAKE;
 
-    // if (!auth()){
-    //     close(sock);
-    //     return false;
-    // }
-
     // TODO: если в очереди есть данные отправляем
     // if (auto_send_ && !queue.empty()){
     //     // qsend()
     // }
 
-
-    state_ = ClientState::WAITING;
-    epoll_.start_handle(sock);
+    // WAITING после AUTH_RESPONSE, не дождались - ERROR
+    epoll_.start_handle(sock, conf_.handshake_timeout_ms);
+    rpc_.attach(epoll_.parser());
+    epoll_.parser()->setTimestamps(conf_.packet_timestamps);
+    epoll_.parser()->setCompression(conf_.compression, conf_.lz_dict_log2);
+    epoll_.parser()->setChecksum(conf_.checksum);
+    ParsedMessage auth;
+    epoll_.parser()->sendAuthRequest(auth, uuid_);
 }
 
 void MultithreadClient::disconnect(){
     state_ = ClientState::DISCONNECTED;
+    rpc_.detach();
     epoll_.stop();
 }
 
 void MultithreadClient::send(char *d, int sz){epoll_.send(d, sz);}
 
-void MultithreadClient::queue_add(char *d, int sz){epoll_.queue_add(d, sz);}
+void MultithreadClient::queue_add(char *d, int sz, SendLane lane){epoll_.queue_add(d, sz, lane);}
+bool MultithreadClient::sendPacket(uint64_t seq_num, SliceChain payload){return epoll_.send_packet(seq_num, std::move(payload));}
 
 void MultithreadClient::queue_send(){epoll_.queue_send();}
+
+uint32_t MultithreadClient::openStream(){return epoll_.stream_open();}
+
+bool MultithreadClient::streamWrite(uint32_t stream_id, const char *d, size_t sz, bool fin){return epoll_.stream_write(stream_id, d, sz, fin);}
+
+void MultithreadClient::setLaneWeight(SendLane lane, uint32_t weight){epoll_.set_lane_weight(lane, weight);}
+
+LatencyReport MultithreadClient::latency(){return epoll_.latency();}
+
+void MultithreadClient::onEvent(EventType e){
+    switch(e){
+    case EventType::Disconnected:
+        state_ = ClientState::DISCONNECTED;
+        rpc_.detach();
+        break;
+    case EventType::Reconnected:
+        state_ = ClientState::RECONNECTED;
+        rpc_.detach();
+        break;
+    case EventType::Waiting:
+        state_ = ClientState::WAITING;
+        break;
+    case EventType::HandshakeTimeout:
+        last_error_ = "handshake timeout";
+        state_ = ClientState::ERROR;
+        rpc_.detach();
+        break;
+    default:
+        break;
+    }
+}
+
+void MultithreadClient::onMessage(ParsedMessage &msg){
+    switch(msg.type){
+    case MessageType::RPC_RESPONSE:
+        rpc_.onResponse(msg);
+        break;
+    default:
+        break;
+    }
+}
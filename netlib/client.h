@@ -9,6 +9,18 @@ struct ClientConfig{
     string host;
     string server_ip = "127.0.0.1";
     uint16_t server_port = 12345;
+    // сколько ждем AUTH_RESPONSE, 0 - не ждем
+    int handshake_timeout_ms = 5000;
+    // ping раз в interval, rtt в stats_; сервер молчит misses интервалов - Disconnected
+    int heartbeat_interval_ms = 5000; // 0 - без ping
+    int heartbeat_misses = 3;
+    // метка времени в DATA_PKT: сервер видит задержку в одну сторону (часы хостов синхронизированы)
+    bool packet_timestamps = false;
+    // предложить серверу LZ на DATA_PKT, словарь 2^lz_dict_log2 (0 - каждый пакет отдельно)
+    bool compression = false;
+    uint8_t lz_dict_log2 = LZ_DICT_LOG2;
+    // предложить crc32c на DATA_PKT; битые от сервера - stats_.rxErrors()
+    bool checksum = false;
 
     // bool auto_reconnect = false;
     // int serialization_ths = 1;
@@ -35,7 +47,9 @@ enum class ClientState : uint8_t{
 */
 class IClient {
 public:
-    IClient(ClientConfig&& c) : conf_(std::move(c)) {};
+    IClient(ClientConfig&& c) : conf_(std::move(c)) {
+        FastClock::calibrate(); // до epoll_ и очередей отправки
+    }
 
     virtual void connect() = 0;
     virtual void disconnect() = 0;
@@ -47,8 +61,30 @@ public:
 
     // прокидываем методы в LightEpoll
     virtual void send(char* d, int sz) = 0;
-    virtual void queue_add(char* d, int sz) = 0;
+    // d не копируется; lane - класс данных для WRR (CONTROL - вне очереди)
+    virtual void queue_add(char* d, int sz, SendLane lane = SendLane::BULK) = 0;
     virtual void queue_send() = 0;
+    // DATA_PKT без копии payload: в очереди лежат ссылки на буферы до отправки,
+    // один Slice можно отдать многим клиентам. уходит с queue_send, как queue_add
+    virtual bool sendPacket(uint64_t seq_num, SliceChain payload) = 0;
+
+    // rpc по этому же соединению, не ждем ответа перед следующим запросом.
+    // ответ (или DISCONNECTED при обрыве) приходит в потоке epoll
+    void call(uint16_t method_id, const char* d, size_t sz, RpcCallback cb){
+        rpc_.call(method_id, d, sz, std::move(cb));
+    }
+    std::future<RpcReply> call(uint16_t method_id, const char* d, size_t sz){
+        return rpc_.call(method_id, d, sz);
+    }
+
+    // логические потоки в этом же соединении, куски уходят в queue_send.
+    // только клиент -> сервер: сервер потоки не открывает, принимает через IServer::setStreamHandler
+    virtual uint32_t openStream() = 0;
+    virtual bool streamWrite(uint32_t stream_id, const char* d, size_t sz, bool fin = false) = 0;
+    // доля полосы данных в WRR очереди отправки
+    virtual void setLaneWeight(SendLane lane, uint32_t weight) = 0;
+    // очередь отправки, пробуждения epoll, one-way для DATA_PKT с меткой от сервера
+    virtual LatencyReport latency() = 0;
 
     ClientConfig conf_;
     string last_error_;
@@ -58,6 +94,8 @@ public:
 protected:
     int create_socket_connect();
     bool auto_send_ = true;
+    RpcClient rpc_;
+    std::array<uint8_t, 16> uuid_ = generateUuid();
 };
 
 
@@ -68,13 +106,20 @@ public:
     void disconnect();
 
     void send(char* d, int sz);
-    void queue_add(char* d, int sz);
+    void queue_add(char* d, int sz, SendLane lane = SendLane::BULK);
+    bool sendPacket(uint64_t seq_num, SliceChain payload);
     void queue_send();
 
+    uint32_t openStream();
+    bool streamWrite(uint32_t stream_id, const char* d, size_t sz, bool fin = false);
+    void setLaneWeight(SendLane lane, uint32_t weight);
+    LatencyReport latency();
+
 private:
     ClientLightEpoll epoll_;
 
     void onEvent(EventType e);
+    void onMessage(ParsedMessage& msg);
 };
 
 class MultithreadClient : public IClient, public IClientEventHandler {
@@ -85,12 +130,21 @@ public:
 
     void send(char *d, int sz);
 
-    void queue_add(char *d, int sz);
+    void queue_add(char *d, int sz, SendLane lane = SendLane::BULK);
+    bool sendPacket(uint64_t seq_num, SliceChain payload);
 
     void queue_send();
 
+    uint32_t openStream();
+    bool streamWrite(uint32_t stream_id, const char* d, size_t sz, bool fin = false);
+    void setLaneWeight(SendLane lane, uint32_t weight);
+    LatencyReport latency();
+
 private:
     ClientMultithEpoll epoll_;
+
+    void onEvent(EventType e);
+    void onMessage(ParsedMessage& msg);
 };
 
 // struct Handshake{
@@ -18,8 +18,10 @@
 using std::string;
 
 #include "utils.h"
+#include "log.h"
 
-#define d(x) std::cout << x << " \t(" << __FUNCTION__ << " " << __LINE__ << ")" << std::endl;
+// отладка, в сборке по умолчанию вырезается (NETLIB_LOG_LEVEL)
+#define d(x) LOG_DEBUG(x);
 
 
 #endif // CONST_H
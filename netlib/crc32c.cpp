@@ -0,0 +1,113 @@
+#include "crc32c.h"
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define CRC32C_X86 1
+#endif
+
+namespace {
+
+constexpr uint32_t POLY = 0x82F63B78; // reflected 0x1EDC6F41
+
+using Tables = std::array<std::array<uint32_t, 256>, 8>;
+
+constexpr Tables makeTables() {
+    Tables t{};
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k) {
+            c = (c >> 1) ^ (POLY & (0u - (c & 1)));
+        }
+        t[0][i] = c;
+    }
+    for (int s = 1; s < 8; ++s) {
+        for (uint32_t i = 0; i < 256; ++i) {
+            t[s][i] = (t[s - 1][i] >> 8) ^ t[0][t[s - 1][i] & 0xFF];
+        }
+    }
+    return t;
+}
+
+constexpr Tables TABLES = makeTables();
+
+uint32_t crc32cSlice8(const void* data, size_t size, uint32_t crc) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    crc = ~crc;
+
+    while (size >= 8) {
+        uint32_t lo, hi;
+        std::memcpy(&lo, p, 4);
+        std::memcpy(&hi, p + 4, 4);
+        lo ^= crc;
+        crc = TABLES[7][lo & 0xFF] ^ TABLES[6][(lo >> 8) & 0xFF] ^
+              TABLES[5][(lo >> 16) & 0xFF] ^ TABLES[4][lo >> 24] ^
+              TABLES[3][hi & 0xFF] ^ TABLES[2][(hi >> 8) & 0xFF] ^
+              TABLES[1][(hi >> 16) & 0xFF] ^ TABLES[0][hi >> 24];
+        p += 8;
+        size -= 8;
+    }
+    while (size--) {
+        crc = (crc >> 8) ^ TABLES[0][(crc ^ *p++) & 0xFF];
+    }
+    return ~crc;
+}
+
+#ifdef CRC32C_X86
+__attribute__((target("sse4.2")))
+uint32_t crc32cSse42(const void* data, size_t size, uint32_t crc) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+#ifdef __x86_64__
+    uint64_t c = ~crc;
+    while (size >= 8) {
+        uint64_t v;
+        std::memcpy(&v, p, 8);
+        c = _mm_crc32_u64(c, v);
+        p += 8;
+        size -= 8;
+    }
+    crc = static_cast<uint32_t>(c);
+#else
+    crc = ~crc;
+#endif
+    while (size >= 4) {
+        uint32_t v;
+        std::memcpy(&v, p, 4);
+        crc = _mm_crc32_u32(crc, v);
+        p += 4;
+        size -= 4;
+    }
+    while (size--) {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return ~crc;
+}
+#endif
+
+using Crc32cFn = uint32_t (*)(const void*, size_t, uint32_t);
+
+Crc32cFn selectImpl() {
+#ifdef CRC32C_X86
+    if (__builtin_cpu_supports("sse4.2")) {
+        return crc32cSse42;
+    }
+#endif
+    return crc32cSlice8;
+}
+
+const Crc32cFn impl = selectImpl();
+
+} // namespace
+
+uint32_t crc32c(const void* data, size_t size, uint32_t crc) {
+    return impl(data, size, crc);
+}
+
+bool crc32cHardware() {
+    return impl != crc32cSlice8;
+}
+
+uint32_t crc32cPortable(const void* data, size_t size, uint32_t crc) {
+    return crc32cSlice8(data, size, crc);
+}
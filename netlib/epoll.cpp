@@ -1,11 +1,23 @@
 #include "epoll.h"
+#include <sys/eventfd.h>
+#include <netinet/tcp.h>
 
 bool IEpoll::add_fd(int fd, uint32_t events)
 {
     epoll_event ev{.events = events, .data{.fd = fd}};
     if (epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) == -1) {
         // throw std::runtime_error("epoll_ctl add");
-        std::cout << "fail epoll_ctl add " << fd << " error: " << strerror(errno)<< std::endl;
+        LOG_WARN("fail epoll_ctl add " << fd << " error: " << strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+bool IEpoll::mod_fd(int fd, uint32_t events)
+{
+    epoll_event ev{.events = events, .data{.fd = fd}};
+    if (epoll_ctl(epfd_, EPOLL_CTL_MOD, fd, &ev) == -1) {
+        LOG_WARN("fail epoll_ctl mod " << fd << " error: " << strerror(errno));
         return false;
     }
     return true;
@@ -16,6 +28,45 @@ void IEpoll::remove_fd(int fd)
     epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, nullptr);
 }
 
+bool IEpoll::sync_writable(int fd, ClientConn& c)
+{
+    if (c.parser.txBroken()) {
+        return false;
+    }
+    bool want = c.parser.hasBacklog();
+    if (want == c.want_out) {
+        return true;
+    }
+    c.want_out = want;
+    return mod_fd(fd, EPOLLIN | EPOLLRDHUP | (want ? uint32_t(EPOLLOUT) : 0u));
+}
+
+void IEpoll::note_rx_errors(const MessageParser& p, Stats& st)
+{
+    RxErrors now = p.rxErrors();
+    RxErrors before = st.rxErrors();
+    if (now == before) {
+        return;
+    }
+    rx_crc_.store(rx_crc_.load() + now.crc - before.crc);
+    rx_resyncs_.store(rx_resyncs_.load() + now.resyncs - before.resyncs);
+    rx_resync_bytes_.store(rx_resync_bytes_.load() + now.resync_bytes - before.resync_bytes);
+    st.setRxErrors(now);
+}
+
+RxErrors IEpoll::rxErrors() const {
+    RxErrors r;
+    r.crc = rx_crc_.load();
+    r.resyncs = rx_resyncs_.load();
+    r.resync_bytes = rx_resync_bytes_.load();
+    return r;
+}
+
+bool IEpoll::flush_client(int fd, ClientConn& c)
+{
+    return c.parser.flushBacklog() && sync_writable(fd, c);
+}
+
 IEpoll::IEpoll(){
     epfd_ = epoll_create1(EPOLL_CLOEXEC);
     if (epfd_ == -1) throw std::runtime_error("epoll_create1");
@@ -33,18 +84,26 @@ void IEpoll::exec()
     epoll_event events[MAX_EVENTS];
     const int EPOLL_TIMEOUT = 100;
 
+    uint64_t window_start = FastClock::nowNs();
+    uint64_t busy_ns = 0;
     while (!need_stop_) {
-        int nfds = epoll_wait(epfd_, events, MAX_EVENTS, EPOLL_TIMEOUT);
+        // спим до ближайшего таймера, но не дольше EPOLL_TIMEOUT (проверка need_stop_)
+        int nfds = epoll_wait(epfd_, events, MAX_EVENTS, timers_.timeoutMs(EPOLL_TIMEOUT));
         if (nfds == -1) {
             if (errno == EINTR) continue;
             throw std::runtime_error("epoll_wait");
         }
+        // один замер на итерацию: обработчики берут время из LoopClock
+        uint64_t wake_ns = LoopClock::tick();
+        trace(TraceEv::WAKE, -1, static_cast<uint64_t>(nfds));
 
         for (int i = 0; i < nfds; ++i) {
             // int fd = events[i].data.fd;
             // uint32_t evs = events[i].events;
 
             if (on_event_handlers){
+                // сколько событие ждало обработчиков перед ним в этой пачке
+                wakeup_latency_.record(elapsedSince(FastClock::nowNs(), wake_ns));
                 on_event_handlers(events[i].data.fd, events[i].events);
             }
             // static_cast<Derived*>(this)->on_event(events[i].data.fd, events[i].events);
@@ -63,25 +122,232 @@ void IEpoll::exec()
             //     event_handlers(fd);
             // }
         }
+        timers_.advance();
+
+        uint64_t now = FastClock::nowNs();
+        busy_ns += elapsedSince(now, wake_ns);
+        if (now - window_start >= BUSY_WINDOW_US * 1000) {
+            busy_ratio_.store(double(busy_ns) / double(now - window_start), std::memory_order_relaxed);
+            window_start = now;
+            busy_ns = 0;
+        }
     }
 }
+
+LatencyReport IEpoll::latency() const {
+    LatencyReport r;
+    r.wakeup = wakeup_latency_.snapshot();
+    r.one_way = one_way_latency_.snapshot();
+    return r;
+}
+
 // Явно инстанцируем шаблон для нужного типа
 // template void IEpoll<LightEpoll>::exec();
 
+// до auth - дедлайн handshake, после - idle; 0 - не ограничиваем
+static void arm_deadline(TimerWheel& timers, const ServerHooks& hooks, ClientConn& c){
+    int ms = c.authed ? hooks.idle_timeout_ms : hooks.handshake_timeout_ms;
+    if (ms > 0) {
+        timers.arm(c.deadline, ms);
+    } else {
+        timers.cancel(c.deadline);
+    }
+}
+
+// новый клиент: on_expire зовется из exec, когда вышел дедлайн, on_heartbeat - раз в интервал
+static void watch_client(TimerWheel& timers, const ServerHooks& hooks, ClientConn& c,
+                         std::function<void()> on_expire, std::function<void()> on_heartbeat){
+    c.authed = hooks.handshake_timeout_ms <= 0;
+    c.last_rx_ms = LoopClock::nowMs();
+    c.deadline.cb = std::move(on_expire);
+    arm_deadline(timers, hooks, c);
+    if (hooks.heartbeat_interval_ms > 0) {
+        c.heartbeat.cb = std::move(on_heartbeat);
+        timers.arm(c.heartbeat, hooks.heartbeat_interval_ms);
+    }
+}
+
+// false - клиент молчит heartbeat_misses интервалов, закрываем
+static bool ping_client(TimerWheel& timers, const ServerHooks& hooks, ClientConn& c){
+    uint64_t silence = elapsedSince(LoopClock::nowMs(), c.last_rx_ms);
+    if (silence > uint64_t(hooks.heartbeat_interval_ms) * hooks.heartbeat_misses) {
+        return false;
+    }
+    c.parser.sendPing(c.reply, ++c.ping_seq, monotonicUs());
+    timers.arm(c.heartbeat, hooks.heartbeat_interval_ms);
+    return true;
+}
+
+// pong несет наше же время отправки; эхо из будущего (битое или подделанное) в rtt не пускаем
+static void add_rtt_sample(Stats& st, uint64_t sent_us){
+    if (uint64_t rtt = elapsedSince(monotonicUs(), sent_us)) {
+        st.addRttSample(static_cast<double>(rtt));
+    }
+}
+
+// новое соединение: что разрешаем на handshake и куда пишем задержку
+static void init_parser(ClientConn& c, const ServerHooks& hooks, LatencyHistogram* one_way){
+    c.parser.setCompression(hooks.compression, hooks.lz_dict_log2);
+    c.parser.setChecksum(hooks.checksum);
+    c.parser.setOneWayHistogram(one_way);
+}
+
+// общий разбор кадров для ServerLightEpoll и ServerSubEpoll
+// сколько прочитали, -1 - соединение надо закрыть
+// frames_total - сюда прибавляем разобранные кадры
+static ssize_t read_client(int fd, ClientConn& c, const ServerHooks& hooks, TimerWheel& timers, uint64_t* frames_total = nullptr){
+    ssize_t n = c.parser.recvSome();
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return 0;
+    }
+    if (n <= 0) {
+        return -1;
+    }
+    trace(TraceEv::RECV, fd, static_cast<uint64_t>(n));
+    c.stats.addBytes(n);
+    c.last_rx_ms = LoopClock::nowMs();
+
+    size_t frames = 0, heartbeats = 0;
+    while (c.parser.tryParseMessage(c.msg)) {
+        ++frames;
+        trace(TraceEv::FRAME, fd, static_cast<uint64_t>(c.msg.type), static_cast<uint64_t>(c.msg.size_header));
+        switch (c.msg.type) {
+        case MessageType::PING:
+            ++heartbeats;
+            c.parser.sendPong(c.reply, c.msg.heartbeat);
+            break;
+        case MessageType::PONG: {
+            ++heartbeats;
+            add_rtt_sample(c.stats, c.msg.heartbeat.send_time_us);
+            break;
+        }
+        case MessageType::AUTH_REQUEST:
+            c.parser.sendAuthResponce(c.reply, c.msg.auth_request.client_uuid, 0);
+            c.authed = true;
+            break;
+        case MessageType::RPC_REQUEST: {
+            // без обработчиков все равно отвечаем, иначе клиент ждет вечно
+            static RpcServer no_methods;
+            if (!(hooks.rpc ? hooks.rpc : &no_methods)->onRequest(c.parser, c.msg, c.reply)) {
+                return -1;
+            }
+            break;
+        }
+        case MessageType::STREAM_CHUNK:
+            if (hooks.streams && *hooks.streams) {
+                const uint32_t id = c.msg.stream_chunk.stream_id;
+                const bool fin = c.msg.stream_chunk.flags & STREAM_FLAG_FIN;
+                if (fin) c.streams.erase(id);
+                else c.streams.insert(id);
+                (*hooks.streams)(fd, id, c.msg.chunk_data, c.msg.stream_chunk.data_size, fin);
+            }
+            break;
+        default:
+            // поток данных пока только считаем
+            break;
+        }
+    }
+    // до auth дедлайн не двигаем, иначе медленный мусор держит соединение вечно.
+    // одни ping/pong - не активность, иначе idle никогда не наступит
+    if (c.authed && (frames == 0 || heartbeats < frames)) {
+        arm_deadline(timers, hooks, c);
+    }
+    if (frames_total) {
+        *frames_total += frames;
+    }
+    return n;
+}
+
+// соединение закрывается: битые кадры за его жизнь - в лог, в итоге потока они остаются
+static void report_rx_errors(int fd, const ClientConn& c){
+    RxErrors e = c.stats.rxErrors();
+    if (e.crc || e.resyncs) {
+        LOG_WARN("client " << fd << " " << c.stats.ip << ": crc errors " << e.crc
+                 << ", resyncs " << e.resyncs << " (" << e.resync_bytes << " bytes skipped)");
+    }
+}
+
+// соединение закрывается: потоки без fin обработчик тоже закрывает, иначе держит их вечно
+static void drop_streams(int fd, ClientConn& c, const ServerHooks& hooks){
+    if (hooks.streams && *hooks.streams) {
+        for (uint32_t id : c.streams) {
+            (*hooks.streams)(fd, id, nullptr, 0, true);
+        }
+    }
+    c.streams.clear();
+}
+
+// кадры уходят целиком одним send, Nagle только задерживает ping/rpc на миллисекунды
+static void set_nodelay(int fd){
+    int nodelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+}
+
+// служебные кадры не ждут данных
+static SendLane frame_lane(const FrameBuffer& frame){
+    FrameHead head;
+    std::memcpy(&head, frame.data(), sizeof(head));
+    switch (head.type) {
+    case MessageType::STREAM_CHUNK:
+        return SendLane::STREAMS;
+    case MessageType::DATA_PKT:
+    case MessageType::DATA_BATCH:
+        return SendLane::BULK;
+    default:
+        return SendLane::CONTROL;
+    }
+}
+
+// за один проход queue_send подкладываем столько кусков потоков,
+// чтобы WRR между полосами работал и на очень больших потоках
+static constexpr size_t MUX_ROUND_BYTES = 4 * PrioritySendQueue::QUANTUM;
+static constexpr size_t SEND_ROUND_BYTES = 8 * PrioritySendQueue::QUANTUM;
+
 ClientLightEpoll::ClientLightEpoll(IClientEventHandler* clh) {
     clientHandler_ = clh;
     on_event_handlers = [this](int fd, uint32_t evs) {
         on_epoll_event(fd, evs);
     };
+    handshake_timer_.cb = [this]{
+        handshake_timeout();
+    };
+    heartbeat_timer_.cb = [this]{
+        heartbeat();
+    };
 }
 
-void ClientLightEpoll::start_handle(int sock){
-    if (socket_ > 0)
+void ClientLightEpoll::start_handle(int sock, int handshake_timeout_ms){
+    if (socket_ > 0 && !sock_down_)
         throw std::runtime_error("cli wrong use start_handle ");
+    // старое соединение оборвалось без disconnect - дожидаемся потоков и закрываем
+    if (sock_down_) {
+        stop();
+    }
     if (!add_fd(sock, EPOLLIN | EPOLLRDHUP)){
         return;
     }
     socket_ = sock;
+    delete parser_;
+    parser_ = new MessageParser(sock);
+    parser_->setOneWayHistogram(&one_way_latency_);
+    wire_send_ = [this](const char* d, size_t sz){
+        return parser_->sendRaw(d, sz);
+    };
+    // своего потока отправки нет: control отправляем сразу в вызывающем потоке
+    parser_->setTxSink([this](FrameBuffer&& frame, SliceChain&& body){
+        SendLane lane = frame_lane(frame);
+        queue_.push(lane, std::move(frame), std::move(body));
+        return lane == SendLane::CONTROL ? queue_.drainControl(wire_send_) : true;
+    });
+    need_stop_ = false;
+    // поток exec еще не запущен, колесо можно трогать отсюда
+    if (handshake_timeout_ms > 0) {
+        timers_.arm(handshake_timer_, handshake_timeout_ms);
+    }
+    last_rx_ms_ = LoopClock::nowMs();
+    if (hb_interval_ms_ > 0) {
+        timers_.arm(heartbeat_timer_, hb_interval_ms_);
+    }
     handleth_ = new std::thread([=](){
         exec();
     });
@@ -94,36 +360,67 @@ void ClientLightEpoll::stop(){
         delete handleth_;
         handleth_ = nullptr;
     }
-    close(socket_);
+    timers_.cancel(handshake_timer_);
+    timers_.cancel(heartbeat_timer_);
+    // потоки, которые могли писать в сокет, уже остановлены - fd можно отдавать ядру
+    if (socket_ >= 0) {
+        if (!sock_down_) remove_fd(socket_);
+        close(socket_);
+    }
     socket_ = -1;
+    sock_down_ = false;
+    mux_.clear();
+    queue_.clear();
+    delete parser_;
+    parser_ = nullptr;
 }
 
 void ClientLightEpoll::send(char *d, int sz){
-    if (::send(socket_, d, sz, MSG_NOSIGNAL) != sz) {
-        std::cerr << socket_ << " send() failed: " << strerror(errno) << std::endl;
+    if (!parser_ || !parser_->sendRaw(d, sz)) {
+        LOG_ERROR(socket_ << " send() failed: " << strerror(errno));
     }
 }
 
-void ClientLightEpoll::queue_add(char *d, int sz){
-    queue_.push(std::make_pair(d, sz));
+void ClientLightEpoll::queue_add(char *d, int sz, SendLane lane){
+    queue_.push(lane, d, sz);
+}
+
+bool ClientLightEpoll::send_packet(uint64_t seq_num, SliceChain&& payload){
+    if (!parser_) {
+        return false;
+    }
+    ParsedMessage msg; // заголовок собираем не в msg_: тот для разбора в потоке epoll
+    parser_->sendDataPkt(msg, seq_num, std::move(payload));
+    return true;
 }
 
 void ClientLightEpoll::queue_send(){
-    while(!queue_.empty()){
-        auto el = queue_.front();
-        queue_.pop();
-        send(el.first, el.second);
+    if (!drain_all()) {
+        LOG_ERROR(socket_ << " queue_send() failed: " << strerror(errno));
     }
 }
 
+bool ClientLightEpoll::drain_all(){
+    if (!parser_) {
+        return false;
+    }
+    do {
+        mux_.pump(*parser_, MUX_ROUND_BYTES);
+        if (!queue_.drain(wire_send_, SEND_ROUND_BYTES)) {
+            return false;
+        }
+    } while (!queue_.empty() || mux_.activeStreams());
+    return true;
+}
+
 void ClientLightEpoll::on_epoll_event(int fd, uint32_t evs){
     if (need_stop_){
         return;
     }
     // close socket
     if (evs & (EPOLLHUP | EPOLLRDHUP | EPOLLERR)) {
-        close(socket_);
-        socket_ = -1;
+        trace(TraceEv::CLOSE, socket_, TRACE_CLOSE_HUP);
+        drop_socket();
         d("close client " << fd);
         clientHandler_->onEvent(need_reconnect_ ? EventType::Reconnected : EventType::Disconnected);
         if (need_reconnect_){
@@ -138,7 +435,7 @@ void ClientLightEpoll::on_epoll_event(int fd, uint32_t evs){
     // тут один единственный сокет, поэтому без проверок
     handle_socket_data();
 
-    if (socket_ == -1 && need_reconnect_){
+    if (sock_down_ && need_reconnect_){
         // reconnect();
     }
 }
@@ -147,21 +444,75 @@ void ClientLightEpoll::handle_socket_data(){
     ssize_t n;
     // это не SubEpoll, тут не нужна статистика
     // std::cout << "2handle_socket_data " << n << std::endl;
-    n = recv(socket_, buffer, sizeof(buffer), 0);
+    n = parser_->recvSome();
     if (n > 0) {
-        // if (on_recv_handler)
-        //     on_recv_handler(buffer, n);
-        // if (write_to_stdout(buffer, n) != 0) {
-        //     throw std::runtime_error("write to stdout");
-        // }
+        last_rx_ms_ = LoopClock::nowMs();
+        while (parser_->tryParseMessage(msg_)) {
+            switch (msg_.type) {
+            case MessageType::AUTH_RESPONSE:
+                if (handshake_timer_.armed()) {
+                    timers_.cancel(handshake_timer_);
+                    clientHandler_->onEvent(EventType::Waiting);
+                }
+                break;
+            case MessageType::PING:
+                parser_->sendPong(hb_msg_, msg_.heartbeat);
+                continue;
+            case MessageType::PONG:
+                if (stats_) {
+                    add_rtt_sample(*stats_, msg_.heartbeat.send_time_us);
+                }
+                continue;
+            default:
+                break;
+            }
+            clientHandler_->onMessage(msg_);
+        }
+        if (stats_) {
+            note_rx_errors(*parser_, *stats_);
+        }
     } else if (n == 0) {
-        close(socket_);
-        socket_ = -1;
-    } else {
+        trace(TraceEv::CLOSE, socket_, TRACE_CLOSE_EOF);
+        drop_socket();
+    } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
         throw std::runtime_error("recv from socket");
     }
 }
 
+void ClientLightEpoll::handshake_timeout(){
+    if (sock_down_) {
+        return;
+    }
+    d("handshake timeout " << socket_);
+    trace(TraceEv::CLOSE, socket_, TRACE_CLOSE_DEADLINE);
+    drop_socket();
+    clientHandler_->onEvent(EventType::HandshakeTimeout);
+}
+
+void ClientLightEpoll::heartbeat(){
+    if (sock_down_) {
+        return;
+    }
+    // tcp заметит мертвый сервер через минуты, а мы - через hb_misses_ интервалов
+    if (elapsedSince(LoopClock::nowMs(), last_rx_ms_) > uint64_t(hb_interval_ms_) * hb_misses_) {
+        d("heartbeat lost " << socket_);
+        trace(TraceEv::CLOSE, socket_, TRACE_CLOSE_HEARTBEAT);
+        drop_socket();
+        clientHandler_->onEvent(need_reconnect_ ? EventType::Reconnected : EventType::Disconnected);
+        return;
+    }
+    parser_->sendPing(hb_msg_, ++hb_seq_, monotonicUs());
+    timers_.arm(heartbeat_timer_, hb_interval_ms_);
+}
+
+// из потока exec: соединение мертво. close нельзя - fd еще пишут rpc, потоки и send
+// пользователя, а номер ядро сразу отдаст новому сокету. shutdown будит их ошибкой, close - в stop
+void ClientLightEpoll::drop_socket(){
+    remove_fd(socket_);
+    shutdown(socket_, SHUT_RDWR);
+    sock_down_ = true;
+}
+
 ServerLightEpoll::ServerLightEpoll(IClientEventHandler* clh){
     clientHandler_ = clh;
     on_event_handlers = [this](int fd, uint32_t evs) {
@@ -198,6 +549,7 @@ void ServerLightEpoll::stop(){
 
     d("stop server:" << clients.size())
     while(!clients.empty()){
+        trace(TraceEv::CLOSE, clients.begin()->first, TRACE_CLOSE_STOP);
         remove_client(clients.begin()->first);
     }
 }
@@ -208,13 +560,22 @@ void ServerLightEpoll::on_epoll_event(int fd, uint32_t evs){
             need_stop_ = true;
             d("need stop server epoll " << socket_)
         } else {
+            trace(TraceEv::CLOSE, fd, TRACE_CLOSE_HUP);
             remove_client(fd);
-            std::cout << "server remove client " << fd << std::endl;
+            LOG_INFO("server remove client " << fd);
             clientHandler_->onEvent(EventType::ClientDisconnect);
         }
         return;
     }
 
+    if (evs & EPOLLOUT) {
+        auto it = clients.find(fd);
+        if (it != clients.end() && !flush_client(fd, it->second)) {
+            trace(TraceEv::CLOSE, fd, TRACE_CLOSE_TX);
+            remove_client(fd);
+            return;
+        }
+    }
     if (evs & EPOLLIN) {
         if (socket_ > 0 && fd == socket_) handle_accept();
         else if (clients.count(fd)) handle_client_data(fd);
@@ -222,9 +583,13 @@ void ServerLightEpoll::on_epoll_event(int fd, uint32_t evs){
 }
 
 void ServerLightEpoll::remove_client(int fd) {
+    // мог уже закрыться в handle_client_data в этой же пачке событий
+    if (!clients.count(fd)) return;
     d("remove_client " << fd)
     // count_fd--;
     remove_fd(fd);
+    report_rx_errors(fd, clients.at(fd));
+    drop_streams(fd, clients.at(fd), hooks_);
     {
         // std::unique_lock lock(mtx_clients);// запись
         clients.erase(fd);
@@ -234,20 +599,39 @@ void ServerLightEpoll::remove_client(int fd) {
     close(fd);
 }
 
-void ServerLightEpoll::handle_client_data(int fd) {
-    ssize_t n;
-    n = recv(fd, buffer, sizeof(buffer), 0);
-    if (n > 0) {
-        // std::cout << "1handle_client_data " << n << std::endl;
+void ServerLightEpoll::expire_client(int fd) {
+    d("deadline client " << fd)
+    trace(TraceEv::CLOSE, fd, TRACE_CLOSE_DEADLINE);
+    remove_client(fd);
+    clientHandler_->onEvent(EventType::ClientDisconnect);
+}
 
-        {
-            // std::unique_lock lock(mtx_clients); // чтение - Запись? unique_lock
-            clients[fd].addBytes(n);
-        }
-        // if (write_to_stdout(buffer, SERVER_WRITE_STDOUT?n:0) != 0) {
-        //     throw std::runtime_error("write to stdout");
-        // }
-    } else {
+void ServerLightEpoll::heartbeat_client(int fd){
+    auto it = clients.find(fd);
+    if (it == clients.end()) {
+        return;
+    }
+    if (!ping_client(timers_, hooks_, it->second)) {
+        d("heartbeat lost " << fd)
+        expire_client(fd);
+    } else if (!sync_writable(fd, it->second)) {
+        trace(TraceEv::CLOSE, fd, TRACE_CLOSE_TX);
+        remove_client(fd);
+    }
+}
+
+void ServerLightEpoll::handle_client_data(int fd) {
+    auto it = clients.find(fd);
+    if (it == clients.end()) {
+        return;
+    }
+    ssize_t n = read_client(fd, it->second, hooks_, timers_);
+    note_rx_errors(it->second.parser, it->second.stats);
+    if (n < 0) {
+        trace(TraceEv::CLOSE, fd, TRACE_CLOSE_EOF);
+        remove_client(fd);
+    } else if (!sync_writable(fd, it->second)) {
+        trace(TraceEv::CLOSE, fd, TRACE_CLOSE_TX);
         remove_client(fd);
     }
 }
@@ -288,7 +672,20 @@ void ServerLightEpoll::handle_accept()
         //         close(client_fd);
         //     }else{
         //         size_clients++;
-        clients.emplace(client_fd, std::move(st));
+        trace(TraceEv::ACCEPT, client_fd, client_addr.sin_addr.s_addr, ntohs(client_addr.sin_port));
+        if (!add_fd(client_fd, EPOLLIN | EPOLLRDHUP)){
+            close(client_fd);
+            continue;
+        }
+        trace(TraceEv::ADD_CLIENT, client_fd);
+        set_nodelay(client_fd);
+        auto& c = clients.try_emplace(client_fd, client_fd, std::move(st)).first->second;
+        init_parser(c, hooks_, &one_way_latency_);
+        watch_client(timers_, hooks_, c, [this, client_fd]{
+            expire_client(client_fd);
+        }, [this, client_fd]{
+            heartbeat_client(client_fd);
+        });
         d("add_client " << client_fd);
             // std::cout << "Added socket: " << client_fd << " (" << clients[client_fd].ip << ")" << std::endl;
         //     }
@@ -303,18 +700,49 @@ ClientMultithEpoll::ClientMultithEpoll(IClientEventHandler *clh){
     on_event_handlers = [this](int fd, uint32_t evs) {
         on_epoll_event(fd, evs);
     };
+    handshake_timer_.cb = [this]{
+        handshake_timeout();
+    };
+    heartbeat_timer_.cb = [this]{
+        heartbeat();
+    };
 }
 
-void ClientMultithEpoll::start_handle(int sock){
-    if (socket_ > 0)
+void ClientMultithEpoll::start_handle(int sock, int handshake_timeout_ms){
+    if (socket_ > 0 && !sock_down_)
         throw std::runtime_error("cli wrong use start_handle ");
+    // старое соединение оборвалось без disconnect - дожидаемся потоков и закрываем
+    if (sock_down_) {
+        stop();
+    }
     if (!add_fd(sock, EPOLLIN | EPOLLRDHUP)){
         return;
     }
     socket_ = sock;
+    delete parser_;
+    parser_ = new MessageParser(sock);
+    parser_->setOneWayHistogram(&one_way_latency_);
+    wire_send_ = [this](const char* d, size_t sz){
+        return parser_->sendRaw(d, sz);
+    };
+    // в сокет пишет только поток отправки, control он заберет первым
+    parser_->setTxSink([this](FrameBuffer&& frame, SliceChain&& body){
+        queue_.push(frame_lane(frame), std::move(frame), std::move(body));
+        return true;
+    });
+    need_stop_ = false;
+    // поток exec еще не запущен, колесо можно трогать отсюда
+    if (handshake_timeout_ms > 0) {
+        timers_.arm(handshake_timer_, handshake_timeout_ms);
+    }
+    last_rx_ms_ = LoopClock::nowMs();
+    if (hb_interval_ms_ > 0) {
+        timers_.arm(heartbeat_timer_, hb_interval_ms_);
+    }
     handleth_ = new std::thread([=](){
         exec();
     });
+    start_queue();
 }
 
 void ClientMultithEpoll::stop(){
@@ -324,28 +752,64 @@ void ClientMultithEpoll::stop(){
         delete handleth_;
         handleth_ = nullptr;
     }
-    close(socket_);
+    timers_.cancel(handshake_timer_);
+    timers_.cancel(heartbeat_timer_);
+    if (queue_th_){
+        queue_.notify();
+        queue_th_->join();
+        delete queue_th_;
+        queue_th_ = nullptr;
+    }
+    // потоки, которые могли писать в сокет, уже остановлены - fd можно отдавать ядру
+    if (socket_ >= 0) {
+        if (!sock_down_) remove_fd(socket_);
+        close(socket_);
+    }
     socket_ = -1;
+    sock_down_ = false;
+    mux_.clear();
+    queue_.clear();
+    delete parser_;
+    parser_ = nullptr;
 }
 
 void ClientMultithEpoll::send(char *d, int sz){
-    if (::send(socket_, d, sz, MSG_NOSIGNAL) != sz) {
-        std::cerr << socket_ << " send() failed: " << strerror(errno) << std::endl;
+    if (!parser_ || !parser_->sendRaw(d, sz)) {
+        LOG_ERROR(socket_ << " send() failed: " << strerror(errno));
     }
 }
 
-void ClientMultithEpoll::queue_add(char *d, int sz){
-    std::lock_guard<std::mutex> lock(mtx_queue_);
-    queue_.push(std::make_pair(d, sz));
+void ClientMultithEpoll::queue_add(char *d, int sz, SendLane lane){
+    queue_.push(lane, d, sz);
+}
+
+bool ClientMultithEpoll::send_packet(uint64_t seq_num, SliceChain&& payload){
+    if (!parser_) {
+        return false;
+    }
+    ParsedMessage msg;
+    parser_->sendDataPkt(msg, seq_num, std::move(payload));
+    return true;
 }
 
 void ClientMultithEpoll::queue_send(){
-    std::lock_guard<std::mutex> lock(mtx_queue_);
-    while(!queue_.empty()){
-        auto el = queue_.front();
-        queue_.pop();
-        send(el.first, el.second);
+    if (!drain_all()) {
+        LOG_ERROR(socket_ << " queue_send() failed: " << strerror(errno));
+    }
+}
+
+bool ClientMultithEpoll::drain_all(){
+    if (!parser_) {
+        return false;
     }
+    // по куску с каждого потока за раз, между кусками проходят остальные кадры
+    do {
+        mux_.pump(*parser_, MUX_ROUND_BYTES);
+        if (!queue_.drain(wire_send_, SEND_ROUND_BYTES)) {
+            return false;
+        }
+    } while (!need_stop_ && (!queue_.empty() || mux_.activeStreams()));
+    return true;
 }
 
 void ClientMultithEpoll::on_epoll_event(int fd, uint32_t evs){
@@ -354,8 +818,8 @@ void ClientMultithEpoll::on_epoll_event(int fd, uint32_t evs){
     }
     // close socket
     if (evs & (EPOLLHUP | EPOLLRDHUP | EPOLLERR)) {
-        close(socket_);
-        socket_ = -1;
+        trace(TraceEv::CLOSE, socket_, TRACE_CLOSE_HUP);
+        drop_socket();
         d("close client " << fd);
         clientHandler_->onEvent(need_reconnect_ ? EventType::Reconnected : EventType::Disconnected);
         if (need_reconnect_){
@@ -370,7 +834,7 @@ void ClientMultithEpoll::on_epoll_event(int fd, uint32_t evs){
     // тут один единственный сокет, поэтому без проверок
     handle_socket_data();
 
-    if (socket_ == -1 && need_reconnect_){
+    if (sock_down_ && need_reconnect_){
         // reconnect();
     }
 }
@@ -379,29 +843,82 @@ void ClientMultithEpoll::handle_socket_data(){
     ssize_t n;
     // это не SubEpoll, тут не нужна статистика
     // std::cout << "2handle_socket_data " << n << std::endl;
-    n = recv(socket_, buffer, sizeof(buffer), 0);
+    n = parser_->recvSome();
     if (n > 0) {
-        // clientHandler_->onEvent()
-        // if (on_recv_handler)
-        //     on_recv_handler(buffer, n);
-        // if (write_to_stdout(buffer, n) != 0) {
-        //     throw std::runtime_error("write to stdout");
-        // }
+        last_rx_ms_ = LoopClock::nowMs();
+        while (parser_->tryParseMessage(msg_)) {
+            switch (msg_.type) {
+            case MessageType::AUTH_RESPONSE:
+                if (handshake_timer_.armed()) {
+                    timers_.cancel(handshake_timer_);
+                    clientHandler_->onEvent(EventType::Waiting);
+                }
+                break;
+            case MessageType::PING:
+                parser_->sendPong(hb_msg_, msg_.heartbeat);
+                continue;
+            case MessageType::PONG:
+                if (stats_) {
+                    add_rtt_sample(*stats_, msg_.heartbeat.send_time_us);
+                }
+                continue;
+            default:
+                break;
+            }
+            clientHandler_->onMessage(msg_);
+        }
+        if (stats_) {
+            note_rx_errors(*parser_, *stats_);
+        }
     } else if (n == 0) {
-        close(socket_);
-        socket_ = -1;
-    } else {
+        trace(TraceEv::CLOSE, socket_, TRACE_CLOSE_EOF);
+        drop_socket();
+    } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
         throw std::runtime_error("recv from socket");
     }
 }
 
+void ClientMultithEpoll::handshake_timeout(){
+    if (sock_down_) {
+        return;
+    }
+    d("handshake timeout " << socket_);
+    trace(TraceEv::CLOSE, socket_, TRACE_CLOSE_DEADLINE);
+    drop_socket();
+    clientHandler_->onEvent(EventType::HandshakeTimeout);
+}
+
+void ClientMultithEpoll::heartbeat(){
+    if (sock_down_) {
+        return;
+    }
+    // tcp заметит мертвый сервер через минуты, а мы - через hb_misses_ интервалов
+    if (elapsedSince(LoopClock::nowMs(), last_rx_ms_) > uint64_t(hb_interval_ms_) * hb_misses_) {
+        d("heartbeat lost " << socket_);
+        trace(TraceEv::CLOSE, socket_, TRACE_CLOSE_HEARTBEAT);
+        drop_socket();
+        clientHandler_->onEvent(need_reconnect_ ? EventType::Reconnected : EventType::Disconnected);
+        return;
+    }
+    parser_->sendPing(hb_msg_, ++hb_seq_, monotonicUs());
+    timers_.arm(heartbeat_timer_, hb_interval_ms_);
+}
+
+// как у ClientLightEpoll, плюс поток отправки
+void ClientMultithEpoll::drop_socket(){
+    remove_fd(socket_);
+    shutdown(socket_, SHUT_RDWR);
+    sock_down_ = true;
+}
+
 void ClientMultithEpoll::start_queue(){
     queue_th_ = new std::thread([&](){
         while (!need_stop_){
-            if (queue_.empty()){
+            queue_.waitPending(std::chrono::milliseconds(200));
+            if (!drain_all()){
+                // сокет умер, ждем stop/reconnect, а не крутимся
                 std::this_thread::sleep_for(std::chrono::milliseconds(200));
             }
-            queue_send();
         }
     });
 }
@@ -416,6 +933,7 @@ ServerMultithEpoll::ServerMultithEpoll(IClientEventHandler *clh){
 ServerMultithEpoll::~ServerMultithEpoll() {
     for (auto& e : subepolls_) {
         e->stop();
+        delete e;
     }
     subepolls_.clear();
 }
@@ -433,8 +951,17 @@ void ServerMultithEpoll::start_handle(int sock, int count_workers){
 
     for (size_t i = 0; i < count_workers; ++i) {
         auto* subepoll = new ServerSubEpoll();
+        subepoll->set_rpc(hooks_.rpc);
+        subepoll->set_stream_handler(hooks_.streams);
+        subepoll->set_timeouts(hooks_.handshake_timeout_ms, hooks_.idle_timeout_ms);
+        subepoll->set_heartbeat(hooks_.heartbeat_interval_ms, hooks_.heartbeat_misses);
+        subepoll->set_compression(hooks_.compression, hooks_.lz_dict_log2);
+        subepoll->set_checksum(hooks_.checksum);
+        subepoll->set_perf_counters(perf_counters_);
         subepoll->start_handle(-1);
+        subepolls_.push_back(subepoll);
     }
+    balancer_.setWorkers(subepolls_.size());
 }
 
 void ServerMultithEpoll::stop(){
@@ -458,6 +985,33 @@ int ServerMultithEpoll::countClients(){
     return full;
 }
 
+RxErrors ServerMultithEpoll::rxErrors() const {
+    RxErrors r;
+    for (auto e: subepolls_){
+        r.merge(e->rxErrors());
+    }
+    return r;
+}
+
+LatencyReport ServerMultithEpoll::latency() const {
+    LatencyReport r = IEpoll::latency();
+    for (auto e: subepolls_){
+        r.merge(e->latency());
+    }
+    return r;
+}
+
+PerfReport ServerMultithEpoll::perf() const {
+    PerfReport r;
+    for (ServerSubEpoll* e : subepolls_) {
+        PerfReport w = e->perf();
+        if (w.available) {
+            r.merge(w);
+        }
+    }
+    return r;
+}
+
 void ServerMultithEpoll::on_epoll_event(int fd, uint32_t evs){
     if (evs & (EPOLLHUP | EPOLLRDHUP | EPOLLERR)) {
         if (fd == socket_) {
@@ -489,11 +1043,16 @@ void ServerMultithEpoll::handle_accept(){
         Stats st;
         st.ip = std::string(ip_str) + ":" + std::to_string(ntohs(client_addr.sin_port));
 
+        trace(TraceEv::ACCEPT, client_fd, client_addr.sin_addr.s_addr, ntohs(client_addr.sin_port));
+        set_nodelay(client_fd);
+
         //balance_socket
-        auto* min_subepoll = *std::min_element (subepolls_.begin(), subepolls_.end(), [](auto* a, auto* b) {
-            return a->countClients() < b->countClients();
-        });
-        min_subepoll->push_external_socket(client_fd, st);
+        size_t i = balancer_.pick([this](size_t i){
+            ServerSubEpoll* e = subepolls_[i];
+            return WorkerLoad{e->countClients(), e->loadBps(), e->busyRatio()};
+        }, client_addr.sin_addr.s_addr);
+        trace(TraceEv::HANDOFF, client_fd, i);
+        subepolls_[i]->push_external_socket(client_fd, st);
     }
 
 
@@ -503,6 +1062,18 @@ ServerSubEpoll::ServerSubEpoll(){
     on_event_handlers = [this](int fd, uint32_t evs) {
         on_epoll_event(fd, evs);
     };
+    load_timer_.cb = [this]{
+        update_load();
+    };
+    wakeup_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeup_fd_ == -1 || !add_fd(wakeup_fd_, EPOLLIN))
+        throw std::runtime_error("eventfd");
+}
+
+ServerSubEpoll::~ServerSubEpoll(){
+    if (wakeup_fd_ >= 0) {
+        close(wakeup_fd_);
+    }
 }
 
 void ServerSubEpoll::start_handle(int sock){
@@ -512,7 +1083,12 @@ void ServerSubEpoll::start_handle(int sock){
         return;
     }
     socket_ = sock;
+    load_start_ms_ = TimerWheel::nowMs();
+    timers_.arm(load_timer_, LOAD_INTERVAL_MS);
     handleth_ = new std::thread([&](){
+        if (perf_enabled_ && !perf_.open()) {
+            LOG_WARN("perf_event_open: " << strerror(errno));
+        }
         exec();
     });
 }
@@ -530,12 +1106,34 @@ void ServerSubEpoll::stop(){
 
     d("stop server:" << clients.size())
         while(!clients.empty()){
+        trace(TraceEv::CLOSE, clients.begin()->first, TRACE_CLOSE_STOP);
         remove_client(clients.begin()->first);
     }
 }
 
 int ServerSubEpoll::countClients(){
-    return clients.size();
+    return count_clients_.load(std::memory_order_relaxed);
+}
+
+void ServerSubEpoll::update_load(){
+    uint64_t now = TimerWheel::nowMs();
+    if (now > load_start_ms_) {
+        load_bps_.store(rx_bytes_ * 1000.0 / (now - load_start_ms_), std::memory_order_relaxed);
+    }
+    if (perf_.isOpen()) {
+        PerfReport r = perf_.sample(rx_bytes_, rx_frames_);
+        std::lock_guard lock(perf_mtx_);
+        perf_last_ = r;
+    }
+    rx_bytes_ = 0;
+    rx_frames_ = 0;
+    load_start_ms_ = now;
+    timers_.arm(load_timer_, LOAD_INTERVAL_MS);
+}
+
+PerfReport ServerSubEpoll::perf(){
+    std::lock_guard lock(perf_mtx_);
+    return perf_last_;
 }
 
 void ServerSubEpoll::push_external_socket(int client_fd, const Stats &st){
@@ -543,10 +1141,39 @@ void ServerSubEpoll::push_external_socket(int client_fd, const Stats &st){
         std::lock_guard lock(mtx_pending_new_socks_);
         pending_new_socks_.push(std::make_pair(client_fd, std::move(st)));
         // добавляем тут, чтобы балансировка проходила корректно
-        // size_clients++;
+        count_clients_++;
+    }
+    uint64_t one = 1;
+    write(wakeup_fd_, &one, sizeof(one)); // разбудить epoll
+}
+
+void ServerSubEpoll::add_pending_sockets(){
+    uint64_t cnt;
+    read(wakeup_fd_, &cnt, sizeof(cnt));
+
+    std::queue<std::pair<int, Stats>> socks;
+    {
+        std::lock_guard lock(mtx_pending_new_socks_);
+        socks.swap(pending_new_socks_);
+    }
+    while (!socks.empty()) {
+        auto& el = socks.front();
+        if (add_fd(el.first, EPOLLIN | EPOLLRDHUP)) {
+            int fd = el.first;
+            trace(TraceEv::ADD_CLIENT, fd);
+            auto& c = clients.try_emplace(fd, fd, std::move(el.second)).first->second;
+            init_parser(c, hooks_, &one_way_latency_);
+            watch_client(timers_, hooks_, c, [this, fd]{
+                expire_client(fd);
+            }, [this, fd]{
+                heartbeat_client(fd);
+            });
+        } else {
+            close(el.first);
+            count_clients_--;
+        }
+        socks.pop();
     }
-    // uint64_t one = 1;
-    // write(wakeup_fd, &one, sizeof(one)); // разбудить epoll
 }
 
 void ServerSubEpoll::on_epoll_event(int fd, uint32_t evs){
@@ -555,49 +1182,82 @@ void ServerSubEpoll::on_epoll_event(int fd, uint32_t evs){
             need_stop_ = true;
             d("need stop server epoll " << socket_)
         } else {
+            trace(TraceEv::CLOSE, fd, TRACE_CLOSE_HUP);
             remove_client(fd);
-            std::cout << "server remove client " << fd << std::endl;
+            LOG_INFO("server remove client " << fd);
             // clientHandler_->onEvent(EventType::ClientDisconnect);
         }
         return;
     }
 
+    if (evs & EPOLLOUT) {
+        auto it = clients.find(fd);
+        if (it != clients.end() && !flush_client(fd, it->second)) {
+            trace(TraceEv::CLOSE, fd, TRACE_CLOSE_TX);
+            remove_client(fd);
+            return;
+        }
+    }
     if (evs & EPOLLIN) {
         // if (socket_ > 0 && fd == socket_) handle_accept();
         // else if (clients.count(fd)) handle_client_data(fd);
 
-        // тут только клиенты, так что без проверки if (clients.count(fd))
-        handle_client_data(fd);
+        if (fd == wakeup_fd_) add_pending_sockets();
+        else handle_client_data(fd);
     }
 }
 
 void ServerSubEpoll::remove_client(int fd){
+    if (!clients.count(fd)) return;
     d("remove_client " << fd)
         // count_fd--;
         remove_fd(fd);
+    report_rx_errors(fd, clients.at(fd));
+    drop_streams(fd, clients.at(fd), hooks_);
     {
         // std::unique_lock lock(mtx_clients);// запись
-        clients.erase(fd);
+        if (clients.erase(fd)) count_clients_--;
     }
 
     // size_clients--;
     close(fd);
 }
 
-void ServerSubEpoll::handle_client_data(int fd){
-    ssize_t n;
-    n = recv(fd, buffer, sizeof(buffer), 0);
-    if (n > 0) {
-        // std::cout << "1handle_client_data " << n << std::endl;
+void ServerSubEpoll::expire_client(int fd){
+    d("deadline client " << fd)
+    trace(TraceEv::CLOSE, fd, TRACE_CLOSE_DEADLINE);
+    remove_client(fd);
+}
 
-        {
-            // std::unique_lock lock(mtx_clients); // чтение - Запись? unique_lock
-            clients[fd].addBytes(n);
-        }
-        // if (write_to_stdout(buffer, SERVER_WRITE_STDOUT?n:0) != 0) {
-        //     throw std::runtime_error("write to stdout");
-        // }
-    } else {
+void ServerSubEpoll::heartbeat_client(int fd){
+    auto it = clients.find(fd);
+    if (it == clients.end()) {
+        return;
+    }
+    if (!ping_client(timers_, hooks_, it->second)) {
+        d("heartbeat lost " << fd)
+        expire_client(fd);
+    } else if (!sync_writable(fd, it->second)) {
+        trace(TraceEv::CLOSE, fd, TRACE_CLOSE_TX);
+        remove_client(fd);
+    }
+}
+
+void ServerSubEpoll::handle_client_data(int fd){
+    auto it = clients.find(fd);
+    if (it == clients.end()) {
+        return;
+    }
+    ssize_t n = read_client(fd, it->second, hooks_, timers_, &rx_frames_);
+    note_rx_errors(it->second.parser, it->second.stats);
+    if (n < 0) {
+        trace(TraceEv::CLOSE, fd, TRACE_CLOSE_EOF);
+        remove_client(fd);
+        return;
+    }
+    rx_bytes_ += n;
+    if (!sync_writable(fd, it->second)) {
+        trace(TraceEv::CLOSE, fd, TRACE_CLOSE_TX);
         remove_client(fd);
     }
 }
@@ -4,14 +4,25 @@
 #include <functional>
 #include <sys/epoll.h>
 #include <atomic>
+#include <unordered_set>
 #include "const.h"
 #include "stats.h"
+#include "serialization.h"
+#include "rpc.h"
+#include "stream.h"
+#include "sendqueue.h"
+#include "timerwheel.h"
+#include "balancer.h"
+#include "histogram.h"
+#include "perfcounters.h"
+#include "fastclock.h"
 
 
 enum class EventType {
     Disconnected,
     Reconnected,
     Waiting,
+    HandshakeTimeout, // сервер не ответил на auth
 
     ClientDisconnect
 };
@@ -21,6 +32,42 @@ class IClientEventHandler {
 public:
     virtual ~IClientEventHandler() = default;
     virtual void onEvent(EventType e) = 0;
+    // разобранный кадр из потока epoll
+    virtual void onMessage(ParsedMessage&) {}
+};
+
+// состояние клиента на сервере
+struct ClientConn {
+    ClientConn(int fd, Stats&& st) : stats(std::move(st)), parser(fd) {}
+
+    Stats stats;
+    MessageParser parser;
+    ParsedMessage msg;   // последний разобранный кадр
+    ParsedMessage reply; // для ответов, msg при этом еще читаем
+    bool authed = false; // или auth не требуется
+    TimerWheel::Timer deadline; // до auth - handshake, потом idle
+    TimerWheel::Timer heartbeat;
+    uint64_t last_rx_ms = 0; // для heartbeat: когда клиент что-то присылал
+    uint64_t ping_seq = 0;
+    bool want_out = false; // в epoll есть EPOLLOUT: parser досылает backlog
+    std::unordered_set<uint32_t> streams; // потоки без fin, при закрытии сообщаем обработчику
+};
+
+// узлы с ClientConn из арены потока epoll, который их добавляет
+using ClientMap = std::unordered_map<int, ClientConn, std::hash<int>, std::equal_to<int>,
+                                     ArenaAllocator<std::pair<const int, ClientConn>>>;
+
+// что делать с кадрами клиентов и когда их отключать, общее для серверных epoll
+struct ServerHooks {
+    RpcServer* rpc = nullptr;
+    StreamHandler* streams = nullptr;
+    int handshake_timeout_ms = 0; // 0 - auth не обязателен
+    int idle_timeout_ms = 0;      // 0 - молчащих не отключаем
+    int heartbeat_interval_ms = 0; // 0 - без ping
+    int heartbeat_misses = 3;      // столько интервалов тишины - соединение мертвое
+    bool checksum = false;         // соглашаться на crc32c, если клиент предложит
+    bool compression = false;      // соглашаться на LZ, если клиент предложит
+    uint8_t lz_dict_log2 = LZ_DICT_LOG2; // потолок словаря на соединение
 };
 
 
@@ -40,11 +87,37 @@ protected:
     std::function<void(int fd, uint32_t events)> on_event_handlers = 0;
 
     bool add_fd(int fd, uint32_t events);
+    bool mod_fd(int fd, uint32_t events);
     void remove_fd(int fd);
+    // после разбора: счетчики parser в Stats соединения, прирост - в итог потока
+    void note_rx_errors(const MessageParser& p, Stats& st);
+    // после отправок клиенту: EPOLLOUT только пока есть backlog. false - клиента закрыть
+    bool sync_writable(int fd, ClientConn& c);
+    // EPOLLOUT: досылаем backlog. false - клиента закрыть
+    bool flush_client(int fd, ClientConn& c);
+
+    std::atomic<bool> need_stop_{false};
+    // таймеры потока exec, задают timeout epoll_wait
+    TimerWheel timers_;
+    // пишет только поток exec; one_way - через parser->setOneWayHistogram
+    LatencyHistogram wakeup_latency_;
+    LatencyHistogram one_way_latency_;
 
-    bool need_stop_ = false;
+public:
+    // доля времени exec в обработчиках за последнее окно, 0..1; из любого потока
+    double busyRatio() const { return busy_ratio_.load(std::memory_order_relaxed); }
+    // задержки этого потока с начала работы; из любого потока
+    LatencyReport latency() const;
+    // отброшенное на приеме всеми соединениями потока, и уже закрытыми; из любого потока
+    RxErrors rxErrors() const;
 
 private:
+    static constexpr uint64_t BUSY_WINDOW_US = 1000000;
+    std::atomic<double> busy_ratio_{0};
+    // пишет только поток exec
+    RelaxedAtomic<uint64_t> rx_crc_;
+    RelaxedAtomic<uint64_t> rx_resyncs_;
+    RelaxedAtomic<uint64_t> rx_resync_bytes_;
     int epfd_ = -1;
     static const int MAX_EVENTS = 64;
 };
@@ -58,7 +131,8 @@ public:
     // (this->*handler_ptr)(fd, evs);
 
     ClientLightEpoll(IClientEventHandler* clh);
-    void start_handle(int sock);
+    // handshake_timeout_ms > 0 - ждем AUTH_RESPONSE, иначе HandshakeTimeout
+    void start_handle(int sock, int handshake_timeout_ms = 0);
     void stop();
 
     bool need_reconnect_ = false;
@@ -67,22 +141,60 @@ public:
     //ВЫНЕСТИ ЭТО в класс для send recv
     // now in socket
     void send(char* d, int sz);
-    // using queue or lockfree queue
-    void queue_add(char* d, int sz);
+    // d не копируется, должен жить до отправки
+    void queue_add(char* d, int sz, SendLane lane = SendLane::BULK);
+    bool send_packet(uint64_t seq_num, SliceChain&& payload);
     // get from q and call send
+    // + куски логических потоков; control кадры уходят сразу, без queue_send
     void queue_send();
 
+    uint32_t stream_open() { return mux_.open(); }
+    // складывает в mux_, отправка в queue_send
+    bool stream_write(uint32_t id, const char* d, size_t sz, bool fin) { return mux_.write(id, d, sz, fin); }
+    void set_lane_weight(SendLane lane, uint32_t w) { queue_.setWeight(lane, w); }
+    // до start_handle: ping раз в interval_ms; rtt и отброшенное на приеме пишутся в st
+    void set_heartbeat(int interval_ms, int misses, Stats* st) {
+        hb_interval_ms_ = interval_ms;
+        hb_misses_ = misses;
+        stats_ = st;
+    }
+    // + ожидание в очереди отправки
+    LatencyReport latency() const {
+        LatencyReport r = IEpoll::latency();
+        r.queue_dwell = queue_.dwell();
+        return r;
+    }
+
+
+    // живет от start_handle до stop, через него rpc и кадры
+    MessageParser* parser() { return parser_; }
 
 private:
     void on_epoll_event(int fd, uint32_t evs);
     void handle_socket_data();
+    void handshake_timeout();
+    void heartbeat();
+    void drop_socket();
 
     std::thread* handleth_ = 0;
-    static constexpr size_t BUF_SIZE = 65536;
-    char buffer[BUF_SIZE];
     int socket_ = -1;
-
-    std::queue<std::pair<char*,int>> queue_;
+    bool sock_down_ = false; // shutdown из потока exec, close только в stop
+    MessageParser* parser_ = nullptr;
+    ParsedMessage msg_;
+    StreamMux mux_;
+    TimerWheel::Timer handshake_timer_;
+
+    TimerWheel::Timer heartbeat_timer_;
+    ParsedMessage hb_msg_; // ping и pong, только из потока exec
+    int hb_interval_ms_ = 0;
+    int hb_misses_ = 3;
+    uint64_t hb_seq_ = 0;
+    uint64_t last_rx_ms_ = 0;
+    Stats* stats_ = nullptr;
+
+    bool drain_all();
+    PrioritySendQueue queue_;
+    PrioritySendQueue::SendFn wire_send_;
 };
 
 // должен быть тем же что и ClientLightEpoll
@@ -96,20 +208,39 @@ public:
     void start_handle(int sock);
     void stop();
     int countClients();
+    using IEpoll::latency;
+    using IEpoll::rxErrors;
+    // до start_handle
+    void set_rpc(RpcServer* rpc) { hooks_.rpc = rpc; }
+    void set_stream_handler(StreamHandler* h) { hooks_.streams = h; }
+    void set_timeouts(int handshake_ms, int idle_ms) {
+        hooks_.handshake_timeout_ms = handshake_ms;
+        hooks_.idle_timeout_ms = idle_ms;
+    }
+    void set_heartbeat(int interval_ms, int misses) {
+        hooks_.heartbeat_interval_ms = interval_ms;
+        hooks_.heartbeat_misses = misses;
+    }
+    void set_compression(bool on, uint8_t dict_log2) {
+        hooks_.compression = on;
+        hooks_.lz_dict_log2 = dict_log2;
+    }
+    void set_checksum(bool on) { hooks_.checksum = on; }
 
 private:
     void on_epoll_event(int fd, uint32_t evs);
 
     void remove_client(int fd);
+    void expire_client(int fd);
+    void heartbeat_client(int fd);
     void handle_client_data(int fd);
     void handle_accept();
 
     std::thread* handleth_ = 0;
     int socket_ = -1;
-    static constexpr size_t BUF_SIZE = 65536;
-    char buffer[BUF_SIZE];
+    ServerHooks hooks_;
 
-    std::unordered_map<int, Stats> clients;
+    ClientMap clients;
 };
 
 
@@ -119,7 +250,8 @@ class ClientMultithEpoll : protected IEpoll
 {
 public:
     ClientMultithEpoll(IClientEventHandler* clh);
-    void start_handle(int sock);
+    // handshake_timeout_ms > 0 - ждем AUTH_RESPONSE, иначе HandshakeTimeout
+    void start_handle(int sock, int handshake_timeout_ms = 0);
     void stop();
 
     bool need_reconnect_ = false;
@@ -127,24 +259,64 @@ public:
     //ВЫНЕСТИ ЭТО в класс для send recv
     // now in socket
     void send(char* d, int sz);
-    // using queue or lockfree queue
-    void queue_add(char* d, int sz);
+    // d не копируется, должен жить до отправки
+    void queue_add(char* d, int sz, SendLane lane = SendLane::BULK);
+    bool send_packet(uint64_t seq_num, SliceChain&& payload);
     // get from q and call send
+    // + куски логических потоков; обычно зовет поток отправки
     void queue_send();
 
+    uint32_t stream_open() { return mux_.open(); }
+    bool stream_write(uint32_t id, const char* d, size_t sz, bool fin) {
+        bool ok = mux_.write(id, d, sz, fin);
+        queue_.notify();
+        return ok;
+    }
+    void set_lane_weight(SendLane lane, uint32_t w) { queue_.setWeight(lane, w); }
+    // до start_handle: ping раз в interval_ms; rtt и отброшенное на приеме пишутся в st
+    void set_heartbeat(int interval_ms, int misses, Stats* st) {
+        hb_interval_ms_ = interval_ms;
+        hb_misses_ = misses;
+        stats_ = st;
+    }
+    // + ожидание в очереди отправки
+    LatencyReport latency() const {
+        LatencyReport r = IEpoll::latency();
+        r.queue_dwell = queue_.dwell();
+        return r;
+    }
+
+    // живет от start_handle до stop, через него rpc и кадры
+    MessageParser* parser() { return parser_; }
+
 private:
     void on_epoll_event(int fd, uint32_t evs);
     void handle_socket_data();
+    void handshake_timeout();
+    void heartbeat();
+    void drop_socket();
 
     std::thread* handleth_ = 0;
-    static constexpr size_t BUF_SIZE = 65536;
-    char buffer[BUF_SIZE];
     int socket_ = -1;
-
+    bool sock_down_ = false; // shutdown из потока exec, close только в stop
+    MessageParser* parser_ = nullptr;
+    ParsedMessage msg_;
+    StreamMux mux_;
+    TimerWheel::Timer handshake_timer_;
+
+    TimerWheel::Timer heartbeat_timer_;
+    ParsedMessage hb_msg_; // ping и pong, только из потока exec
+    int hb_interval_ms_ = 0;
+    int hb_misses_ = 3;
+    uint64_t hb_seq_ = 0;
+    uint64_t last_rx_ms_ = 0;
+    Stats* stats_ = nullptr;
+
+    bool drain_all();
     void start_queue();
-    std::thread* queue_th_;
-    std::mutex mtx_queue_;
-    std::queue<std::pair<char*,int>> queue_;
+    std::thread* queue_th_ = nullptr;
+    PrioritySendQueue queue_;
+    PrioritySendQueue::SendFn wire_send_;
 };
 
 // wait th + n th recv clns
@@ -153,9 +325,35 @@ class ServerSubEpoll : protected IEpoll
 {
 public:
     ServerSubEpoll();
+    ~ServerSubEpoll();
     void start_handle(int sock);
     void stop();
+    // можно звать из любого потока, учитывает и еще не добавленные
     int countClients();
+    // входящий трафик за последний интервал, байт/с; из любого потока
+    double loadBps() const { return load_bps_.load(std::memory_order_relaxed); }
+    using IEpoll::busyRatio;
+    using IEpoll::latency;
+    using IEpoll::rxErrors;
+    void set_rpc(RpcServer* rpc) { hooks_.rpc = rpc; }
+    void set_stream_handler(StreamHandler* h) { hooks_.streams = h; }
+    void set_timeouts(int handshake_ms, int idle_ms) {
+        hooks_.handshake_timeout_ms = handshake_ms;
+        hooks_.idle_timeout_ms = idle_ms;
+    }
+    void set_heartbeat(int interval_ms, int misses) {
+        hooks_.heartbeat_interval_ms = interval_ms;
+        hooks_.heartbeat_misses = misses;
+    }
+    void set_compression(bool on, uint8_t dict_log2) {
+        hooks_.compression = on;
+        hooks_.lz_dict_log2 = dict_log2;
+    }
+    void set_checksum(bool on) { hooks_.checksum = on; }
+    // до start_handle: счетчики PMU своего потока, снимок раз в LOAD_INTERVAL_MS
+    void set_perf_counters(bool on) { perf_enabled_ = on; }
+    // последний интервал, из любого потока; available == 0 - выключено или ядро не дало
+    PerfReport perf();
 
     // очередь для передачи сокетов между потоками
     void push_external_socket(int client_fd, const Stats &st);
@@ -164,17 +362,32 @@ private:
     void on_epoll_event(int fd, uint32_t evs);
 
     void remove_client(int fd);
+    void expire_client(int fd);
+    void heartbeat_client(int fd);
 
     void handle_client_data(int fd);
+    void add_pending_sockets();
+    void update_load();
 
     std::thread* handleth_ = 0;
     int socket_ = -1;
-    static constexpr size_t BUF_SIZE = 65536;
-    char buffer[BUF_SIZE];
-    std::unordered_map<int, Stats> clients;
-
-
-    // int wakeup_fd = -1; // для пробуждения epoll
+    ServerHooks hooks_;
+    ClientMap clients;
+    std::atomic<int> count_clients_{0};
+
+    static constexpr uint32_t LOAD_INTERVAL_MS = 1000;
+    TimerWheel::Timer load_timer_;
+    uint64_t rx_bytes_ = 0; // за текущий интервал, только поток exec
+    uint64_t rx_frames_ = 0;
+    uint64_t load_start_ms_ = 0;
+    std::atomic<double> load_bps_{0};
+
+    bool perf_enabled_ = false;
+    PerfCounters perf_; // только поток exec
+    std::mutex perf_mtx_;
+    PerfReport perf_last_;
+
+    int wakeup_fd_ = -1; // для пробуждения epoll
     std::queue<std::pair<int, Stats>> pending_new_socks_; // новые сокеты от MainEpoll
     std::mutex mtx_pending_new_socks_; // защищает очередь
 };
@@ -191,11 +404,37 @@ public:
     void start_handle(int sock, int count_workers);
     void stop();
     int countClients();
+    // поток accept + все воркеры
+    LatencyReport latency() const;
+    RxErrors rxErrors() const;
+    // до start_handle
+    void set_balance(BalancePolicy policy) { balancer_.setPolicy(policy); }
+    void set_perf_counters(bool on) { perf_counters_ = on; }
+    // сумма воркеров за последний интервал
+    PerfReport perf() const;
+    void set_rpc(RpcServer* rpc) { hooks_.rpc = rpc; }
+    void set_stream_handler(StreamHandler* h) { hooks_.streams = h; }
+    void set_timeouts(int handshake_ms, int idle_ms) {
+        hooks_.handshake_timeout_ms = handshake_ms;
+        hooks_.idle_timeout_ms = idle_ms;
+    }
+    void set_heartbeat(int interval_ms, int misses) {
+        hooks_.heartbeat_interval_ms = interval_ms;
+        hooks_.heartbeat_misses = misses;
+    }
+    void set_compression(bool on, uint8_t dict_log2) {
+        hooks_.compression = on;
+        hooks_.lz_dict_log2 = dict_log2;
+    }
+    void set_checksum(bool on) { hooks_.checksum = on; }
 
 private:
     void on_epoll_event(int fd, uint32_t evs);
     void handle_accept();
     std::vector<ServerSubEpoll*> subepolls_;
+    Balancer balancer_; // только поток accept
+    ServerHooks hooks_;
+    bool perf_counters_ = false;
 
     std::thread* handleth_ = 0;
     int socket_ = -1;
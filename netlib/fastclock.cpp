@@ -0,0 +1,106 @@
+#include "fastclock.h"
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define FASTCLOCK_HAS_TSC 1
+#else
+#define FASTCLOCK_HAS_TSC 0
+#endif
+
+namespace {
+
+constexpr uint64_t CALIBRATE_NS = 10 * 1000000ull;
+
+uint64_t clock_ns(clockid_t id){
+    timespec ts;
+    clock_gettime(id, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+struct Calibration {
+    bool tsc = false;
+    uint64_t base_tsc = 0;
+    uint64_t base_ns = 0;
+    uint64_t mult = 0; // нс на тик << 32
+    double ticks_per_ns = 0;
+};
+
+#if FASTCLOCK_HAS_TSC
+// CPUID 0x80000007 EDX[8]: частота не зависит от P/C-состояний и одна на все ядра
+bool invariant_tsc(){
+    unsigned a, b, c, d;
+    if (!__get_cpuid(0x80000000, &a, &b, &c, &d) || a < 0x80000007) {
+        return false;
+    }
+    __get_cpuid(0x80000007, &a, &b, &c, &d);
+    return d & (1u << 8);
+}
+
+// пара (tsc, ns), снятая как можно ближе друг к другу: берем самое узкое окно из нескольких
+void sample_pair(uint64_t& tsc, uint64_t& ns){
+    uint64_t best = ~0ull;
+    for (int i = 0; i < 5; ++i) {
+        uint64_t t0 = __rdtsc();
+        uint64_t n = clock_ns(CLOCK_MONOTONIC);
+        uint64_t t1 = __rdtsc();
+        if (t1 - t0 < best) {
+            best = t1 - t0;
+            tsc = t0 + (t1 - t0) / 2;
+            ns = n;
+        }
+    }
+}
+#endif
+
+Calibration calibrate(){
+    Calibration c;
+#if FASTCLOCK_HAS_TSC
+    if (invariant_tsc()) {
+        uint64_t tsc0, ns0, tsc1, ns1;
+        sample_pair(tsc0, ns0);
+        timespec pause{0, long(CALIBRATE_NS)};
+        nanosleep(&pause, nullptr);
+        sample_pair(tsc1, ns1);
+        if (tsc1 > tsc0 && ns1 > ns0) {
+            c.tsc = true;
+            c.ticks_per_ns = double(tsc1 - tsc0) / double(ns1 - ns0);
+            c.mult = uint64_t(double(1ull << 32) / c.ticks_per_ns);
+            c.base_tsc = tsc1;
+            c.base_ns = ns1;
+        }
+    }
+#endif
+    return c;
+}
+
+const Calibration& calibration(){
+    static const Calibration c = calibrate();
+    return c;
+}
+
+} // namespace
+
+void FastClock::calibrate(){
+    calibration();
+}
+
+uint64_t FastClock::nowNs(){
+    const Calibration& c = calibration();
+#if FASTCLOCK_HAS_TSC
+    if (c.tsc) {
+        // TSC соседних ядер может отставать на десятки тактов от base_tsc
+        int64_t delta = int64_t(__rdtsc() - c.base_tsc);
+        return delta > 0 ? c.base_ns + uint64_t((unsigned __int128)delta * c.mult >> 32) : c.base_ns;
+    }
+#endif
+    return clock_ns(CLOCK_MONOTONIC_COARSE);
+}
+
+bool FastClock::usesTsc(){
+    return calibration().tsc;
+}
+
+double FastClock::ticksPerNs(){
+    return calibration().ticks_per_ns;
+}
@@ -0,0 +1,54 @@
+#ifndef FASTCLOCK_H
+#define FASTCLOCK_H
+
+#include <cstdint>
+
+/*
+ * дешевые монотонные наносекунды.
+ * с invariant TSC - rdtsc, пересчитанный калибровкой против CLOCK_MONOTONIC
+ * (~10 мс сна): пара наносекунд против ~20 у vDSO clock_gettime.
+ * калибровку делает calibrate() при старте (конструкторы сервера и клиента, main у mync),
+ * иначе ее оплатит первый nowNs() - на горячем пути.
+ * без него (старый CPU, не x86) - CLOCK_MONOTONIC_COARSE: тоже дешево, но точность - тик ядра.
+ * отсчет совпадает с CLOCK_MONOTONIC на момент калибровки, дальше может уплыть
+ * на единицы мкс в секунду - для длительностей и статистики, не для сравнения с чужими часами.
+ */
+class FastClock {
+public:
+    // идемпотентно, звать до запуска потоков ввода-вывода
+    static void calibrate();
+    static uint64_t nowNs();
+    static bool usesTsc();
+    // тиков TSC в наносекунде, 0 - без TSC
+    static double ticksPerNs();
+};
+
+/*
+ * "сейчас" цикла событий: tick() один раз после epoll_wait, обработчики читают
+ * nowNs() из thread_local без обращения к часам. время замирает на итерацию,
+ * для bps, дедлайнов и возраста соединений этого хватает.
+ * поток без цикла (ни разу не звал tick) получает живое FastClock::nowNs().
+ */
+class LoopClock {
+public:
+    static uint64_t tick(){
+        now_ns_ = FastClock::nowNs();
+        return now_ns_;
+    }
+    static uint64_t nowNs(){
+        return now_ns_ ? now_ns_ : FastClock::nowNs();
+    }
+    static uint64_t nowMs(){
+        return nowNs() / 1000000;
+    }
+
+private:
+    static inline thread_local uint64_t now_ns_ = 0;
+};
+
+// a - b без переполнения: метки из разных потоков могут прийти в обратном порядке
+inline uint64_t elapsedSince(uint64_t now, uint64_t then){
+    return now > then ? now - then : 0;
+}
+
+#endif // FASTCLOCK_H
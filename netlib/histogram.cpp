@@ -0,0 +1,83 @@
+#include "histogram.h"
+#include <algorithm>
+#include <cstdio>
+
+uint64_t LatencyHistogram::bucketHigh(size_t i) noexcept {
+    if (i < SUB_COUNT) {
+        return i;
+    }
+    unsigned shift = static_cast<unsigned>(i / SUB_COUNT) - 1;
+    uint64_t low = (SUB_COUNT + i % SUB_COUNT) << shift;
+    return low + ((uint64_t(1) << shift) - 1);
+}
+
+LatencySnapshot LatencyHistogram::snapshot() const {
+    LatencySnapshot s;
+    for (size_t i = 0; i < BUCKETS; ++i) {
+        s.counts_[i] = counts_[i].load(std::memory_order_relaxed);
+        s.count_ += s.counts_[i];
+    }
+    s.max_ = max_.load(std::memory_order_relaxed);
+    s.sum_ = sum_.load(std::memory_order_relaxed);
+    return s;
+}
+
+void LatencySnapshot::merge(const LatencySnapshot& o){
+    for (size_t i = 0; i < counts_.size(); ++i) {
+        counts_[i] += o.counts_[i];
+    }
+    count_ += o.count_;
+    sum_ += o.sum_;
+    max_ = std::max(max_, o.max_);
+}
+
+uint64_t LatencySnapshot::percentile(double q) const {
+    if (count_ == 0) {
+        return 0;
+    }
+    // ранг первого значения, которое не меньше доли q
+    uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(q * count_ + 0.5));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts_.size(); ++i) {
+        seen += counts_[i];
+        if (seen >= rank) {
+            return std::min(LatencyHistogram::bucketHigh(i), max_);
+        }
+    }
+    return max_;
+}
+
+static std::string formatNs(uint64_t ns){
+    char buf[32];
+    if (ns < 1000) {
+        snprintf(buf, sizeof(buf), "%luns", static_cast<unsigned long>(ns));
+    } else if (ns < 1000000) {
+        snprintf(buf, sizeof(buf), "%.1fus", ns / 1e3);
+    } else if (ns < 1000000000) {
+        snprintf(buf, sizeof(buf), "%.2fms", ns / 1e6);
+    } else {
+        snprintf(buf, sizeof(buf), "%.2fs", ns / 1e9);
+    }
+    return buf;
+}
+
+std::string LatencySnapshot::summary() const {
+    return "n " + std::to_string(count_)
+        + " p50 " + formatNs(percentile(0.50))
+        + " p99 " + formatNs(percentile(0.99))
+        + " p999 " + formatNs(percentile(0.999))
+        + " max " + formatNs(max_);
+}
+
+std::string LatencyReport::toString() const {
+    std::string out;
+    auto line = [&out](const char* name, const LatencySnapshot& s) {
+        if (s.count()) {
+            out += std::string(name) + ": " + s.summary() + "\n";
+        }
+    };
+    line("queue dwell", queue_dwell);
+    line("wakeup", wakeup);
+    line("one-way", one_way);
+    return out;
+}
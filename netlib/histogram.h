@@ -0,0 +1,87 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/*
+ * log-linear гистограмма задержек (как HDR): степень двойки делится на
+ * 2^SUB_BITS равных корзин, ошибка значения не больше 1/16 (~6%) на всем диапазоне,
+ * от наносекунд до часов, память фиксированная.
+ * record - один писатель за раз (поток epoll или под мутексом очереди), без lock-префикса;
+ * snapshot можно брать из любого потока, снимки разных потоков складываются merge.
+ */
+class LatencySnapshot;
+
+class LatencyHistogram {
+public:
+    static constexpr unsigned SUB_BITS = 4;
+    static constexpr uint64_t SUB_COUNT = uint64_t(1) << SUB_BITS;
+    static constexpr size_t BUCKETS = (64 - SUB_BITS + 1) * SUB_COUNT;
+
+    void record(uint64_t ns) noexcept {
+        std::atomic<uint64_t>& c = counts_[bucketOf(ns)];
+        c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        sum_.store(sum_.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+        if (ns > max_.load(std::memory_order_relaxed)) {
+            max_.store(ns, std::memory_order_relaxed);
+        }
+    }
+
+    LatencySnapshot snapshot() const;
+
+    static size_t bucketOf(uint64_t v) noexcept {
+        if (v < SUB_COUNT) {
+            return static_cast<size_t>(v);
+        }
+        unsigned msb = 63 - __builtin_clzll(v);
+        unsigned shift = msb - SUB_BITS;
+        return (msb - SUB_BITS + 1) * SUB_COUNT + ((v >> shift) & (SUB_COUNT - 1));
+    }
+    // наибольшее значение, попадающее в корзину
+    static uint64_t bucketHigh(size_t i) noexcept;
+
+private:
+    std::array<std::atomic<uint64_t>, BUCKETS> counts_{};
+    std::atomic<uint64_t> max_{0};
+    std::atomic<uint64_t> sum_{0}; // для среднего и _sum в Prometheus
+};
+
+// копия гистограммы обычными числами: складывать, считать перцентили
+class LatencySnapshot {
+public:
+    void merge(const LatencySnapshot& o);
+
+    uint64_t count() const { return count_; }
+    uint64_t max() const { return max_; }
+    uint64_t sum() const { return sum_; } // точная сумма записанных значений, нс
+    // q из 0..1, в нс; верхняя граница корзины, но не больше max
+    uint64_t percentile(double q) const;
+    // "n 1200 p50 12.0us p99 80.0us p999 1.20ms max 3.40ms"
+    std::string summary() const;
+
+private:
+    friend class LatencyHistogram;
+    std::array<uint64_t, LatencyHistogram::BUCKETS> counts_{};
+    uint64_t count_ = 0;
+    uint64_t max_ = 0;
+    uint64_t sum_ = 0;
+};
+
+// задержки соединения или сервера, с начала работы
+struct LatencyReport {
+    LatencySnapshot queue_dwell; // кадр в очереди отправки: push -> ушел в сокет
+    LatencySnapshot wakeup;      // epoll_wait вернулся -> вызван обработчик события
+    LatencySnapshot one_way;     // отметка времени отправителя в DATA_PKT -> разбор (часы хостов должны совпадать)
+
+    void merge(const LatencyReport& o){
+        queue_dwell.merge(o.queue_dwell);
+        wakeup.merge(o.wakeup);
+        one_way.merge(o.one_way);
+    }
+    std::string toString() const;
+};
+
+#endif // HISTOGRAM_H
@@ -0,0 +1,264 @@
+#include "log.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <sys/syscall.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+constexpr size_t LINE_MAX_BYTES = 1024;
+constexpr size_t LINE_SUFFIX_BYTES = 96; // " \t(func line)\n"
+constexpr size_t RING_BYTES = 64 * 1024; // на поток
+
+// кольцо байт: пишет поток-владелец, читает только писатель лога
+struct LogRing {
+    char buf[RING_BYTES];
+    std::atomic<uint64_t> head{0};
+    std::atomic<uint64_t> tail{0};
+    std::atomic<uint64_t> dropped{0};
+
+    bool push(const char* p, size_t n){
+        uint64_t h = head.load(std::memory_order_relaxed);
+        if (RING_BYTES - (h - tail.load(std::memory_order_acquire)) < n) {
+            dropped.store(dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return false;
+        }
+        size_t at = h % RING_BYTES;
+        size_t first = std::min(n, RING_BYTES - at);
+        std::memcpy(buf + at, p, first);
+        std::memcpy(buf, p + first, n - first);
+        head.store(h + n, std::memory_order_release);
+        return true;
+    }
+};
+
+struct Logger {
+    std::atomic<int> level{NETLIB_LOG_LEVEL};
+    std::atomic<int> fd{STDOUT_FILENO};
+    std::mutex rings_mtx;
+    std::vector<LogRing*> rings;
+    std::mutex drain_mtx; // читатель колец один: поток лога, logFlush или ERROR своего кольца
+    std::once_flag started;
+
+    static Logger& get(){
+        static auto* l = new Logger(); // не разрушаем: потоки могут логировать после main
+        return *l;
+    }
+
+    void writeOut(const char* p, size_t n){
+        int out = fd.load(std::memory_order_relaxed);
+        while (n > 0) {
+            ssize_t w = ::write(out, p, n);
+            if (w < 0 && errno == EINTR) {
+                continue;
+            }
+            if (w <= 0) {
+                return;
+            }
+            p += w;
+            n -= static_cast<size_t>(w);
+        }
+    }
+
+    // под drain_mtx
+    void drainRing(LogRing* r){
+        uint64_t t = r->tail.load(std::memory_order_relaxed);
+        uint64_t h = r->head.load(std::memory_order_acquire);
+        if (h != t) {
+            size_t at = t % RING_BYTES;
+            size_t n = h - t;
+            size_t first = std::min(n, RING_BYTES - at);
+            writeOut(r->buf + at, first);
+            writeOut(r->buf, n - first);
+            r->tail.store(h, std::memory_order_release);
+        }
+        if (uint64_t lost = r->dropped.exchange(0, std::memory_order_relaxed)) {
+            char msg[64];
+            int len = snprintf(msg, sizeof(msg), "log: %llu lines dropped\n", (unsigned long long)lost);
+            writeOut(msg, len);
+        }
+    }
+
+    void drainAll(){
+        std::lock_guard drain(drain_mtx);
+        std::vector<LogRing*> snapshot;
+        {
+            std::lock_guard lock(rings_mtx);
+            snapshot = rings;
+        }
+        for (LogRing* r : snapshot) {
+            drainRing(r);
+        }
+    }
+
+    void drainOne(LogRing* r){
+        std::lock_guard drain(drain_mtx);
+        drainRing(r);
+    }
+
+    // поток выходит: дописать его кольцо и удалить, пока писатель его не держит
+    void release(LogRing* r){
+        std::lock_guard drain(drain_mtx);
+        drainRing(r);
+        {
+            std::lock_guard lock(rings_mtx);
+            rings.erase(std::find(rings.begin(), rings.end(), r));
+        }
+        delete r;
+    }
+
+    // строка мимо колец, для потоков после разрушения их local_log
+    void writeLine(const char* p, size_t n){
+        std::lock_guard drain(drain_mtx);
+        writeOut(p, n);
+    }
+
+    void start(){
+        std::call_once(started, [this]{
+            std::thread([this]{
+                for (;;) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(LOG_FLUSH_MS));
+                    drainAll();
+                }
+            }).detach();
+            atexit([]{ Logger::get().drainAll(); });
+        });
+    }
+};
+
+// тривиальный: живет и после деструктора local_log того же потока
+thread_local bool local_dead = false;
+
+struct LocalLog : std::streambuf {
+    LogRing* ring = nullptr;
+    char line[LINE_MAX_BYTES];
+    std::ostream os{this};
+    uint32_t tid = 0;
+    time_t cached_sec = -1;
+    char cached_time[16] = {};
+
+    LocalLog(){
+        reset();
+    }
+    ~LocalLog(){
+        if (ring) {
+            Logger::get().release(ring);
+            ring = nullptr;
+        }
+        local_dead = true;
+    }
+
+    // новая строка; длиннее LINE_MAX_BYTES - обрезаем
+    void reset(){
+        setp(line, line + LINE_MAX_BYTES - LINE_SUFFIX_BYTES);
+        os.clear();
+    }
+    char* end(){ return pptr(); }
+
+    LogRing* get(){
+        if (!ring) {
+            Logger& l = Logger::get();
+            ring = new LogRing();
+            tid = static_cast<uint32_t>(syscall(SYS_gettid));
+            {
+                std::lock_guard lock(l.rings_mtx);
+                l.rings.push_back(ring);
+            }
+            l.start();
+        }
+        return ring;
+    }
+
+    // HH:MM:SS раз в секунду, дальше только микросекунды
+    const char* timeOfDay(time_t sec){
+        if (sec != cached_sec) {
+            tm t;
+            localtime_r(&sec, &t);
+            strftime(cached_time, sizeof(cached_time), "%H:%M:%S", &t);
+            cached_sec = sec;
+        }
+        return cached_time;
+    }
+};
+thread_local LocalLog local_log;
+
+// буфер для строк из деструкторов thread_local после local_log, пишется синхронно
+struct LateLog {
+    std::mutex mtx;
+    LocalLog log;
+
+    static LateLog& get(){
+        static auto* l = new LateLog(); // как и Logger, не разрушаем
+        return *l;
+    }
+};
+
+LocalLog& currentLog(){
+    return local_dead ? LateLog::get().log : local_log;
+}
+
+const char LEVEL_CHAR[] = {'T', 'D', 'I', 'W', 'E'};
+
+} // namespace
+
+bool logEnabled(int level){
+    return level >= Logger::get().level.load(std::memory_order_relaxed);
+}
+
+void logSetLevel(int level){
+    Logger::get().level.store(level, std::memory_order_relaxed);
+}
+
+void logSetFd(int fd){
+    Logger::get().fd.store(fd, std::memory_order_relaxed);
+}
+
+void logFlush(){
+    Logger::get().drainAll();
+}
+
+LogLine::LogLine(int level, const char* func, int line) : level_(level), func_(func), line_(line) {
+    if (local_dead) {
+        LateLog::get().mtx.lock(); // отпускает ~LogLine
+        LateLog::get().log.tid = static_cast<uint32_t>(syscall(SYS_gettid));
+    } else {
+        local_log.get();
+    }
+    LocalLog& l = currentLog();
+    l.reset();
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    char prefix[64];
+    int n = snprintf(prefix, sizeof(prefix), "%s.%06ld %c [%u] ", l.timeOfDay(ts.tv_sec), ts.tv_nsec / 1000,
+                     LEVEL_CHAR[level < 0 ? 0 : level > LOG_LEVEL_ERROR ? LOG_LEVEL_ERROR : level], l.tid);
+    l.sputn(prefix, n);
+}
+
+std::ostream& LogLine::stream(){
+    return currentLog().os;
+}
+
+LogLine::~LogLine(){
+    LocalLog& l = currentLog();
+    char* end = l.end();
+    int n = snprintf(end, LINE_SUFFIX_BYTES, " \t(%.60s %d)\n", func_, line_);
+    end += std::min<int>(n, LINE_SUFFIX_BYTES - 1);
+    if (local_dead) {
+        Logger::get().writeLine(l.line, end - l.line);
+        LateLog::get().mtx.unlock();
+        return;
+    }
+    l.ring->push(l.line, end - l.line);
+    if (level_ >= LOG_LEVEL_ERROR) {
+        Logger::get().drainOne(l.ring); // только свое кольцо, чужие допишет поток лога
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <ostream>
+
+/*
+ * асинхронный лог: строка форматируется в буфер потока и копируется в его кольцо,
+ * в файл пишет отдельный поток раз в LOG_FLUSH_MS. на горячем пути ни блокировок,
+ * ни системных вызовов; кольцо полное - строка выкидывается и считается.
+ * уровни ниже NETLIB_LOG_LEVEL вырезаются при компиляции вместе с аргументами,
+ * выше - еще фильтр logSetLevel во время работы.
+ */
+#define LOG_LEVEL_TRACE 0
+#define LOG_LEVEL_DEBUG 1
+#define LOG_LEVEL_INFO  2
+#define LOG_LEVEL_WARN  3
+#define LOG_LEVEL_ERROR 4
+#define LOG_LEVEL_OFF   5
+
+// -DNETLIB_LOG_LEVEL=0 - все, включая d() и отправку по кадрам
+#ifndef NETLIB_LOG_LEVEL
+#define NETLIB_LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#define LOG_FLUSH_MS 10
+
+class LogLine {
+public:
+    LogLine(int level, const char* func, int line);
+    ~LogLine(); // в кольцо потока, ERROR - сразу на диск
+    LogLine(const LogLine&) = delete;
+    LogLine& operator=(const LogLine&) = delete;
+    std::ostream& stream();
+
+private:
+    int level_;
+    const char* func_;
+    int line_;
+};
+
+bool logEnabled(int level);
+void logSetLevel(int level);
+// куда писать, по умолчанию stdout; fd не закрываем
+void logSetFd(int fd);
+// все накопленное на диск, синхронно
+void logFlush();
+
+#define NETLIB_LOG(level, x) do { \
+    if constexpr ((level) >= NETLIB_LOG_LEVEL) { \
+        if (logEnabled(level)) { \
+            LogLine log_line_((level), __FUNCTION__, __LINE__); \
+            log_line_.stream() << x; \
+        } \
+    } \
+} while (0)
+
+#define LOG_TRACE(x) NETLIB_LOG(LOG_LEVEL_TRACE, x)
+#define LOG_DEBUG(x) NETLIB_LOG(LOG_LEVEL_DEBUG, x)
+#define LOG_INFO(x)  NETLIB_LOG(LOG_LEVEL_INFO, x)
+#define LOG_WARN(x)  NETLIB_LOG(LOG_LEVEL_WARN, x)
+#define LOG_ERROR(x) NETLIB_LOG(LOG_LEVEL_ERROR, x)
+
+#endif // LOG_H
@@ -0,0 +1,207 @@
+#include "lz.h"
+#include <cstring>
+
+static inline uint32_t read32(const char* p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t hash32(uint32_t v, int bits) {
+    return (v * 2654435761u) >> (32 - bits);
+}
+
+// длины > 15 продолжаются байтами по 255
+static inline char* putLength(char* op, size_t len) {
+    while (len >= 255) {
+        *op++ = static_cast<char>(255);
+        len -= 255;
+    }
+    *op++ = static_cast<char>(len);
+    return op;
+}
+
+static inline bool getLength(const uint8_t*& ip, const uint8_t* end, size_t& len) {
+    uint8_t b;
+    do {
+        if (ip >= end) return false;
+        b = *ip++;
+        len += b;
+    } while (b == 255);
+    return true;
+}
+
+LzCodec::LzCodec(size_t dict_reset_bytes) :
+    dict_reset_bytes_(dict_reset_bytes), table_(1u << HASH_BITS, 0)
+{
+    window_.reserve(dict_reset_bytes_);
+}
+
+void LzCodec::reset(){
+    window_.clear();
+    pending_reset_ = true;
+}
+
+bool LzCodec::compress(const char* src, size_t size, std::vector<char>& out)
+{
+    if (size < MIN_MATCH * 2 || size > LZ_MAX_BLOCK_BYTES) {
+        return false;
+    }
+    if (dict_reset_bytes_ == 0 || window_.size() + size > dict_reset_bytes_) {
+        reset();
+    }
+
+    const size_t start = window_.size();
+    window_.insert(window_.end(), src, src + size);
+    const char* base = window_.data();
+    const size_t end = start + size;
+
+    // сжимать есть смысл только если вышло меньше исходного
+    out.resize(1 + 5 + size);
+    char* op = out.data();
+    char* const op_limit = out.data() + size;
+
+    *op++ = pending_reset_ ? BLOCK_FLAG_RESET : 0;
+    uint32_t v = static_cast<uint32_t>(size);
+    while (v >= 0x80) {
+        *op++ = static_cast<char>((v & 0x7F) | 0x80);
+        v >>= 7;
+    }
+    *op++ = static_cast<char>(v);
+
+    size_t pos = start;
+    size_t anchor = start;
+    while (pos + MIN_MATCH <= end) {
+        uint32_t seq = read32(base + pos);
+        uint32_t h = hash32(seq, HASH_BITS);
+        size_t cand = table_[h];
+        table_[h] = static_cast<uint32_t>(pos);
+
+        // таблица может быть устаревшей после reset, байты все равно сверяем
+        if (cand >= pos || pos - cand > MAX_OFFSET || read32(base + cand) != seq) {
+            ++pos;
+            continue;
+        }
+
+        size_t len = MIN_MATCH;
+        while (pos + len < end && base[cand + len] == base[pos + len]) {
+            ++len;
+        }
+
+        size_t lit = pos - anchor;
+        // token + литералы + offset + длины с запасом
+        if (op + 1 + lit + lit / 255 + 2 + len / 255 + 2 >= op_limit) {
+            window_.resize(start);
+            return false;
+        }
+        char* token = op++;
+        *token = static_cast<char>((lit < 15 ? lit : 15) << 4);
+        if (lit >= 15) op = putLength(op, lit - 15);
+        std::memcpy(op, base + anchor, lit);
+        op += lit;
+
+        uint16_t offset = static_cast<uint16_t>(pos - cand);
+        std::memcpy(op, &offset, sizeof(offset));
+        op += sizeof(offset);
+
+        size_t mlen = len - MIN_MATCH;
+        *token |= static_cast<char>(mlen < 15 ? mlen : 15);
+        if (mlen >= 15) op = putLength(op, mlen - 15);
+
+        pos += len;
+        anchor = pos;
+    }
+
+    // хвост литералами
+    size_t lit = end - anchor;
+    if (op + 1 + lit + lit / 255 + 1 >= op_limit) {
+        window_.resize(start);
+        return false;
+    }
+    char* token = op++;
+    *token = static_cast<char>((lit < 15 ? lit : 15) << 4);
+    if (lit >= 15) op = putLength(op, lit - 15);
+    std::memcpy(op, base + anchor, lit);
+    op += lit;
+
+    out.resize(op - out.data());
+    pending_reset_ = false;
+    return true;
+}
+
+bool LzCodec::decompress(const char* src, size_t size, std::vector<char>& out)
+{
+    const uint8_t* ip = reinterpret_cast<const uint8_t*>(src);
+    const uint8_t* const iend = ip + size;
+    if (ip >= iend) return false;
+
+    if (*ip++ & BLOCK_FLAG_RESET) {
+        window_.clear();
+    }
+
+    uint32_t raw_size = 0;
+    int shift = 0;
+    while (true) {
+        if (ip >= iend || shift > 28) return false;
+        uint8_t b = *ip++;
+        raw_size |= static_cast<uint32_t>(b & 0x7F) << shift;
+        if (!(b & 0x80)) break;
+        shift += 7;
+    }
+
+    // до resize: иначе пир одним varint заставит выделить гигабайты
+    if (raw_size > LZ_MAX_BLOCK_BYTES) return false;
+    const size_t start = window_.size();
+    const size_t end = start + raw_size;
+    // пир обязан сбрасывать историю не реже dict_reset_bytes_
+    if (dict_reset_bytes_ && start > 0 && end > dict_reset_bytes_) return false;
+    window_.resize(end);
+
+    if (!decodeSequences(ip, iend, start, end)) {
+        window_.resize(start);
+        return false;
+    }
+
+    out.assign(window_.data() + start, window_.data() + end);
+    if (dict_reset_bytes_ == 0) {
+        window_.clear();
+    }
+    return true;
+}
+
+bool LzCodec::decodeSequences(const uint8_t* ip, const uint8_t* iend, size_t op, size_t end)
+{
+    char* base = window_.data();
+    while (true) {
+        if (ip >= iend) return false;
+        uint8_t token = *ip++;
+
+        size_t lit = token >> 4;
+        if (lit == 15 && !getLength(ip, iend, lit)) return false;
+        if (lit > static_cast<size_t>(iend - ip) || lit > end - op) return false;
+        std::memcpy(base + op, ip, lit);
+        ip += lit;
+        op += lit;
+
+        if (op == end) break;
+
+        if (iend - ip < 2) return false;
+        uint16_t offset;
+        std::memcpy(&offset, ip, sizeof(offset));
+        ip += sizeof(offset);
+        if (offset == 0 || offset > op) return false;
+
+        size_t mlen = token & 0x0F;
+        if (mlen == 15 && !getLength(ip, iend, mlen)) return false;
+        mlen += MIN_MATCH;
+        if (mlen > end - op) return false;
+
+        // совпадения могут перекрываться, копируем побайтно
+        const char* match = base + op - offset;
+        for (size_t i = 0; i < mlen; ++i) {
+            base[op + i] = match[i];
+        }
+        op += mlen;
+    }
+    return ip == iend;
+}
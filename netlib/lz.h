@@ -0,0 +1,49 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// сброс словаря по умолчанию 1 << 20 = 1 MiB истории на соединение
+static constexpr uint8_t LZ_DICT_LOG2 = 20;
+static constexpr uint8_t LZ_DICT_LOG2_MAX = 24;
+static constexpr size_t LZ_DICT_RESET_BYTES = size_t(1) << LZ_DICT_LOG2;
+// больше одним блоком не сжимаем и не разжимаем: raw_size приходит от пира
+static constexpr size_t LZ_MAX_BLOCK_BYTES = size_t(1) << LZ_DICT_LOG2_MAX;
+
+/*
+ * быстрый LZ77 в стиле lz4, один экземпляр на направление (tx или rx).
+ * блок: flags | varint raw_size | последовательности
+ * последовательность: token(lit:4|match:4) [+255..] литералы [offset 2б, +255..]
+ *
+ * потоковый режим: совпадения ищутся и в предыдущих блоках этого соединения,
+ * история сбрасывается каждые dict_reset_bytes (0 - каждый блок независимый).
+ * поэтому блоки надо разжимать строго в том порядке, в котором сжимали.
+ */
+class LzCodec {
+public:
+    explicit LzCodec(size_t dict_reset_bytes = LZ_DICT_RESET_BYTES);
+
+    // false - сжатие не выгодно, отправляем как есть (история не меняется)
+    bool compress(const char* src, size_t size, std::vector<char>& out);
+    // false - битый блок
+    bool decompress(const char* src, size_t size, std::vector<char>& out);
+
+    void reset();
+
+private:
+    bool decodeSequences(const uint8_t* ip, const uint8_t* iend, size_t op, size_t end);
+
+    static constexpr int HASH_BITS = 14;
+    static constexpr size_t MIN_MATCH = 4;
+    static constexpr size_t MAX_OFFSET = 65535;
+    static constexpr uint8_t BLOCK_FLAG_RESET = 0x01;
+
+    size_t dict_reset_bytes_;
+    bool pending_reset_ = true;
+    std::vector<char> window_;   // история raw данных
+    std::vector<uint32_t> table_; // hash(4 байта) -> позиция в window_
+};
+
+#endif // LZ_H
@@ -0,0 +1,162 @@
+#include "perfcounters.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+static uint64_t now_ns(){
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+static int open_counter(uint32_t type, uint64_t config){
+    perf_event_attr attr{};
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    // сначала с ядром: сервер сетевой, syscall - большая часть работы
+    int fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    if (fd < 0 && (errno == EACCES || errno == EPERM)) {
+        attr.exclude_kernel = 1; // perf_event_paranoid >= 2 - только user
+        fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    }
+    return fd;
+}
+
+PerfCounters::~PerfCounters(){
+    close();
+}
+
+bool PerfCounters::open(){
+    close();
+    static const struct {
+        uint32_t type;
+        uint64_t config;
+    } events[PERF_COUNT] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+    };
+    for (int i = 0; i < PERF_COUNT; ++i) {
+        fds_[i] = open_counter(events[i].type, events[i].config);
+        if (fds_[i] >= 0) {
+            available_ |= 1u << i;
+            last_[i] = read(i);
+        }
+    }
+    last_ns_ = now_ns();
+    return available_ != 0;
+}
+
+void PerfCounters::close(){
+    for (int& fd : fds_) {
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+    available_ = 0;
+}
+
+uint64_t PerfCounters::read(int i) const {
+    uint64_t v[3]; // value, time_enabled, time_running
+    if (fds_[i] < 0 || ::read(fds_[i], v, sizeof(v)) != sizeof(v)) {
+        return 0;
+    }
+    if (v[2] == 0) {
+        return 0;
+    }
+    if (v[2] < v[1]) {
+        return uint64_t(double(v[0]) * double(v[1]) / double(v[2]));
+    }
+    return v[0];
+}
+
+PerfReport PerfCounters::sample(uint64_t bytes, uint64_t packets){
+    PerfReport r;
+    uint64_t now = now_ns();
+    r.seconds = (now - last_ns_) / 1e9;
+    last_ns_ = now;
+    r.bytes = bytes;
+    r.packets = packets;
+    r.available = available_;
+    for (int i = 0; i < PERF_COUNT; ++i) {
+        if (available_ & (1u << i)) {
+            uint64_t v = read(i);
+            r.value[i] = v > last_[i] ? v - last_[i] : 0;
+            last_[i] = v;
+        }
+    }
+    return r;
+}
+
+double PerfReport::ipc() const {
+    return has(PERF_CYCLES) && has(PERF_INSTRUCTIONS) && value[PERF_CYCLES]
+        ? double(value[PERF_INSTRUCTIONS]) / value[PERF_CYCLES] : 0;
+}
+
+double PerfReport::cyclesPerByte() const {
+    return has(PERF_CYCLES) && bytes ? double(value[PERF_CYCLES]) / bytes : 0;
+}
+
+double PerfReport::cyclesPerPacket() const {
+    return has(PERF_CYCLES) && packets ? double(value[PERF_CYCLES]) / packets : 0;
+}
+
+void PerfReport::merge(const PerfReport& o){
+    if (o.seconds == 0) {
+        return; // пустой: поток без счетчиков
+    }
+    available = seconds > 0 ? (available & o.available) : o.available;
+    seconds = seconds > o.seconds ? seconds : o.seconds;
+    for (int i = 0; i < PERF_COUNT; ++i) {
+        value[i] += o.value[i];
+    }
+    bytes += o.bytes;
+    packets += o.packets;
+}
+
+// 12345678 -> "12.3M"
+static std::string short_count(double v){
+    static const char* units[] = {"", "k", "M", "G", "T"};
+    size_t u = 0;
+    while (v >= 1000 && u + 1 < sizeof(units) / sizeof(units[0])) {
+        v /= 1000;
+        ++u;
+    }
+    char buf[32];
+    snprintf(buf, sizeof(buf), u ? "%.1f%s" : "%.0f%s", v, units[u]);
+    return buf;
+}
+
+std::string PerfReport::toString() const {
+    if (!available) {
+        return "perf n/a";
+    }
+    char buf[64];
+    std::string s;
+    auto add = [&](const char* name, bool ok, const std::string& v){
+        s += s.empty() ? "" : " ";
+        s += name;
+        s += " ";
+        s += ok ? v : "n/a";
+    };
+    double secs = seconds > 0 ? seconds : 1;
+    snprintf(buf, sizeof(buf), "%.2f", ipc());
+    add("ipc", has(PERF_CYCLES) && has(PERF_INSTRUCTIONS), buf);
+    snprintf(buf, sizeof(buf), "%.2f", cyclesPerByte());
+    add("cycles/B", has(PERF_CYCLES) && bytes, buf);
+    snprintf(buf, sizeof(buf), "%.0f", cyclesPerPacket());
+    add("cycles/pkt", has(PERF_CYCLES) && packets, buf);
+    add("cycles", has(PERF_CYCLES), short_count(value[PERF_CYCLES] / secs) + "/s");
+    add("cache-miss", has(PERF_CACHE_MISSES), short_count(value[PERF_CACHE_MISSES] / secs) + "/s");
+    add("cs", has(PERF_CONTEXT_SWITCHES), short_count(value[PERF_CONTEXT_SWITCHES] / secs) + "/s");
+    return s;
+}
@@ -0,0 +1,67 @@
+#ifndef PERFCOUNTERS_H
+#define PERFCOUNTERS_H
+
+#include <cstdint>
+#include <string>
+
+/*
+ * аппаратные счетчики потока через perf_event_open: такты, инструкции,
+ * промахи кэша и переключения контекста. читаются раз в интервал статистики,
+ * на горячем пути ничего не стоят - считает PMU.
+ * в VM и контейнерах часть счетчиков ядро не дает (perf_event_paranoid, нет PMU),
+ * тогда они просто отсутствуют в available.
+ */
+enum PerfCounter {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_CACHE_MISSES,
+    PERF_CONTEXT_SWITCHES,
+    PERF_COUNT,
+};
+
+// за интервал; bytes/packets кладет тот, кто знает, что обрабатывал поток
+struct PerfReport {
+    double seconds = 0;
+    uint64_t value[PERF_COUNT] = {};
+    uint64_t bytes = 0;
+    uint64_t packets = 0;
+    uint32_t available = 0; // биты PerfCounter
+
+    bool has(PerfCounter c) const { return available & (1u << c); }
+    // 0 - нет данных
+    double ipc() const;
+    double cyclesPerByte() const;
+    double cyclesPerPacket() const;
+    // сумма по потокам; счетчик есть, если он есть у всех
+    void merge(const PerfReport& o);
+    // "ipc 1.52 cycles/B 0.91 cycles/pkt 850 cache-miss 12.3k/s cs 40/s", недоступное - n/a
+    std::string toString() const;
+};
+
+class PerfCounters {
+public:
+    PerfCounters() = default;
+    ~PerfCounters();
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    // счетчики вызывающего потока, звать из него; false - ни одного не дали
+    bool open();
+    void close();
+    bool isOpen() const { return available_ != 0; }
+    uint32_t available() const { return available_; }
+
+    // разница с прошлым вызовом (первый - с open), bytes/packets - за тот же интервал
+    PerfReport sample(uint64_t bytes, uint64_t packets);
+
+private:
+    // с поправкой на мультиплексирование, когда счетчиков больше, чем регистров PMU
+    uint64_t read(int i) const;
+
+    int fds_[PERF_COUNT] = {-1, -1, -1, -1};
+    uint32_t available_ = 0;
+    uint64_t last_[PERF_COUNT] = {};
+    uint64_t last_ns_ = 0;
+};
+
+#endif // PERFCOUNTERS_H
@@ -0,0 +1,104 @@
+#include "rpc.h"
+
+// parser_ меняем под обоими мьютексами: send_mtx_ -> mtx_
+void RpcClient::attach(MessageParser* parser){
+    std::lock_guard send_lock(send_mtx_);
+    std::lock_guard lock(mtx_);
+    parser_ = parser;
+}
+
+void RpcClient::detach(){
+    std::unordered_map<uint64_t, RpcCallback> failed;
+    {
+        // ждем отправку в процессе, после этого парсер можно удалять
+        std::lock_guard send_lock(send_mtx_);
+        std::lock_guard lock(mtx_);
+        parser_ = nullptr;
+        failed.swap(pending_);
+    }
+    // колбеки вне мьютекса, из них можно снова звать call
+    for (auto& el : failed) {
+        el.second(RpcReply{RpcStatus::DISCONNECTED, {}});
+    }
+}
+
+void RpcClient::call(uint16_t method_id, const char* data, size_t size, RpcCallback cb){
+    uint64_t corr_id;
+    {
+        std::lock_guard lock(mtx_);
+        corr_id = next_corr_id_++;
+        // в pending до отправки: ответ может прийти раньше, чем вернется send
+        pending_.emplace(corr_id, std::move(cb));
+    }
+
+    bool sent;
+    {
+        // отдельный мьютекс: пока send висит, поток epoll должен разбирать ответы
+        std::lock_guard send_lock(send_mtx_);
+        sent = parser_ && parser_->sendRpcRequest(out_, corr_id, method_id, data, size);
+    }
+    if (sent) {
+        return;
+    }
+
+    {
+        std::lock_guard lock(mtx_);
+        auto it = pending_.find(corr_id);
+        if (it == pending_.end()) {
+            return; // уже завершен в detach
+        }
+        cb = std::move(it->second);
+        pending_.erase(it);
+    }
+    cb(RpcReply{RpcStatus::DISCONNECTED, {}});
+}
+
+std::future<RpcReply> RpcClient::call(uint16_t method_id, const char* data, size_t size){
+    auto promise = std::make_shared<std::promise<RpcReply>>();
+    std::future<RpcReply> f = promise->get_future();
+    call(method_id, data, size, [promise](RpcReply&& reply){
+        promise->set_value(std::move(reply));
+    });
+    return f;
+}
+
+void RpcClient::onResponse(ParsedMessage& msg){
+    RpcCallback cb;
+    {
+        std::lock_guard lock(mtx_);
+        const uint64_t corr_id = msg.rpc_response.corr_id; // packed, только копией
+        auto it = pending_.find(corr_id);
+        if (it == pending_.end()) {
+            return; // ответ на неизвестный запрос
+        }
+        cb = std::move(it->second);
+        pending_.erase(it);
+    }
+    cb(RpcReply{static_cast<RpcStatus>(msg.rpc_response.status), std::move(msg.packet_data)});
+}
+
+size_t RpcClient::inFlight(){
+    std::lock_guard lock(mtx_);
+    return pending_.size();
+}
+
+void RpcServer::registerMethod(uint16_t method_id, RpcHandler handler){
+    methods_[method_id] = std::move(handler);
+}
+
+bool RpcServer::onRequest(MessageParser& parser, ParsedMessage& msg, ParsedMessage& out){
+    const uint64_t corr_id = msg.rpc_request.corr_id;
+    std::vector<char> reply;
+    RpcStatus status = RpcStatus::NO_METHOD;
+
+    const uint16_t method_id = msg.rpc_request.method_id;
+    auto it = methods_.find(method_id);
+    if (it != methods_.end()) {
+        status = it->second(msg.packet_data.data(), msg.packet_data.size(), reply);
+    }
+    if (!parser.sendRpcResponse(out, corr_id, static_cast<uint16_t>(status), reply.data(), reply.size())) {
+        LOG_WARN("rpc response lost, corr_id " << corr_id);
+        return false;
+    }
+    return true;
+}
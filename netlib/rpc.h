@@ -0,0 +1,74 @@
+#ifndef RPC_H
+#define RPC_H
+
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "serialization.h"
+
+enum class RpcStatus : uint16_t {
+    OK = 0,
+    NO_METHOD = 1,   // на сервере нет обработчика
+    FAILED = 2,      // обработчик вернул ошибку
+    DISCONNECTED = 3 // локальный: соединение закрылось до ответа
+};
+
+struct RpcReply {
+    RpcStatus status = RpcStatus::OK;
+    std::vector<char> data;
+};
+
+// вызывается в потоке epoll клиента (или в disconnect при обрыве)
+using RpcCallback = std::function<void(RpcReply&& reply)>;
+// вызывается в потоке epoll сервера, ответ пишем в reply
+using RpcHandler = std::function<RpcStatus(const char* data, size_t size, std::vector<char>& reply)>;
+
+/*
+ * клиентская сторона: запросы уходят сразу, ответы сопоставляются по corr_id.
+ * не ждем ответа перед следующим запросом - все летят по одному соединению.
+ * call можно звать из любого потока.
+ */
+class RpcClient {
+public:
+    // парсер соединения, через него отправляем; nullptr - нет соединения
+    void attach(MessageParser* parser);
+    // обрыв: все ожидающие получат DISCONNECTED
+    void detach();
+
+    void call(uint16_t method_id, const char* data, size_t size, RpcCallback cb);
+    std::future<RpcReply> call(uint16_t method_id, const char* data, size_t size);
+
+    // RPC_RESPONSE из потока epoll
+    void onResponse(ParsedMessage& msg);
+
+    size_t inFlight();
+
+private:
+    std::mutex send_mtx_; // отправка и out_
+    std::mutex mtx_;      // pending_, next_corr_id_
+    MessageParser* parser_ = nullptr;
+    ParsedMessage out_;
+    uint64_t next_corr_id_ = 1;
+    std::unordered_map<uint64_t, RpcCallback> pending_;
+};
+
+/*
+ * серверная сторона: method_id -> обработчик.
+ * регистрировать до start(), потом таблица только читается из потоков epoll.
+ */
+class RpcServer {
+public:
+    void registerMethod(uint16_t method_id, RpcHandler handler);
+
+    // RPC_REQUEST: вызывает обработчик и сразу отвечает в то же соединение.
+    // false - ответ не ушел, соединение надо закрыть
+    bool onRequest(MessageParser& parser, ParsedMessage& msg, ParsedMessage& out);
+
+private:
+    std::unordered_map<uint16_t, RpcHandler> methods_;
+};
+
+#endif // RPC_H
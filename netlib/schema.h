@@ -0,0 +1,132 @@
+#ifndef SCHEMA_H
+#define SCHEMA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+/*
+ * описание полей сообщения в одном месте, все остальное выводится при компиляции:
+ *   using X = FieldList<Field<&Hdr::a>, Field<&Hdr::b, Endian::Big>>;
+ *   X::size                   - размер на проводе
+ *   X::encode(hdr, out)       - запись полей по порядку
+ *   X::decode(hdr, in)        - чтение
+ * поля пишутся подряд без выравнивания, как в #pragma pack(1) структурах.
+ */
+
+enum class Endian : uint8_t {
+    Little,
+    Big,
+};
+
+template <typename M>
+struct MemberTraits;
+
+template <typename C, typename T>
+struct MemberTraits<T C::*> {
+    using Class = C;
+    using Type = T;
+};
+
+namespace schema_detail {
+
+constexpr Endian hostEndian() {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return Endian::Big;
+#else
+    return Endian::Little;
+#endif
+}
+
+template <typename T>
+inline T byteSwap(T v) {
+    if constexpr (sizeof(T) == 2) {
+        uint16_t u;
+        std::memcpy(&u, &v, 2);
+        u = __builtin_bswap16(u);
+        std::memcpy(&v, &u, 2);
+    } else if constexpr (sizeof(T) == 4) {
+        uint32_t u;
+        std::memcpy(&u, &v, 4);
+        u = __builtin_bswap32(u);
+        std::memcpy(&v, &u, 4);
+    } else if constexpr (sizeof(T) == 8) {
+        uint64_t u;
+        std::memcpy(&u, &v, 8);
+        u = __builtin_bswap64(u);
+        std::memcpy(&v, &u, 8);
+    }
+    return v;
+}
+
+// порядок байт меняем только у скаляров, массивы байт (uuid) пишем как есть
+template <typename T, Endian E>
+inline T toWire(T v) {
+    if constexpr ((std::is_integral_v<T> || std::is_enum_v<T>) && E != hostEndian()) {
+        return byteSwap(v);
+    }
+    return v;
+}
+
+} // namespace schema_detail
+
+template <auto Member, Endian E = Endian::Little>
+struct Field {
+    using Class = typename MemberTraits<decltype(Member)>::Class;
+    using Type = typename MemberTraits<decltype(Member)>::Type;
+    static_assert(std::is_trivially_copyable_v<Type>, "только POD поля");
+
+    static constexpr size_t size = sizeof(Type);
+
+    // через указатель на член компилятор не знает про pack(1), поэтому только memcpy
+    static void encode(const Class& msg, char* out) {
+        Type v;
+        std::memcpy(&v, &(msg.*Member), size);
+        v = schema_detail::toWire<Type, E>(v);
+        std::memcpy(out, &v, size);
+    }
+    static void decode(Class& msg, const char* in) {
+        Type v;
+        std::memcpy(&v, in, size);
+        v = schema_detail::toWire<Type, E>(v);
+        std::memcpy(&(msg.*Member), &v, size);
+    }
+};
+
+template <typename... Fields>
+struct FieldList {
+    static constexpr size_t size = (Fields::size + ... + 0);
+
+    template <typename Class>
+    static void encode(const Class& msg, char* out) {
+        size_t off = 0;
+        ((Fields::encode(msg, out + off), off += Fields::size), ...);
+    }
+    template <typename Class>
+    static void decode(Class& msg, const char* in) {
+        size_t off = 0;
+        ((Fields::decode(msg, in + off), off += Fields::size), ...);
+    }
+};
+
+// размер данных после заголовка
+struct NoTail {
+    template <typename Header>
+    static constexpr size_t size(const Header&) { return 0; }
+};
+
+template <auto Member>
+struct TailField {
+    template <typename Header>
+    static size_t size(const Header& h) {
+        typename MemberTraits<decltype(Member)>::Type v;
+        std::memcpy(&v, &(h.*Member), sizeof(v));
+        return v;
+    }
+};
+
+template <typename... Msgs>
+struct MessageList {};
+
+#endif // SCHEMA_H
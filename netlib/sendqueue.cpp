@@ -0,0 +1,238 @@
+#include "sendqueue.h"
+#include "fastclock.h"
+
+PrioritySendQueue::PrioritySendQueue(){
+    weights_[static_cast<size_t>(SendLane::STREAMS)] = 4;
+    weights_[static_cast<size_t>(SendLane::BULK)] = 1;
+}
+
+void PrioritySendQueue::push(SendLane lane, FrameBuffer&& frame){
+    {
+        std::lock_guard lock(mtx_);
+        size_t i = static_cast<size_t>(lane);
+        size_t size = frame.size();
+        lanes_[i].push_back(Item{std::move(frame), {}, nullptr, size, 0, false, FastClock::nowNs()});
+        lanes_[i].back().data = lanes_[i].back().frame.data();
+        bytes_[i] += size;
+    }
+    cv_.notify_one();
+}
+
+void PrioritySendQueue::push(SendLane lane, const char* data, size_t size){
+    {
+        std::lock_guard lock(mtx_);
+        size_t i = static_cast<size_t>(lane);
+        lanes_[i].push_back(Item{{}, {}, data, size, 0, true, FastClock::nowNs()});
+        bytes_[i] += size;
+    }
+    cv_.notify_one();
+}
+
+void PrioritySendQueue::push(SendLane lane, FrameBuffer&& head, SliceChain&& body){
+    if (body.empty()) {
+        push(lane, std::move(head));
+        return;
+    }
+    {
+        std::lock_guard lock(mtx_);
+        size_t i = static_cast<size_t>(lane);
+        size_t size = head.size() + body.size();
+        lanes_[i].push_back(Item{std::move(head), std::move(body), nullptr, size, 0, false, FastClock::nowNs()});
+        lanes_[i].back().data = lanes_[i].back().frame.data();
+        bytes_[i] += size;
+    }
+    cv_.notify_one();
+}
+
+// текущая часть кадра: сначала frame, потом куски body
+static void item_part(const FrameBuffer& frame, const SliceChain& body, size_t offset,
+                      const char*& data, size_t& size){
+    if (offset < frame.size()) {
+        data = frame.data() + offset;
+        size = frame.size() - offset;
+        return;
+    }
+    body.at(offset - frame.size(), data, size);
+}
+
+bool PrioritySendQueue::pick(bool control_only, size_t& lane, const char*& data, size_t& size){
+    if (pinned_lane_ >= 0) {
+        // control тоже ждет: иначе он окажется посреди кадра
+        const Item& item = lanes_[pinned_lane_].front();
+        lane = static_cast<size_t>(pinned_lane_);
+        item_part(item.frame, item.body, item.offset, data, size);
+        return true;
+    }
+    auto& control = lanes_[static_cast<size_t>(SendLane::CONTROL)];
+    if (!control.empty()) {
+        lane = static_cast<size_t>(SendLane::CONTROL);
+        data = control.front().data;
+        size = control.front().size;
+        if (!control.front().body.empty()) {
+            size = control.front().frame.size(); // дальше - по pinned_lane_
+        }
+        return true;
+    }
+    if (control_only) {
+        return false;
+    }
+
+    bool any = false;
+    for (size_t i = 1; i < LANES; ++i) {
+        any |= !lanes_[i].empty();
+    }
+    if (!any) {
+        return false;
+    }
+
+    // deficit round robin; кадр больше квоты уходит в долг, долг отдается в следующих кругах
+    while (true) {
+        if (lanes_[rr_].empty()) {
+            deficit_[rr_] = 0;
+        } else {
+            if (deficit_[rr_] <= 0) {
+                deficit_[rr_] += static_cast<int64_t>(weights_[rr_]) * QUANTUM;
+            }
+            if (deficit_[rr_] > 0) {
+                break;
+            }
+        }
+        rr_ = rr_ + 1 < LANES ? rr_ + 1 : 1;
+    }
+
+    const Item& item = lanes_[rr_].front();
+    lane = rr_;
+    if (!item.body.empty()) {
+        item_part(item.frame, item.body, item.offset, data, size);
+        return true;
+    }
+    data = item.data + item.offset;
+    size = item.size - item.offset;
+    if (item.splittable) {
+        size = std::min<size_t>(size, deficit_[rr_]);
+    }
+    return true;
+}
+
+void PrioritySendQueue::advance(size_t lane, size_t size){
+    Item& item = lanes_[lane].front();
+    item.offset += size;
+    bytes_[lane] -= size;
+    if (item.offset == item.size) {
+        dwell_.record(elapsedSince(FastClock::nowNs(), item.enqueued_ns));
+        lanes_[lane].pop_front();
+        pinned_lane_ = -1;
+    } else if (!item.body.empty()) {
+        pinned_lane_ = static_cast<int>(lane);
+    }
+    if (lane != static_cast<size_t>(SendLane::CONTROL)) {
+        deficit_[lane] -= static_cast<int64_t>(size);
+        if (deficit_[lane] <= 0) {
+            rr_ = rr_ + 1 < LANES ? rr_ + 1 : 1;
+        }
+    }
+}
+
+bool PrioritySendQueue::drainLocked(const SendFn& send, bool control_only, size_t max_bytes){
+    size_t sent = 0;
+    while (max_bytes == 0 || sent < max_bytes) {
+        size_t lane;
+        const char* data;
+        size_t size;
+        {
+            std::lock_guard lock(mtx_);
+            if (!pick(control_only, lane, data, size)) {
+                break;
+            }
+        }
+        // голову полосы удаляет только отправитель, data не сдвинется
+        if (!send(data, size)) {
+            return false;
+        }
+        sent += size;
+        std::lock_guard lock(mtx_);
+        advance(lane, size);
+    }
+    return true;
+}
+
+bool PrioritySendQueue::drain(const SendFn& send, size_t max_bytes){
+    {
+        std::lock_guard drain_lock(drain_mtx_);
+        if (!drainLocked(send, false, max_bytes)) {
+            return false;
+        }
+    }
+    // control мог прийти, пока выходили, и его drainControl не смог взять drain_mtx_
+    return drainControl(send);
+}
+
+bool PrioritySendQueue::drainControl(const SendFn& send){
+    while (true) {
+        {
+            std::unique_lock drain_lock(drain_mtx_, std::try_to_lock);
+            if (!drain_lock.owns_lock()) {
+                return true; // тот, кто держит, проверит control после себя
+            }
+            if (!drainLocked(send, true, 0)) {
+                return false;
+            }
+        }
+        std::lock_guard lock(mtx_);
+        if (lanes_[static_cast<size_t>(SendLane::CONTROL)].empty()) {
+            return true;
+        }
+    }
+}
+
+void PrioritySendQueue::waitPending(std::chrono::milliseconds timeout){
+    std::unique_lock lock(mtx_);
+    cv_.wait_for(lock, timeout, [this]{
+        if (kicked_) return true;
+        for (auto& l : lanes_) {
+            if (!l.empty()) return true;
+        }
+        return false;
+    });
+    kicked_ = false;
+}
+
+void PrioritySendQueue::notify(){
+    {
+        std::lock_guard lock(mtx_);
+        kicked_ = true;
+    }
+    cv_.notify_all();
+}
+
+void PrioritySendQueue::setWeight(SendLane lane, uint32_t weight){
+    if (lane == SendLane::CONTROL) {
+        return; // у control строгий приоритет
+    }
+    std::lock_guard lock(mtx_);
+    weights_[static_cast<size_t>(lane)] = std::max<uint32_t>(weight, 1);
+}
+
+size_t PrioritySendQueue::queuedBytes(SendLane lane){
+    std::lock_guard lock(mtx_);
+    return bytes_[static_cast<size_t>(lane)];
+}
+
+bool PrioritySendQueue::empty(){
+    std::lock_guard lock(mtx_);
+    for (auto& l : lanes_) {
+        if (!l.empty()) return false;
+    }
+    return true;
+}
+
+void PrioritySendQueue::clear(){
+    std::lock_guard drain_lock(drain_mtx_);
+    std::lock_guard lock(mtx_);
+    for (size_t i = 0; i < LANES; ++i) {
+        lanes_[i].clear();
+        bytes_[i] = 0;
+        deficit_[i] = 0;
+    }
+    pinned_lane_ = -1;
+}
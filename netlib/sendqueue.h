@@ -0,0 +1,97 @@
+#ifndef SENDQUEUE_H
+#define SENDQUEUE_H
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+#include "arena.h"
+#include "histogram.h"
+#include "slice.h"
+
+enum class SendLane : uint8_t {
+    CONTROL = 0, // handshake, rpc, heartbeat - всегда первыми
+    STREAMS,     // куски логических потоков
+    BULK,        // DATA_PKT/DATA_BATCH и сырые queue_add
+    COUNT
+};
+
+/*
+ * очередь отправки по полосам.
+ * CONTROL - строгий приоритет: проверяется перед каждой отправкой,
+ * остальные - weighted round-robin по байтам (deficit round robin):
+ * за круг полоса может отправить weight * QUANTUM байт.
+ * кадры уходят целиком, сырые байты режутся по квоте, поэтому
+ * control ждет максимум один кадр/квант, а не всю очередь.
+ * внутри полосы порядок сохраняется (это важно для сжатых кадров).
+ */
+class PrioritySendQueue {
+public:
+    static constexpr size_t QUANTUM = 64 * 1024;
+    // false - ошибка отправки, дальше не шлем
+    using SendFn = std::function<bool(const char* data, size_t size)>;
+
+    PrioritySendQueue();
+
+    // свой буфер (кадр целиком)
+    void push(SendLane lane, FrameBuffer&& frame);
+    // заголовок + хвост из чужих буферов без копии, уходит тоже целым кадром
+    void push(SendLane lane, FrameBuffer&& head, SliceChain&& body);
+    // чужие байты без копии, должны жить до отправки; можно резать
+    void push(SendLane lane, const char* data, size_t size);
+
+    // отправляет до max_bytes (0 - все что есть)
+    bool drain(const SendFn& send, size_t max_bytes = 0);
+    // только CONTROL и не ждет, если уже кто-то отправляет (тот сам заберет control)
+    bool drainControl(const SendFn& send);
+
+    // для потока отправки: ждем данных, notify или timeout
+    void waitPending(std::chrono::milliseconds timeout);
+    // разбудить waitPending без данных в очереди (есть что подложить снаружи)
+    void notify();
+
+    void setWeight(SendLane lane, uint32_t weight);
+    size_t queuedBytes(SendLane lane);
+    // сколько кадры ждали в очереди: push -> последний байт ушел в send
+    LatencySnapshot dwell() const { return dwell_.snapshot(); }
+    bool empty();
+    void clear();
+
+private:
+    struct Item {
+        FrameBuffer frame;
+        SliceChain body;   // после frame
+        const char* data;
+        size_t size;
+        size_t offset = 0;
+        bool splittable;
+        uint64_t enqueued_ns = 0;
+    };
+    static constexpr size_t LANES = static_cast<size_t>(SendLane::COUNT);
+
+    // под mtx_: следующий кусок, false - нечего отправлять
+    bool pick(bool control_only, size_t& lane, const char*& data, size_t& size);
+    // под mtx_: отправили size байт из головы lane
+    void advance(size_t lane, size_t size);
+    bool drainLocked(const SendFn& send, bool control_only, size_t max_bytes);
+
+    std::mutex drain_mtx_; // один отправитель за раз
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::array<std::deque<Item>, LANES> lanes_;
+    std::array<size_t, LANES> bytes_{};
+    std::array<uint32_t, LANES> weights_{};
+    std::array<int64_t, LANES> deficit_{};
+    // кадр с body уходит по частям, пока не ушел весь - никто не вклинивается
+    int pinned_lane_ = -1;
+    size_t rr_ = 1; // текущая полоса данных
+    LatencyHistogram dwell_; // пишет advance под mtx_
+    bool kicked_ = false;
+};
+
+#endif // SENDQUEUE_H
@@ -2,49 +2,326 @@
 #define SERIALIZATION_H
 
 #include "const.h"
+#include "stats.h"
 #include <cerrno>
 #include <cstdint>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <array>
+#include <functional>
+#include <memory>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "lz.h"
+#include "crc32c.h"
+#include "schema.h"
+#include "arena.h"
+#include "bufpool.h"
+#include "slice.h"
+#include "histogram.h"
+#include "trace.h"
 
 enum class MessageType : uint8_t {
     AUTH_REQUEST = 1,
     AUTH_RESPONSE = 2,
-    DATA_PKT = 3
+    DATA_PKT = 3,
+    DATA_BATCH = 4,
+    RPC_REQUEST = 5,
+    RPC_RESPONSE = 6,
+    STREAM_CHUNK = 7,
+    PING = 8,
+    PONG = 9
 };
 
+// возможности соединения, клиент предлагает в AuthRequest, сервер подтверждает в AuthResponse
+enum AuthFlags : uint8_t {
+    AUTH_FLAG_LZ = 0x01,
+    AUTH_FLAG_CRC32C = 0x02,
+    AUTH_FLAG_TIMESTAMP = 0x04, // метки времени в DATA_PKT, сервер соглашается всегда
+};
+// флаги конкретного пакета
+enum PktFlags : uint8_t {
+    PKT_FLAG_LZ = 0x01, // payload сжат LzCodec
+    PKT_FLAG_CRC32C = 0x02, // после заголовка uint32 crc32c: заголовок кадра + исходный (несжатый) payload
+    PKT_FLAG_TIMESTAMP = 0x04, // дальше uint64 realtimeUs отправителя на момент сборки кадра
+};
+
+enum StreamFlags : uint8_t {
+    STREAM_FLAG_FIN = 0x01, // последний кусок потока
+};
+
+// каждый кадр начинается с magic + version, по ним находим начало кадра после мусора
+static constexpr uint8_t FRAME_MAGIC = 0xA5;
+static constexpr uint8_t FRAME_VERSION = 1;
+// кадр больше - считаем мусором (размер из заголовка, не ждем гигабайты в приемный буфер)
+static constexpr size_t FRAME_MAX_SIZE = size_t(16) << 20;
+
 #pragma pack(push, 1)
+struct FrameHead {
+    uint8_t magic = FRAME_MAGIC;
+    uint8_t version = FRAME_VERSION;
+    MessageType type;
+};
 struct AuthRequest {
+    uint8_t magic = FRAME_MAGIC;
+    uint8_t version = FRAME_VERSION;
     MessageType type = MessageType::AUTH_REQUEST;
     std::array<uint8_t, 16> client_uuid;
+    uint8_t flags = 0;
+    uint8_t lz_dict_log2 = 0; // 0 - блоки сжимаются независимо
 };
 struct AuthResponse {
+    uint8_t magic = FRAME_MAGIC;
+    uint8_t version = FRAME_VERSION;
     MessageType type = MessageType::AUTH_RESPONSE;
     std::array<uint8_t, 16> client_uuid;
     uint64_t restore_seq_num = 0;
+    uint8_t flags = 0;
+    uint8_t lz_dict_log2 = 0;
 };
 struct DataPktHeader {
+    uint8_t magic = FRAME_MAGIC;
+    uint8_t version = FRAME_VERSION;
     MessageType type = MessageType::DATA_PKT;
+    uint8_t flags = 0;
     uint64_t seq_num;
-    uint32_t data_size;
+    uint32_t data_size; // без учета crc
+    //uint32_t crc; если PKT_FLAG_CRC32C
+    //uint64_t send_time_us; если PKT_FLAG_TIMESTAMP
     //char* data; after header (but here only header)
 };
+// пачка мелких пакетов под одним заголовком:
+// header | varint длины count записей | данные записей подряд
+struct DataBatchHeader {
+    uint8_t magic = FRAME_MAGIC;
+    uint8_t version = FRAME_VERSION;
+    MessageType type = MessageType::DATA_BATCH;
+    uint8_t flags = 0; // PKT_FLAG_LZ - сжато все тело целиком
+    uint64_t base_seq_num; // seq первой записи, дальше +1
+    uint16_t count;
+    uint32_t body_size; // varint длины + данные
+};
+// rpc: corr_id выбирает клиент, сервер возвращает его в ответе как есть,
+// поэтому на одном соединении может быть много запросов одновременно
+struct RpcRequestHeader {
+    uint8_t magic = FRAME_MAGIC;
+    uint8_t version = FRAME_VERSION;
+    MessageType type = MessageType::RPC_REQUEST;
+    uint64_t corr_id;
+    uint16_t method_id;
+    uint32_t data_size;
+};
+struct RpcResponseHeader {
+    uint8_t magic = FRAME_MAGIC;
+    uint8_t version = FRAME_VERSION;
+    MessageType type = MessageType::RPC_RESPONSE;
+    uint64_t corr_id;
+    uint16_t status; // RpcStatus
+    uint32_t data_size;
+};
+// кусок логического потока, большие данные режутся на куски,
+// куски разных потоков чередуются в одном соединении
+struct StreamChunkHeader {
+    uint8_t magic = FRAME_MAGIC;
+    uint8_t version = FRAME_VERSION;
+    MessageType type = MessageType::STREAM_CHUNK;
+    uint8_t flags = 0; // StreamFlags
+    uint32_t stream_id;
+    uint32_t data_size;
+};
+// PING и PONG: PONG возвращает поля PING как есть,
+// rtt считает отправитель PING по своим же часам
+struct HeartbeatHeader {
+    uint8_t magic = FRAME_MAGIC;
+    uint8_t version = FRAME_VERSION;
+    MessageType type = MessageType::PING;
+    uint64_t seq;
+    uint64_t send_time_us; // монотонные часы отправителя
+};
 #pragma pack(pop)
 
+// запись внутри пачки, указывает прямо в буфер парсера (без копирования)
+struct PktView {
+    uint64_t seq_num;
+    const char* data;
+    uint32_t size;
+};
+
+// в ParsedMessage заголовки лежат в union, поэтому magic/version пишем явно
+template <typename Header>
+inline void setFrameHead(Header& h, MessageType type) {
+    h.magic = FRAME_MAGIC;
+    h.version = FRAME_VERSION;
+    h.type = type;
+}
+
+// первая пара magic+version в [p, end), end если нет.
+// последний байт == magic тоже считается возможным началом (version еще не пришла)
+inline const char* findFrameStart(const char* p, const char* end) {
+#ifdef __SSE2__
+    const __m128i magic = _mm_set1_epi8(static_cast<char>(FRAME_MAGIC));
+    const __m128i version = _mm_set1_epi8(static_cast<char>(FRAME_VERSION));
+    while (end - p >= 17) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 1));
+        int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, magic),
+                                                   _mm_cmpeq_epi8(b, version)));
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+#endif
+    while (p < end) {
+        p = static_cast<const char*>(std::memchr(p, FRAME_MAGIC, end - p));
+        if (!p) return end;
+        if (p + 1 == end || static_cast<uint8_t>(p[1]) == FRAME_VERSION) return p;
+        ++p;
+    }
+    return end;
+}
+
+// varint (LEB128), для uint32 максимум 5 байт
+static constexpr size_t MAX_VARINT32_SIZE = 5;
+
+inline size_t putVarint32(char* out, uint32_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        out[n++] = static_cast<char>((v & 0x7F) | 0x80);
+        v >>= 7;
+    }
+    out[n++] = static_cast<char>(v);
+    return n;
+}
+
+// false - не хватило данных или битый varint
+inline bool getVarint32(const char*& p, const char* end, uint32_t& v) {
+    v = 0;
+    for (int shift = 0; shift < 35 && p < end; shift += 7) {
+        uint8_t b = static_cast<uint8_t>(*p++);
+        v |= static_cast<uint32_t>(b & 0x7F) << shift;
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
 // Результат парсинга
 struct ParsedMessage {
+    // у членов union есть инициализаторы, поэтому конструктор нужен явно
+    ParsedMessage() : auth_request() {}
+
     MessageType type;
     int size_header;
     union {
         AuthRequest auth_request;
         AuthResponse auth_response;
         DataPktHeader packet_header;
+        DataBatchHeader batch_header;
+        RpcRequestHeader rpc_request;
+        RpcResponseHeader rpc_response;
+        StreamChunkHeader stream_chunk;
+        HeartbeatHeader heartbeat;
     };
     // char* payload = nullptr;
+    // rpc
     std::vector<char> packet_data;
+    // DATA_PKT без копии: кусок приемного буфера (сжатый - распакованный блок).
+    // до следующего tryParseMessage; чтобы держать дольше или переслать - скопировать Slice
+    Slice payload;
+    // DATA_PKT с PKT_FLAG_TIMESTAMP: realtimeUs отправителя, иначе 0
+    uint64_t send_time_us = 0;
+    // для DATA_BATCH, валидны до следующего readMessage/recvSome/tryParseMessage
+    std::vector<PktView> batch_records;
+    // для STREAM_CHUNK, тоже прямо в буфер парсера
+    const char* chunk_data = nullptr;
 };
 
+/*
+ * схемы кадров: заголовок FrameHead + поля по порядку + размер хвоста (payload).
+ * новый тип кадра = значение MessageType, структура, схема тут и в Messages,
+ * своя логика разбора - перегрузка MessageParser::onFrame.
+ */
+template <MessageType Id, auto Slot, typename Tail, typename... Fields>
+struct MessageDef {
+    using Type = typename MemberTraits<decltype(Slot)>::Type;
+    using Body = FieldList<Fields...>;
+    static constexpr MessageType id = Id;
+    static constexpr auto slot = Slot; // где лежит в ParsedMessage
+    static constexpr size_t head_size = sizeof(FrameHead) + Body::size;
+    static_assert(head_size == sizeof(Type), "в схеме должны быть все поля структуры");
+
+    static void encode(const Type& h, char* out) {
+        FrameHead head;
+        head.type = Id;
+        std::memcpy(out, &head, sizeof(head));
+        Body::encode(h, out + sizeof(FrameHead));
+    }
+    static void decode(Type& h, const char* in) {
+        setFrameHead(h, Id);
+        Body::decode(h, in + sizeof(FrameHead));
+    }
+    static size_t tailSize(const Type& h) {
+        return Tail::size(h);
+    }
+};
+
+struct DataPktTail {
+    static size_t size(const DataPktHeader& h) {
+        return h.data_size + ((h.flags & PKT_FLAG_CRC32C) ? sizeof(uint32_t) : 0)
+                           + ((h.flags & PKT_FLAG_TIMESTAMP) ? sizeof(uint64_t) : 0);
+    }
+};
+
+using AuthRequestMsg = MessageDef<MessageType::AUTH_REQUEST, &ParsedMessage::auth_request, NoTail,
+    Field<&AuthRequest::client_uuid>,
+    Field<&AuthRequest::flags>,
+    Field<&AuthRequest::lz_dict_log2>>;
+
+using AuthResponseMsg = MessageDef<MessageType::AUTH_RESPONSE, &ParsedMessage::auth_response, NoTail,
+    Field<&AuthResponse::client_uuid>,
+    Field<&AuthResponse::restore_seq_num>,
+    Field<&AuthResponse::flags>,
+    Field<&AuthResponse::lz_dict_log2>>;
+
+using DataPktMsg = MessageDef<MessageType::DATA_PKT, &ParsedMessage::packet_header, DataPktTail,
+    Field<&DataPktHeader::flags>,
+    Field<&DataPktHeader::seq_num>,
+    Field<&DataPktHeader::data_size>>;
+
+using DataBatchMsg = MessageDef<MessageType::DATA_BATCH, &ParsedMessage::batch_header, TailField<&DataBatchHeader::body_size>,
+    Field<&DataBatchHeader::flags>,
+    Field<&DataBatchHeader::base_seq_num>,
+    Field<&DataBatchHeader::count>,
+    Field<&DataBatchHeader::body_size>>;
+
+using RpcRequestMsg = MessageDef<MessageType::RPC_REQUEST, &ParsedMessage::rpc_request, TailField<&RpcRequestHeader::data_size>,
+    Field<&RpcRequestHeader::corr_id>,
+    Field<&RpcRequestHeader::method_id>,
+    Field<&RpcRequestHeader::data_size>>;
+
+using RpcResponseMsg = MessageDef<MessageType::RPC_RESPONSE, &ParsedMessage::rpc_response, TailField<&RpcResponseHeader::data_size>,
+    Field<&RpcResponseHeader::corr_id>,
+    Field<&RpcResponseHeader::status>,
+    Field<&RpcResponseHeader::data_size>>;
+
+using StreamChunkMsg = MessageDef<MessageType::STREAM_CHUNK, &ParsedMessage::stream_chunk, TailField<&StreamChunkHeader::data_size>,
+    Field<&StreamChunkHeader::flags>,
+    Field<&StreamChunkHeader::stream_id>,
+    Field<&StreamChunkHeader::data_size>>;
+
+using PingMsg = MessageDef<MessageType::PING, &ParsedMessage::heartbeat, NoTail,
+    Field<&HeartbeatHeader::seq>,
+    Field<&HeartbeatHeader::send_time_us>>;
+
+using PongMsg = MessageDef<MessageType::PONG, &ParsedMessage::heartbeat, NoTail,
+    Field<&HeartbeatHeader::seq>,
+    Field<&HeartbeatHeader::send_time_us>>;
+
+// из этого списка строится таблица разбора
+using Messages = MessageList<AuthRequestMsg, AuthResponseMsg, DataPktMsg, DataBatchMsg,
+                             RpcRequestMsg, RpcResponseMsg, StreamChunkMsg, PingMsg, PongMsg>;
+
 
 // bool peekHeader(int sock, char* data, size_t size) {
 //     size_t totalReceived = 0;
@@ -65,230 +342,764 @@ struct ParsedMessage {
  * используется сразу после конекта или в основном потоке чтения.
  * сокетом не владеем, только для recv !!!
  *
+ * в epoll: recvSome() на EPOLLIN, потом tryParseMessage() пока true.
+ *
  *TODO:
  * MSG_PEEK?
- * обработка не поддерживаемого типа
- * timeout коннектов - надо отбрасывать на авторизации
  */
 
 //может переписать на connection handler ???
 class MessageParser {
+public:
+    // куда уходят готовые кадры вместо сокета (очередь отправки клиента)
+    // body - хвост кадра без копии (payload из чужих буферов), чаще пустой
+    using TxSink = std::function<bool(FrameBuffer&& frame, SliceChain&& body)>;
+
 private:
     int sockfd_;
-    std::vector<char> recv_buffer_;
+    RecvBuffer recv_buffer_;
     size_t parsed_bytes_ = 0;
     bool is_timeout_ = false;
 
-    bool sendAll(const int sockfd, const std::vector<char>& data){
-        size_t total_sent = 0;
-        const char* ptr = data.data();
-        size_t remaining = data.size();
+    // сжатие: local_flags_ предлагаем/разрешаем, включается только после handshake
+    uint8_t local_flags_ = 0;
+    uint8_t lz_dict_log2_ = LZ_DICT_LOG2;
+    AuthRequest peer_request_;
+    bool compress_ = false;
+    bool checksum_ = false;
+    bool timestamps_ = false;
+    LatencyHistogram* one_way_ = nullptr;
+    uint64_t crc_errors_ = 0;
+    uint64_t resync_events_ = 0;
+    uint64_t resync_skipped_bytes_ = 0;
+    // по 1 MiB истории на направление - создаем только если сжатие договорено
+    std::unique_ptr<LzCodec> lz_tx_;
+    std::unique_ptr<LzCodec> lz_rx_;
+    std::vector<char> lz_buf_;
+    std::vector<char> unpack_buf_;
+    // send* из разных потоков (rpc, потоки, очередь) - кадры целиком, не вперемешку.
+    // tx_mtx_ - сборка кадра (порядок сжатия = порядок в очереди), wire_mtx_ - запись в сокет
+    std::mutex tx_mtx_;
+    std::mutex wire_mtx_;
+    TxSink tx_sink_;
+    // что не влезло в неблокирующий сокет: хвост кадра и все кадры после него, под wire_mtx_.
+    // досылает владелец на EPOLLOUT через flushBacklog
+    std::vector<char> tx_backlog_;
+    size_t tx_backlog_sent_ = 0;
+    bool tx_broken_ = false; // кадр оборван или backlog переполнен - только закрывать
+
+    void enableCompression(uint8_t dict_log2){
+        size_t dict = dict_log2 ? size_t(1) << std::min(dict_log2, LZ_DICT_LOG2_MAX) : 0;
+        lz_tx_ = std::make_unique<LzCodec>(dict);
+        lz_rx_ = std::make_unique<LzCodec>(dict);
+        compress_ = true;
+    }
+
+    static constexpr size_t RECV_MIN_TAILROOM = 16 * 1024; // меньше - сначала сдвигаем кадр в голову
+    static constexpr size_t TX_BACKLOG_MAX = 4 << 20; // пир столько не читает - рвем соединение
+
+    // в хвост backlog, под wire_mtx_
+    bool toBacklog(const char* ptr, size_t size){
+        if (tx_backlog_.size() - tx_backlog_sent_ + size > TX_BACKLOG_MAX) {
+            tx_broken_ = true;
+            return false;
+        }
+        tx_backlog_.insert(tx_backlog_.end(), ptr, ptr + size);
+        return true;
+    }
 
+    // запись в сокет целиком или остаток в backlog, под wire_mtx_.
+    // поток не ждет: сокеты сервера неблокирующие и пишет в них поток epoll
+    bool writeAll(const int sockfd, const char* ptr, size_t remaining){
+        if (tx_broken_) {
+            return false;
+        }
+        if (!tx_backlog_.empty()) {
+            return toBacklog(ptr, remaining);
+        }
         while (remaining > 0) {
-            ssize_t sent = send(sockfd, ptr + total_sent, remaining, MSG_NOSIGNAL);
+            ssize_t sent = send(sockfd, ptr, remaining, MSG_NOSIGNAL);
+            if (sent < 0 && errno == EINTR) {
+                continue;
+            }
+            // кадр нельзя обрывать на середине - остаток уйдет на EPOLLOUT
+            if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return toBacklog(ptr, remaining);
+            }
             if (sent <= 0) {
+                tx_broken_ = true;
                 return false;
             }
-            total_sent += static_cast<size_t>(sent);
+            trace(TraceEv::SEND, sockfd, static_cast<uint64_t>(sent));
+            ptr += sent;
             remaining -= static_cast<size_t>(sent);
         }
-
-        std::cout << "send header:" << total_sent << std::endl;
         return true;
     }
 
-    bool sendPacketPayload(const int sockfd, const std::vector<char>& header, char* data, int size){
-        sendAll(sockfd, header);
-        size_t total_sent = 0;
-        size_t remaining = size;
-        while (remaining > 0) {
-            ssize_t sent = send(sockfd, data + total_sent, remaining, MSG_NOSIGNAL);
+    // заголовок и куски одним sendmsg, под wire_mtx_
+    bool writeChain(const int sockfd, const FrameBuffer& head, const SliceChain& body){
+        static constexpr size_t IOV_BATCH = 16;
+        const size_t total = head.size() + body.size();
+        size_t done = 0;
+        if (tx_broken_) {
+            return false;
+        }
+        if (!tx_backlog_.empty()) {
+            return chainToBacklog(head, body, 0);
+        }
+        while (done < total) {
+            iovec iov[IOV_BATCH];
+            size_t n = 0;
+            if (done < head.size()) {
+                iov[n++] = iovec{const_cast<char*>(head.data()) + done, head.size() - done};
+            }
+            n += body.toIovec(iov + n, IOV_BATCH - n, done > head.size() ? done - head.size() : 0);
+            msghdr mh{};
+            mh.msg_iov = iov;
+            mh.msg_iovlen = n;
+            ssize_t sent = sendmsg(sockfd, &mh, MSG_NOSIGNAL);
+            if (sent < 0 && errno == EINTR) {
+                continue;
+            }
+            if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return chainToBacklog(head, body, done);
+            }
             if (sent <= 0) {
+                tx_broken_ = true;
                 return false;
             }
-            total_sent += static_cast<size_t>(sent);
-            remaining -= static_cast<size_t>(sent);
+            trace(TraceEv::SEND, sockfd, static_cast<uint64_t>(sent));
+            done += static_cast<size_t>(sent);
+        }
+        return true;
+    }
+
+    // неотправленное с done: копия, куски Slice могут освободиться раньше EPOLLOUT
+    bool chainToBacklog(const FrameBuffer& head, const SliceChain& body, size_t done){
+        if (done < head.size() && !toBacklog(head.data() + done, head.size() - done)) {
+            return false;
+        }
+        size_t skip = done > head.size() ? done - head.size() : 0;
+        for (size_t i = 0; i < body.count(); ++i) {
+            const Slice& part = body[i];
+            if (skip >= part.size()) {
+                skip -= part.size();
+                continue;
+            }
+            if (!toBacklog(part.data() + skip, part.size() - skip)) {
+                return false;
+            }
+            skip = 0;
+        }
+        return true;
+    }
+
+    bool sendAll(const int sockfd, const FrameBuffer& data){
+        std::lock_guard lock(wire_mtx_);
+        if (!writeAll(sockfd, data.data(), data.size())) {
+            return false;
+        }
+        LOG_TRACE("send header:" << data.size());
+        return true;
+    }
+
+    bool sendPacketPayload(const int sockfd, const FrameBuffer& header, char* data, int size){
+        std::lock_guard lock(wire_mtx_);
+        if (!writeAll(sockfd, header.data(), header.size())) {
+            return false;
+        }
+        LOG_TRACE("send header:" << header.size());
+        if (!writeAll(sockfd, data, size)) {
+            return false;
         }
-        std::cout << "send data:" << total_sent << std::endl;
+        LOG_TRACE("send data:" << size);
 
         return true;
     }
 
+    // готовый кадр: в очередь отправки, если она есть, иначе сразу в сокет
+    bool sendFrame(FrameBuffer&& frame){
+        if (tx_sink_) {
+            return tx_sink_(std::move(frame), SliceChain());
+        }
+        return sendAll(sockfd_, frame);
+    }
+
+    bool sendFrame(FrameBuffer&& head, SliceChain&& body){
+        if (tx_sink_) {
+            return tx_sink_(std::move(head), std::move(body));
+        }
+        std::lock_guard lock(wire_mtx_);
+        return writeChain(sockfd_, head, body);
+    }
+
+    using ParseFn = bool (MessageParser::*)(ParsedMessage&);
+
+    // тип кадра -> parseFrame<схема>, нулевые - неизвестные типы
+    template <typename... Msgs>
+    static constexpr std::array<ParseFn, 256> makeParseTable(MessageList<Msgs...>) {
+        std::array<ParseFn, 256> table{};
+        ((table[static_cast<uint8_t>(Msgs::id)] = &MessageParser::parseFrame<Msgs>), ...);
+        return table;
+    }
+
 public:
-    MessageParser(int sockfd, size_t size_buff) : sockfd_(sockfd) {
-        // todo может только тогда когда используется
-        // min for detect type for protect
-        recv_buffer_.reserve(std::max(size_buff, sizeof(MessageType)));
+    // приемный буфер берется из пула при первом recv
+    explicit MessageParser(int sockfd) : sockfd_(sockfd) {
         // setSocketTimeout(sockfd_, 1);
     }
 
+    // до handshake: клиент предлагает сжатие, сервер разрешает и урезает словарь до dict_log2
+    void setCompression(bool enable, uint8_t dict_log2 = LZ_DICT_LOG2){
+        if (enable) local_flags_ |= AUTH_FLAG_LZ;
+        else local_flags_ &= ~AUTH_FLAG_LZ;
+        lz_dict_log2_ = dict_log2;
+    }
+    bool isCompressed() const { return compress_; }
+
+    // crc32c на DATA_PKT, тоже согласуется на handshake
+    void setChecksum(bool enable){
+        if (enable) local_flags_ |= AUTH_FLAG_CRC32C;
+        else local_flags_ &= ~AUTH_FLAG_CRC32C;
+    }
+    bool isChecksummed() const { return checksum_; }
+
+    // метка отправителя в каждом DATA_PKT, для задержки в одну сторону; согласуется на handshake
+    void setTimestamps(bool enable){
+        if (enable) local_flags_ |= AUTH_FLAG_TIMESTAMP;
+        else local_flags_ &= ~AUTH_FLAG_TIMESTAMP;
+    }
+    bool hasTimestamps() const { return timestamps_; }
+    // куда писать задержку принятых DATA_PKT с меткой; гистограмма потока, который разбирает
+    void setOneWayHistogram(LatencyHistogram* h){
+        one_way_ = h;
+    }
+    // отброшенное на приеме с начала соединения; только поток, который разбирает
+    RxErrors rxErrors() const {
+        RxErrors e;
+        e.crc = crc_errors_;
+        e.resyncs = resync_events_;
+        e.resync_bytes = resync_skipped_bytes_;
+        return e;
+    }
+
     // Основной метод: читает и парсит одно сообщение
     bool readMessage(ParsedMessage& result, bool wait_timeout = true) {
 
         while (true) {
+            // Пытаемся распарсить из буфера, там может быть несколько кадров с прошлого recv
+            if (tryParseMessage(result)) {
+                return true;
+            }
+
             if (!readAvailable()) {
                 return false;
             }
             if (is_timeout_){
-                std::cout << "timeout" << std::endl;
+                LOG_DEBUG("timeout");
                 is_timeout_ = false;
                 if (wait_timeout){
                     continue;
                 }
                 return false;
             }
-
-            // Пытаемся распарсить из буфера
-            if (tryParseMessage(result)) {
-                return true;
-            }
         }
     }
 
     // Парсинг сообщения из буфера
     bool tryParseMessage(ParsedMessage& result) {
-        // need min msg - MessageType
-        if (recv_buffer_.size() - parsed_bytes_ < sizeof(MessageType)) {
-            return false;
+        // прошлый payload не держит приемный буфер, иначе recvSome не сможет его переиспользовать
+        result.payload = Slice();
+        while (true) {
+            // need min msg - FrameHead
+            if (recv_buffer_.size() - parsed_bytes_ < sizeof(FrameHead)) {
+                return false;
+            }
+            FrameHead head;
+            std::memcpy(&head, recv_buffer_.data() + parsed_bytes_, sizeof(FrameHead));
+            if (head.magic != FRAME_MAGIC || head.version != FRAME_VERSION) {
+                resync();
+                continue;
+            }
+
+            static constexpr auto parse_table = makeParseTable(Messages{});
+            ParseFn parse = parse_table[static_cast<uint8_t>(head.type)];
+            if (!parse) {
+                // Неизвестный тип - ищем следующий кадр
+                resync();
+                continue;
+            }
+
+            const size_t before = parsed_bytes_;
+            bool parsed = (this->*parse)(result);
+            if (parsed) {
+                return true;
+            }
+            // кадр еще не пришел целиком
+            if (parsed_bytes_ == before) {
+                return false;
+            }
+            // кадр отброшен (crc, битая пачка, размер), разбираем следующий
         }
-        MessageType type = *reinterpret_cast<MessageType*>(
-            recv_buffer_.data() + parsed_bytes_);
+    }
+
+    // до первой отправки
+    void setTxSink(TxSink sink){
+        tx_sink_ = std::move(sink);
+    }
 
+    // сырые байты мимо кадров и очереди, но не посреди чужого кадра
+    bool sendRaw(const char* data, size_t size){
+        std::lock_guard lock(wire_mtx_);
+        return writeAll(sockfd_, data, size);
+    }
 
-        switch (type) {
-        case MessageType::AUTH_REQUEST:
-            return parseAuthRequest(result);
-        case MessageType::AUTH_RESPONSE:
-            return parseAuthResponse(result);
-        case MessageType::DATA_PKT:
-            return parseDataPacket(result);
-        default:
-            // Неизвестный тип - пропускаем байт
-            parsed_bytes_++;
-            return false;
+    // есть неотправленное: владелец ждет EPOLLOUT и зовет flushBacklog
+    bool hasBacklog(){
+        std::lock_guard lock(wire_mtx_);
+        return !tx_backlog_.empty();
+    }
+    // запись сломана (ошибка сокета, переполнен backlog), соединение надо закрыть
+    bool txBroken(){
+        std::lock_guard lock(wire_mtx_);
+        return tx_broken_;
+    }
+
+    // сокет готов к записи: досылаем backlog сколько влезет. false - соединение закрывать
+    bool flushBacklog(){
+        std::lock_guard lock(wire_mtx_);
+        while (tx_backlog_sent_ < tx_backlog_.size() && !tx_broken_) {
+            ssize_t sent = send(sockfd_, tx_backlog_.data() + tx_backlog_sent_,
+                                tx_backlog_.size() - tx_backlog_sent_, MSG_NOSIGNAL);
+            if (sent < 0 && errno == EINTR) {
+                continue;
+            }
+            if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            }
+            if (sent <= 0) {
+                tx_broken_ = true;
+                break;
+            }
+            trace(TraceEv::SEND, sockfd_, static_cast<uint64_t>(sent));
+            tx_backlog_sent_ += static_cast<size_t>(sent);
         }
+        if (tx_backlog_sent_ == tx_backlog_.size()) {
+            tx_backlog_.clear();
+            tx_backlog_sent_ = 0;
+        } else if (tx_backlog_sent_ > tx_backlog_.size() / 2) {
+            // отправленная голова больше хвоста - сдвигаем, чтобы не росла
+            tx_backlog_.erase(tx_backlog_.begin(), tx_backlog_.begin() + tx_backlog_sent_);
+            tx_backlog_sent_ = 0;
+        }
+        return !tx_broken_;
+    }
+
+    // один recv в буфер, для epoll (сокет готов к чтению).
+    // >0 прочитано байт, 0 - соединение закрыто, <0 - ошибка (errno, EAGAIN не ошибка)
+    ssize_t recvSome() {
+        compactBuffer();
+        // прямо в приемный буфер, без промежуточной копии
+        char* tail = recv_buffer_.prepare(RECV_MIN_TAILROOM);
+        ssize_t received = recv(sockfd_, tail, recv_buffer_.tailroom(), 0);
+        if (received > 0) {
+            recv_buffer_.commit(static_cast<size_t>(received));
+        } else {
+            recv_buffer_.trim(); // ничего не пришло - буфер обратно в запас потока
+        }
+        return received;
     }
 
     void sendAuthResponce(ParsedMessage& msg, const std::array<uint8_t, 16> uuid, const uint64_t& restore_seq_num){
-        msg.auth_response.type = MessageType::AUTH_RESPONSE;
+        std::lock_guard lock(tx_mtx_);
+        setFrameHead(msg.auth_response, MessageType::AUTH_RESPONSE);
         msg.auth_response.client_uuid = uuid;
         msg.auth_response.restore_seq_num = 0;
-        msg.size_header = sizeof(AuthResponse);
+        // подтверждаем только то, что оба поддерживают
+        // метки только пишутся в гистограмму приема - соглашаемся без настройки
+        msg.auth_response.flags = peer_request_.flags & (local_flags_ | AUTH_FLAG_TIMESTAMP);
+        msg.auth_response.lz_dict_log2 = std::min(std::min(peer_request_.lz_dict_log2, lz_dict_log2_), LZ_DICT_LOG2_MAX);
+        msg.size_header = AuthResponseMsg::head_size;
 
         //sendAuthResponce
-        std::vector<char> resp(msg.size_header);
-        memcpy(resp.data(), &msg.auth_response, msg.size_header);
-        sendAll(sockfd_, resp);
+        FrameBuffer resp(msg.size_header);
+        AuthResponseMsg::encode(msg.auth_response, resp.data());
+        sendFrame(std::move(resp));
+
+        if (msg.auth_response.flags & AUTH_FLAG_LZ) {
+            enableCompression(msg.auth_response.lz_dict_log2);
+        }
+        checksum_ = msg.auth_response.flags & AUTH_FLAG_CRC32C;
+        timestamps_ = msg.auth_response.flags & AUTH_FLAG_TIMESTAMP;
     }
 
     void sendAuthRequest(ParsedMessage& msg, const std::array<uint8_t, 16> uuid){
-        msg.auth_request.type = MessageType::AUTH_REQUEST;
+        std::lock_guard lock(tx_mtx_);
+        setFrameHead(msg.auth_request, MessageType::AUTH_REQUEST);
         msg.auth_request.client_uuid = uuid;
-        msg.size_header = sizeof(AuthRequest);
+        msg.auth_request.flags = local_flags_;
+        msg.auth_request.lz_dict_log2 = lz_dict_log2_;
+        msg.size_header = AuthRequestMsg::head_size;
 
         //sendAuthResponce
-        std::vector<char> resp(msg.size_header);
-        memcpy(resp.data(), &msg.auth_request, msg.size_header);
-        sendAll(sockfd_, resp);
+        FrameBuffer resp(msg.size_header);
+        AuthRequestMsg::encode(msg.auth_request, resp.data());
+        sendFrame(std::move(resp));
+    }
+
+    bool sendRpcRequest(ParsedMessage& msg, uint64_t corr_id, uint16_t method_id, const char* data, uint32_t data_size){
+        std::lock_guard lock(tx_mtx_);
+        setFrameHead(msg.rpc_request, MessageType::RPC_REQUEST);
+        msg.rpc_request.corr_id = corr_id;
+        msg.rpc_request.method_id = method_id;
+        msg.rpc_request.data_size = data_size;
+        msg.size_header = RpcRequestMsg::head_size;
+
+        // одним send, чтобы мелкие запросы не ждали Nagle между заголовком и данными
+        FrameBuffer frame(RpcRequestMsg::head_size + data_size);
+        RpcRequestMsg::encode(msg.rpc_request, frame.data());
+        if (data_size) {
+            std::memcpy(frame.data() + RpcRequestMsg::head_size, data, data_size);
+        }
+        return sendFrame(std::move(frame));
+    }
+
+    bool sendRpcResponse(ParsedMessage& msg, uint64_t corr_id, uint16_t status, const char* data, uint32_t data_size){
+        std::lock_guard lock(tx_mtx_);
+        setFrameHead(msg.rpc_response, MessageType::RPC_RESPONSE);
+        msg.rpc_response.corr_id = corr_id;
+        msg.rpc_response.status = status;
+        msg.rpc_response.data_size = data_size;
+        msg.size_header = RpcResponseMsg::head_size;
+
+        FrameBuffer frame(RpcResponseMsg::head_size + data_size);
+        RpcResponseMsg::encode(msg.rpc_response, frame.data());
+        if (data_size) {
+            std::memcpy(frame.data() + RpcResponseMsg::head_size, data, data_size);
+        }
+        return sendFrame(std::move(frame));
+    }
+
+    bool sendStreamChunk(ParsedMessage& msg, uint32_t stream_id, uint8_t flags, const char* data, uint32_t data_size){
+        std::lock_guard lock(tx_mtx_);
+        setFrameHead(msg.stream_chunk, MessageType::STREAM_CHUNK);
+        msg.stream_chunk.flags = flags;
+        msg.stream_chunk.stream_id = stream_id;
+        msg.stream_chunk.data_size = data_size;
+        msg.size_header = StreamChunkMsg::head_size;
+
+        FrameBuffer frame(StreamChunkMsg::head_size + data_size);
+        StreamChunkMsg::encode(msg.stream_chunk, frame.data());
+        if (data_size) {
+            std::memcpy(frame.data() + StreamChunkMsg::head_size, data, data_size);
+        }
+        return sendFrame(std::move(frame));
+    }
+
+    bool sendPing(ParsedMessage& msg, uint64_t seq, uint64_t send_time_us){
+        std::lock_guard lock(tx_mtx_);
+        setFrameHead(msg.heartbeat, MessageType::PING);
+        msg.heartbeat.seq = seq;
+        msg.heartbeat.send_time_us = send_time_us;
+        msg.size_header = PingMsg::head_size;
+
+        FrameBuffer frame(PingMsg::head_size);
+        PingMsg::encode(msg.heartbeat, frame.data());
+        return sendFrame(std::move(frame));
+    }
+
+    // ответ на PING из ping
+    bool sendPong(ParsedMessage& msg, const HeartbeatHeader& ping){
+        std::lock_guard lock(tx_mtx_);
+        setFrameHead(msg.heartbeat, MessageType::PONG);
+        msg.heartbeat.seq = ping.seq;
+        msg.heartbeat.send_time_us = ping.send_time_us;
+        msg.size_header = PongMsg::head_size;
+
+        FrameBuffer frame(PongMsg::head_size);
+        PongMsg::encode(msg.heartbeat, frame.data());
+        return sendFrame(std::move(frame));
     }
 
     void sendDataPkt(ParsedMessage& msg, uint64_t seq_num, char* data, int data_size){
-        msg.packet_header.type = MessageType::DATA_PKT;
+        std::lock_guard lock(tx_mtx_);
+        setFrameHead(msg.packet_header, MessageType::DATA_PKT);
+        msg.packet_header.flags = 0;
         msg.packet_header.seq_num = seq_num;
+        if (checksum_) {
+            msg.packet_header.flags |= PKT_FLAG_CRC32C;
+        }
+        if (timestamps_) {
+            msg.packet_header.flags |= PKT_FLAG_TIMESTAMP;
+        }
+        const char* raw = data;
+        const size_t raw_size = data_size;
+        if (compress_ && lz_tx_->compress(data, data_size, lz_buf_)) {
+            msg.packet_header.flags |= PKT_FLAG_LZ;
+            data = lz_buf_.data();
+            data_size = lz_buf_.size();
+        }
         msg.packet_header.data_size = data_size;
-        msg.size_header = sizeof(DataPktHeader) + data_size;
+        msg.size_header = DataPktMsg::head_size + data_size;
 
         //sendAuthResponce
-        std::vector<char> resp(sizeof(DataPktHeader));
-        memcpy(resp.data(), &msg.packet_header, sizeof(DataPktHeader));
-        sendAll(sockfd_, resp);
+        FrameBuffer resp(DataPktMsg::head_size);
+        DataPktMsg::encode(msg.packet_header, resp.data());
+        uint32_t crc = 0;
+        if (checksum_) {
+            crc = crc32c(raw, raw_size, crc32c(resp.data(), DataPktMsg::head_size));
+        }
+        putPktExtras(resp, msg.packet_header.flags, crc);
+        if (tx_sink_) {
+            // в очередь только целым кадром
+            resp.insert(resp.end(), data, data + data_size);
+            sendFrame(std::move(resp));
+            return;
+        }
         sendPacketPayload(sockfd_, resp, data, data_size);
     }
 
+    // payload без копии: в очередь уходят ссылки на те же буферы,
+    // поэтому один Slice можно разослать многим соединениям. сжатие собирает новый кадр
+    void sendDataPkt(ParsedMessage& msg, uint64_t seq_num, SliceChain payload){
+        std::unique_lock lock(tx_mtx_);
+        if (compress_) {
+            // сжатие включается один раз и не выключается, можно отпустить до сборки кадра
+            lock.unlock();
+            std::vector<char> flat(payload.size());
+            for (size_t i = 0, off = 0; i < payload.count(); off += payload[i].size(), ++i) {
+                std::memcpy(flat.data() + off, payload[i].data(), payload[i].size());
+            }
+            sendDataPkt(msg, seq_num, flat.data(), static_cast<int>(flat.size()));
+            return;
+        }
+        setFrameHead(msg.packet_header, MessageType::DATA_PKT);
+        msg.packet_header.flags = 0;
+        msg.packet_header.seq_num = seq_num;
+        msg.packet_header.data_size = payload.size();
+        msg.size_header = DataPktMsg::head_size + payload.size();
+        if (checksum_) {
+            msg.packet_header.flags |= PKT_FLAG_CRC32C;
+        }
+        if (timestamps_) {
+            msg.packet_header.flags |= PKT_FLAG_TIMESTAMP;
+        }
 
-private:
-    bool parseAuthRequest(ParsedMessage& result) {
-        const size_t required_size = sizeof(AuthRequest);
-        if (recv_buffer_.size() - parsed_bytes_ < required_size) {
-            return false;
+        FrameBuffer head(DataPktMsg::head_size);
+        DataPktMsg::encode(msg.packet_header, head.data());
+        uint32_t crc = 0;
+        if (checksum_) {
+            crc = crc32c(head.data(), DataPktMsg::head_size);
+            for (size_t i = 0; i < payload.count(); ++i) {
+                crc = crc32c(payload[i].data(), payload[i].size(), crc);
+            }
+        }
+        putPktExtras(head, msg.packet_header.flags, crc);
+        sendFrame(std::move(head), std::move(payload));
+    }
+
+    // одной пачкой: seq записей base_seq_num, base_seq_num+1, ...
+    void sendDataBatch(ParsedMessage& msg, uint64_t base_seq_num, const PktView* records, uint16_t count){
+        std::lock_guard lock(tx_mtx_);
+        size_t payload_size = 0;
+        for (uint16_t i = 0; i < count; ++i) {
+            payload_size += records[i].size;
+        }
+
+        FrameBuffer frame(DataBatchMsg::head_size + count * MAX_VARINT32_SIZE + payload_size);
+        char* p = frame.data() + DataBatchMsg::head_size;
+        for (uint16_t i = 0; i < count; ++i) {
+            p += putVarint32(p, records[i].size);
         }
+        for (uint16_t i = 0; i < count; ++i) {
+            std::memcpy(p, records[i].data, records[i].size);
+            p += records[i].size;
+        }
+        frame.resize(p - frame.data());
 
-        result.type = MessageType::AUTH_REQUEST;
-        std::memcpy(&result.auth_request,
-                    recv_buffer_.data() + parsed_bytes_,
-                    required_size);
-        parsed_bytes_ += required_size;
+        msg.batch_header.flags = 0;
+        if (compress_ && lz_tx_->compress(frame.data() + DataBatchMsg::head_size,
+                                         frame.size() - DataBatchMsg::head_size, lz_buf_)) {
+            msg.batch_header.flags |= PKT_FLAG_LZ;
+            frame.resize(DataBatchMsg::head_size);
+            frame.insert(frame.end(), lz_buf_.begin(), lz_buf_.end());
+        }
 
-        return true;
+        setFrameHead(msg.batch_header, MessageType::DATA_BATCH);
+        msg.batch_header.base_seq_num = base_seq_num;
+        msg.batch_header.count = count;
+        msg.batch_header.body_size = frame.size() - DataBatchMsg::head_size;
+        msg.size_header = DataBatchMsg::head_size;
+        DataBatchMsg::encode(msg.batch_header, frame.data());
+        sendFrame(std::move(frame));
+    }
+
+
+private:
+    // после заголовка DATA_PKT: crc, потом метка времени - по флагам пакета
+    static void putPktExtras(FrameBuffer& head, uint8_t flags, uint32_t crc){
+        if (flags & PKT_FLAG_CRC32C) {
+            head.insert(head.end(), reinterpret_cast<const char*>(&crc), reinterpret_cast<const char*>(&crc) + sizeof(crc));
+        }
+        if (flags & PKT_FLAG_TIMESTAMP) {
+            uint64_t now = realtimeUs();
+            head.insert(head.end(), reinterpret_cast<const char*>(&now), reinterpret_cast<const char*>(&now) + sizeof(now));
+        }
     }
 
-    bool parseAuthResponse(ParsedMessage& result) {
-        const size_t required_size = sizeof(AuthResponse);
-        if (recv_buffer_.size() - parsed_bytes_ < required_size) {
+    // false без сдвига parsed_bytes_ - кадр еще не пришел целиком
+    template <typename Msg>
+    bool parseFrame(ParsedMessage& result) {
+        const char* frame = recv_buffer_.data() + parsed_bytes_;
+        const size_t available = recv_buffer_.size() - parsed_bytes_;
+        if (available < Msg::head_size) {
             return false;
         }
 
-        result.type = MessageType::AUTH_RESPONSE;
-        std::memcpy(&result.auth_response,
-                    recv_buffer_.data() + parsed_bytes_,
-                    required_size);
-        parsed_bytes_ += required_size;
+        typename Msg::Type header;
+        Msg::decode(header, frame);
 
+        // Проверяем, есть ли полные данные
+        const size_t total_size = Msg::head_size + Msg::tailSize(header);
+        if (total_size > FRAME_MAX_SIZE) {
+            resync();
+            return false;
+        }
+        if (available < total_size) {
+            return false;
+        }
+        parsed_bytes_ += total_size;
+
+        result.type = Msg::id;
+        result.size_header = Msg::head_size;
+        result.*Msg::slot = header;
+        return onFrame(result, header, frame + Msg::head_size);
+    }
+
+    bool onFrame(ParsedMessage&, const AuthRequest& header, const char*) {
+        peer_request_ = header; // для ответа
         return true;
     }
 
-    bool parseDataPacket(ParsedMessage& result) {
-        // Сначала читаем заголовок
-        const size_t required_size = sizeof(DataPktHeader);
-        if (recv_buffer_.size() - parsed_bytes_ < required_size) {
-            return false;
+    bool onFrame(ParsedMessage&, const AuthResponse& header, const char*) {
+        // поток epoll; пользователь в это время уже может слать DATA_PKT под tx_mtx_
+        std::lock_guard lock(tx_mtx_);
+        if (header.flags & AUTH_FLAG_LZ & local_flags_) {
+            enableCompression(header.lz_dict_log2);
         }
+        checksum_ = header.flags & AUTH_FLAG_CRC32C & local_flags_;
+        timestamps_ = header.flags & AUTH_FLAG_TIMESTAMP & local_flags_;
+        return true;
+    }
 
-        DataPktHeader header;
-        std::memcpy(&header,
-                    recv_buffer_.data() + parsed_bytes_,
-                    required_size);
+    bool onFrame(ParsedMessage& result, const DataPktHeader& header, const char* tail) {
+        const size_t crc_size = (header.flags & PKT_FLAG_CRC32C) ? sizeof(uint32_t) : 0;
+        uint32_t crc = 0;
+        std::memcpy(&crc, tail, crc_size);
+        const size_t ts_size = (header.flags & PKT_FLAG_TIMESTAMP) ? sizeof(uint64_t) : 0;
+        result.send_time_us = 0;
+        std::memcpy(&result.send_time_us, tail + crc_size, ts_size);
+        const char* payload = tail + crc_size + ts_size;
 
-        // Проверяем, есть ли полные данные
-        size_t total_size = required_size + header.data_size;
-        if (recv_buffer_.size() - parsed_bytes_ < total_size) {
+        if (header.flags & PKT_FLAG_LZ) {
+            // не договаривались или битый блок - пакет отбрасываем
+            std::vector<char> unpacked;
+            if (!compress_ || !lz_rx_->decompress(payload, header.data_size, unpacked)) {
+                return false;
+            }
+            result.payload = Slice::adopt(std::move(unpacked));
+        } else {
+            result.payload = recv_buffer_.slice(payload, header.data_size);
+        }
+
+        // заголовок тоже под crc: битые seq/data_size/flags не пройдут как целый пакет
+        if (crc_size && crc32c(result.payload.data(), result.payload.size(),
+                               crc32c(tail - DataPktMsg::head_size, DataPktMsg::head_size)) != crc) {
+            crc_errors_++;
             return false;
         }
+        // часы отправителя впереди наших - разница бессмысленна, не пишем
+        if (ts_size && one_way_) {
+            uint64_t now = realtimeUs();
+            if (now >= result.send_time_us) {
+                one_way_->record((now - result.send_time_us) * 1000);
+            }
+        }
+        return true;
+    }
 
-        // Копируем заголовок и данные
-        result.type = MessageType::DATA_PKT;
-        result.packet_header = header;
-        result.packet_data.resize(header.data_size);
+    bool onFrame(ParsedMessage& result, const DataBatchHeader& header, const char* body) {
+        size_t body_size = header.body_size;
+        if (header.flags & PKT_FLAG_LZ) {
+            if (!compress_ || !lz_rx_->decompress(body, body_size, unpack_buf_)) {
+                return false;
+            }
+            body = unpack_buf_.data();
+            body_size = unpack_buf_.size();
+        }
+        // битая пачка - пропускаем целиком
+        return splitBatch(header, body, body_size, result);
+    }
 
-        std::memcpy(result.packet_data.data(),
-                    recv_buffer_.data() + parsed_bytes_ + required_size,
-                    header.data_size);
+    // payload rpc копируем, обработчик может жить дольше буфера парсера
+    bool onFrame(ParsedMessage& result, const RpcRequestHeader& header, const char* data) {
+        result.packet_data.assign(data, data + header.data_size);
+        return true;
+    }
 
-        parsed_bytes_ += total_size;
+    bool onFrame(ParsedMessage& result, const RpcResponseHeader& header, const char* data) {
+        result.packet_data.assign(data, data + header.data_size);
         return true;
     }
 
-    // Чтение данных из сокета
-    bool readAvailable() {
-        // Освобождаем место если нужно
-        // if (parsed_bytes_ > recv_buffer_.size() / 2) {
-        //     compactBuffer();
-        // }
+    bool onFrame(ParsedMessage& result, const StreamChunkHeader&, const char* data) {
+        result.chunk_data = data;
+        return true;
+    }
 
-        // Читаем в доступное место
-        size_t available_space = recv_buffer_.capacity() - recv_buffer_.size();
-        if (available_space < 1024) {
-            recv_buffer_.reserve(recv_buffer_.capacity() * 2);
-            available_space = recv_buffer_.capacity() - recv_buffer_.size();
+    bool onFrame(ParsedMessage&, const HeartbeatHeader&, const char*) {
+        return true;
+    }
+
+    // сначала длины, потом данные - раскладываем указатели в буфер
+    bool splitBatch(const DataBatchHeader& header, const char* p, size_t size, ParsedMessage& result) {
+        const char* end = p + size;
+        result.batch_records.resize(header.count);
+        for (uint16_t i = 0; i < header.count; ++i) {
+            uint32_t rec_size;
+            if (!getVarint32(p, end, rec_size)) {
+                return false;
+            }
+            result.batch_records[i].seq_num = header.base_seq_num + i;
+            result.batch_records[i].size = rec_size;
         }
+        for (uint16_t i = 0; i < header.count; ++i) {
+            PktView& rec = result.batch_records[i];
+            if (static_cast<size_t>(end - p) < rec.size) {
+                return false;
+            }
+            rec.data = p;
+            p += rec.size;
+        }
+        return true;
+    }
+
+    // мусор на месте заголовка - прыгаем сразу к следующему magic+version
+    void resync() {
+        const char* begin = recv_buffer_.data() + parsed_bytes_;
+        const char* end = recv_buffer_.data() + recv_buffer_.size();
+        const char* next = findFrameStart(begin + 1, end);
+        resync_events_++;
+        resync_skipped_bytes_ += next - begin;
+        parsed_bytes_ += next - begin;
+    }
 
-        std::vector<char> temp_buf(1024);
-        ssize_t received = recv(sockfd_, temp_buf.data(), temp_buf.size(), 0);
-        // std::cout << sockfd_ << " recv:" << received << " " << temp_buf.size() << " " << errno << std::endl;
+    // Чтение данных из сокета
+    bool readAvailable() {
+        ssize_t received = recvSome();
+        // std::cout << sockfd_ << " recv:" << received << " " << errno << std::endl;
         if (received > 0) {
-            recv_buffer_.insert(recv_buffer_.end(),
-                                temp_buf.data(),
-                                temp_buf.data() + received);
             return true;
         } else if (received == 0) {
             return false; // Connection closed
@@ -302,17 +1113,14 @@ private:
         }
     }
 
-    // void compactBuffer() {
-    //     if (parsed_bytes_ > 0) {
-    //         if (parsed_bytes_ < recv_buffer_.size()) {
-    //             std::memmove(recv_buffer_.data(),
-    //                          recv_buffer_.data() + parsed_bytes_,
-    //                          recv_buffer_.size() - parsed_bytes_);
-    //         }
-    //         recv_buffer_.resize(recv_buffer_.size() - parsed_bytes_);
-    //         parsed_bytes_ = 0;
-    //     }
-    // }
+    // разобранное выкидываем, остается только недочитанный кадр
+    void compactBuffer() {
+        if (parsed_bytes_ > 0) {
+            // сдвиг хвоста - в prepare, только когда кончится место
+            recv_buffer_.consume(parsed_bytes_);
+            parsed_bytes_ = 0;
+        }
+    }
 
     static void setSocketTimeout(int sockfd, int seconds) {
         struct timeval tv;
@@ -1,5 +1,6 @@
 #include "server.h"
 #include "serialization.h"
+#include <fcntl.h>
 
 int IServer::create_listen_socket()
 {
@@ -13,13 +14,6 @@ int IServer::create_listen_socket()
     //     std::cout << "fail set SO_RCVBUF";
     // };
 
-    timeval tv;
-    tv.tv_sec = 1;
-    tv.tv_usec = 0;
-    if (setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == -1) {
-        std::cout << "fail set SO_RCVTIMEO 1s";
-    }
-
     int opt = 1;
     if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt))) {
         last_error_ = "setsockopt reuseaddr failed";
@@ -48,6 +42,10 @@ int IServer::create_listen_socket()
         return false;
     }
 
+    // handle_accept крутит accept4 до EAGAIN, на блокирующем сокете
+    // последний вызов висел бы и держал весь поток epoll
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+
     return sock;
 }
 
@@ -86,6 +84,16 @@ int SinglethreadServer::countClients()
     return epoll_.countClients();
 }
 
+LatencyReport SinglethreadServer::latency()
+{
+    return epoll_.latency();
+}
+
+RxErrors SinglethreadServer::rxErrors()
+{
+    return epoll_.rxErrors();
+}
+
 void SinglethreadServer::onEvent(EventType e){
     switch(e){
     case EventType::ClientDisconnect:
@@ -105,6 +113,18 @@ void SinglethreadServer::onEvent(EventType e){
 
 MultithreadServer::MultithreadServer(ServerConfig &&conf) : IServer(std::move(conf)), epoll_(this){
     // conf_ = std::move(conf);
+    epoll_.set_rpc(&rpc_);
+    epoll_.set_stream_handler(&stream_handler_);
+    epoll_.set_timeouts(conf_.handshake_timeout_ms, conf_.idle_timeout_ms);
+    epoll_.set_heartbeat(conf_.heartbeat_interval_ms, conf_.heartbeat_misses);
+    epoll_.set_compression(conf_.compression, conf_.lz_dict_log2);
+    epoll_.set_checksum(conf_.checksum);
+    epoll_.set_balance(conf_.balance);
+    epoll_.set_perf_counters(conf_.perf_counters);
+}
+
+bool MultithreadServer::start(){
+    return start(std::max(1u, std::thread::hardware_concurrency()));
 }
 
 bool MultithreadServer::start(int count_ths){
@@ -130,3 +150,22 @@ int MultithreadServer::countClients()
 {
     return epoll_.countClients();
 }
+
+LatencyReport MultithreadServer::latency()
+{
+    return epoll_.latency();
+}
+
+RxErrors MultithreadServer::rxErrors()
+{
+    return epoll_.rxErrors();
+}
+
+PerfReport MultithreadServer::perf()
+{
+    return epoll_.perf();
+}
+
+void MultithreadServer::onEvent(EventType e){
+    d("srv onEvent " << (int)e << " state:" << (int)state_)
+}
@@ -12,6 +12,22 @@ struct ServerConfig{
 
     // int recv_buffer_size = 1 * 1024 * 1024; // 100 MiB
     int max_connections = 10;
+    // не прислал AUTH_REQUEST за это время - отключаем, 0 - auth не обязателен
+    int handshake_timeout_ms = 5000;
+    // после auth: сколько можно молчать, 0 - сколько угодно
+    int idle_timeout_ms = 0;
+    // ping раз в interval, rtt в Stats соединения; клиент молчит misses интервалов - отключаем
+    int heartbeat_interval_ms = 5000; // 0 - без ping
+    int heartbeat_misses = 3;
+    // MultithreadServer: в какой поток отдавать новое соединение, LEAST_BPS/LEAST_BUSY - только явно
+    BalancePolicy balance = BalancePolicy::LEAST_CONN;
+    // MultithreadServer: perf_event_open в каждом воркере, смотреть perf()
+    bool perf_counters = false;
+    // LZ на DATA_PKT, если клиент тоже просит; словарь клиента урезаем до 2^lz_dict_log2
+    bool compression = false;
+    uint8_t lz_dict_log2 = LZ_DICT_LOG2;
+    // crc32c на DATA_PKT, если клиент тоже просит; битые считает rxErrors()
+    bool checksum = false;
 
     // int serialization_ths = 1;
 };
@@ -24,10 +40,25 @@ enum class ServerState : uint8_t{
 
 class IServer{
 public:
-    IServer(ServerConfig&& c) : conf_(std::move(c)) {};
+    IServer(ServerConfig&& c) : conf_(std::move(c)) {
+        FastClock::calibrate(); // до epoll_ и очередей отправки
+    }
     virtual bool start() = 0; // wait accept
     virtual void stop() = 0;
     virtual int countClients() = 0;
+    // задержки по всем потокам сервера с начала работы, LatencyReport::toString для лога
+    virtual LatencyReport latency() = 0;
+    // отброшенное на приеме по всем соединениям с начала работы, и уже закрытым
+    virtual RxErrors rxErrors() = 0;
+
+    // обработчик rpc, регистрировать до start()
+    void registerMethod(uint16_t method_id, RpcHandler handler){
+        rpc_.registerMethod(method_id, std::move(handler));
+    }
+    // куски логических потоков от клиентов, conn - fd соединения; до start()
+    void setStreamHandler(StreamHandler h){
+        stream_handler_ = std::move(h);
+    }
 
     ServerConfig conf_;
     string last_error_;
@@ -38,17 +69,26 @@ public:
 protected:
     ServerState state_ = ServerState::STOPPED;
     int create_listen_socket();
+    RpcServer rpc_;
+    StreamHandler stream_handler_;
 };
 
 class SinglethreadServer : public IServer, public IClientEventHandler {
 public:
     SinglethreadServer(ServerConfig&& conf) :
         IServer(std::move(conf)), epoll_(this){
-
+        epoll_.set_rpc(&rpc_);
+        epoll_.set_stream_handler(&stream_handler_);
+        epoll_.set_timeouts(conf_.handshake_timeout_ms, conf_.idle_timeout_ms);
+        epoll_.set_heartbeat(conf_.heartbeat_interval_ms, conf_.heartbeat_misses);
+        epoll_.set_compression(conf_.compression, conf_.lz_dict_log2);
+        epoll_.set_checksum(conf_.checksum);
     }
     bool start();
     void stop();
     int countClients();
+    LatencyReport latency();
+    RxErrors rxErrors();
 
 private:
     void onEvent(EventType e);
@@ -59,11 +99,19 @@ private:
 class MultithreadServer : public IServer, public IClientEventHandler {
 public:
     MultithreadServer(ServerConfig&& conf);
-    bool start(int count_ths);;
+    // по потоку на ядро
+    bool start();
+    bool start(int count_ths);
     void stop();
 
     int countClients();
+    LatencyReport latency();
+    RxErrors rxErrors();
+    // IPC, такты на байт и на кадр за последнюю секунду по всем воркерам; нужен conf.perf_counters
+    PerfReport perf();
 private:
+    void onEvent(EventType e);
+
     ServerMultithEpoll epoll_;
 };
 
@@ -0,0 +1,86 @@
+#include "slice.h"
+#include <algorithm>
+#include <cstring>
+
+Slice Slice::copyOf(const char* data, size_t size){
+    std::shared_ptr<char[]> block(new char[size ? size : 1]);
+    if (size) {
+        std::memcpy(block.get(), data, size);
+    }
+    const char* p = block.get();
+    return Slice(std::shared_ptr<const void>(std::move(block), p), p, size);
+}
+
+Slice Slice::adopt(std::vector<char>&& data){
+    auto v = std::make_shared<std::vector<char>>(std::move(data));
+    const char* p = v->data();
+    size_t size = v->size();
+    return Slice(std::shared_ptr<const void>(std::move(v)), p, size);
+}
+
+Slice Slice::sub(size_t offset, size_t size) const {
+    Slice s(*this);
+    offset = std::min(offset, size_);
+    s.data_ = data_ + offset;
+    s.size_ = std::min(size, size_ - offset);
+    return s;
+}
+
+void SliceChain::append(Slice s){
+    if (s.empty()) {
+        return;
+    }
+    bytes_ += s.size();
+    parts_.push_back(std::move(s));
+}
+
+size_t SliceChain::toIovec(iovec* out, size_t max, size_t offset) const {
+    offset += head_skip_;
+    size_t n = 0;
+    for (const Slice& s : parts_) {
+        if (n == max) {
+            break;
+        }
+        if (offset >= s.size()) {
+            offset -= s.size();
+            continue;
+        }
+        out[n].iov_base = const_cast<char*>(s.data() + offset);
+        out[n].iov_len = s.size() - offset;
+        offset = 0;
+        ++n;
+    }
+    return n;
+}
+
+bool SliceChain::at(size_t offset, const char*& data, size_t& size) const {
+    offset += head_skip_;
+    for (const Slice& s : parts_) {
+        if (offset < s.size()) {
+            data = s.data() + offset;
+            size = s.size() - offset;
+            return true;
+        }
+        offset -= s.size();
+    }
+    return false;
+}
+
+void SliceChain::consume(size_t n){
+    n = std::min(n, bytes_);
+    bytes_ -= n;
+    n += head_skip_;
+    size_t drop = 0;
+    while (drop < parts_.size() && n >= parts_[drop].size()) {
+        n -= parts_[drop].size();
+        ++drop;
+    }
+    parts_.erase(parts_.begin(), parts_.begin() + drop);
+    head_skip_ = n;
+}
+
+void SliceChain::clear(){
+    parts_.clear();
+    bytes_ = 0;
+    head_skip_ = 0;
+}
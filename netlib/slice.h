@@ -0,0 +1,75 @@
+#ifndef SLICE_H
+#define SLICE_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <sys/uio.h>
+#include <vector>
+#include "arena.h"
+#include "bufpool.h"
+
+/*
+ * кусок чужого буфера со ссылкой на владельца: пока жив хоть один Slice,
+ * память не переиспользуется. копия Slice - это счетчик ссылок, не байты.
+ * владелец - буфер пула (приемный буфер парсера) или общий блок в куче.
+ * данные только для чтения: один буфер могут держать много очередей отправки.
+ */
+class Slice {
+public:
+    Slice() = default;
+    Slice(PoolBuffer owner, const char* data, size_t size)
+        : pooled_(std::move(owner)), data_(data), size_(size) {}
+    Slice(std::shared_ptr<const void> owner, const char* data, size_t size)
+        : heap_(std::move(owner)), data_(data), size_(size) {}
+
+    // своя копия байт, когда владельца нет (данные пользователя)
+    static Slice copyOf(const char* data, size_t size);
+    // забрать вектор без копии
+    static Slice adopt(std::vector<char>&& data);
+
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    const char* begin() const { return data_; }
+    const char* end() const { return data_ + size_; }
+
+    // без копии, общий владелец; size обрезается по концу
+    Slice sub(size_t offset, size_t size = std::string::npos) const;
+
+    iovec iov() const { return iovec{const_cast<char*>(data_), size_}; }
+
+private:
+    PoolBuffer pooled_;
+    std::shared_ptr<const void> heap_;
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+// цепочка кусков, уходит в сокет одним writev
+class SliceChain {
+public:
+    SliceChain() = default;
+    SliceChain(Slice s) { append(std::move(s)); }
+
+    void append(Slice s);
+    size_t size() const { return bytes_; }
+    bool empty() const { return bytes_ == 0; }
+    size_t count() const { return parts_.size(); }
+    const Slice& operator[](size_t i) const { return parts_[i]; }
+
+    // не больше max записей, пропустив первые offset байт (уже отправленные)
+    size_t toIovec(iovec* out, size_t max, size_t offset = 0) const;
+    // кусок, в котором лежит байт offset: указатель на него и сколько до конца куска
+    bool at(size_t offset, const char*& data, size_t& size) const;
+    // выкинуть первые n байт, полностью отправленные куски освобождаются
+    void consume(size_t n);
+    void clear();
+
+private:
+    std::vector<Slice, ArenaAllocator<Slice>> parts_;
+    size_t bytes_ = 0;
+    size_t head_skip_ = 0; // уже отправлено из parts_.front()
+};
+
+#endif // SLICE_H
@@ -2,20 +2,97 @@
 #define STATS_H
 
 #include "const.h"
+#include <atomic>
 #include <chrono>
+#include <cmath>
 #include <cstdint>
 #include <iomanip>
 #include <sstream>
 
+// atomic, который копируется как обычное значение (Stats переезжает между потоками целиком)
+template <typename T>
+class RelaxedAtomic {
+public:
+    RelaxedAtomic() = default;
+    RelaxedAtomic(const RelaxedAtomic& o) : v_(o.load()) {}
+    RelaxedAtomic& operator=(const RelaxedAtomic& o) {
+        store(o.load());
+        return *this;
+    }
+    T load() const { return v_.load(std::memory_order_relaxed); }
+    void store(T v) { v_.store(v, std::memory_order_relaxed); }
+
+private:
+    std::atomic<T> v_{};
+};
+
+// отброшенное на приеме одним соединением или суммой соединений
+struct RxErrors {
+    uint64_t crc = 0;            // DATA_PKT с несошедшимся crc32c
+    uint64_t resyncs = 0;        // поиски следующего magic после мусора
+    uint64_t resync_bytes = 0;   // байт пропущено при этом
+
+    void merge(const RxErrors& o){
+        crc += o.crc;
+        resyncs += o.resyncs;
+        resync_bytes += o.resync_bytes;
+    }
+    bool operator==(const RxErrors& o) const {
+        return crc == o.crc && resyncs == o.resyncs && resync_bytes == o.resync_bytes;
+    }
+    bool operator!=(const RxErrors& o) const { return !(*this == o); }
+};
+
 class Stats {
 public:
     std::string ip;
     double last_bps = 0;
 
+    // rtt по heartbeat, сглаживание как у tcp (RFC 6298).
+    // пишет только поток epoll, читать можно из любого
+    double srttUs() const { return srtt_us_.load(); }
+    double rttJitterUs() const { return rtt_jitter_us_.load(); } // rttvar
+    uint64_t rttSamples() const { return rtt_samples_.load(); }
+
+    // копия счетчиков MessageParser соединения, пишет только поток epoll
+    RxErrors rxErrors() const {
+        RxErrors e;
+        e.crc = rx_crc_.load();
+        e.resyncs = rx_resyncs_.load();
+        e.resync_bytes = rx_resync_bytes_.load();
+        return e;
+    }
+    void setRxErrors(const RxErrors& e) {
+        rx_crc_.store(e.crc);
+        rx_resyncs_.store(e.resyncs);
+        rx_resync_bytes_.store(e.resync_bytes);
+    }
+
     void addBytes(size_t bytes) {
         total_bytes += bytes;
     }
 
+    // один писатель: load/store без rmw, читатели видят целые значения
+    void addRttSample(double rtt_us) {
+        uint64_t n = rtt_samples_.load();
+        rtt_samples_.store(n + 1);
+        if (n == 0) {
+            rtt_jitter_us_.store(rtt_us / 2);
+            srtt_us_.store(rtt_us);
+            return;
+        }
+        double srtt = srtt_us_.load();
+        rtt_jitter_us_.store(0.75 * rtt_jitter_us_.load() + 0.25 * std::fabs(srtt - rtt_us));
+        srtt_us_.store(0.875 * srtt + 0.125 * rtt_us);
+    }
+
+    string getRtt() const {
+        std::ostringstream oss;
+        oss << std::fixed << std::setprecision(3)
+            << "rtt " << srttUs() / 1000.0 << " ms jitter " << rttJitterUs() / 1000.0 << " ms";
+        return oss.str();
+    }
+
     //  скорость за интервал с последнего вызова
     string getBitrate() {
         auto now = std::chrono::steady_clock::now();
@@ -43,6 +120,12 @@ public:
     }
 
 private:
+    RelaxedAtomic<double> srtt_us_;
+    RelaxedAtomic<double> rtt_jitter_us_;
+    RelaxedAtomic<uint64_t> rtt_samples_;
+    RelaxedAtomic<uint64_t> rx_crc_;
+    RelaxedAtomic<uint64_t> rx_resyncs_;
+    RelaxedAtomic<uint64_t> rx_resync_bytes_;
     uint64_t total_bytes;
     uint64_t last_bytes = 0;
     std::chrono::steady_clock::time_point last_time{};
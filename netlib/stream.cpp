@@ -0,0 +1,97 @@
+#include "stream.h"
+
+uint32_t StreamMux::open(){
+    std::lock_guard lock(mtx_);
+    uint32_t id = next_id_++;
+    streams_[id];
+    return id;
+}
+
+bool StreamMux::write(uint32_t stream_id, const char* data, size_t size, bool fin){
+    std::lock_guard lock(mtx_);
+    auto it = streams_.find(stream_id);
+    if (it == streams_.end() || it->second.closed) {
+        return false;
+    }
+    Stream& st = it->second;
+    // пустой буфер с fin тоже отправляем - пир узнает о закрытии
+    if (size || fin) {
+        st.bufs.emplace_back(data, data + size);
+        queued_bytes_ += size;
+    }
+    st.fin = fin;
+    st.closed = fin;
+    if (!st.active && !st.bufs.empty()) {
+        st.active = true;
+        active_.push_back(stream_id);
+    }
+    return true;
+}
+
+bool StreamMux::pump(MessageParser& parser, size_t max_bytes){
+    std::lock_guard pump_lock(pump_mtx_);
+    size_t sent = 0;
+    while (max_bytes == 0 || sent < max_bytes) {
+        uint32_t id;
+        const char* data;
+        size_t size;
+        uint8_t flags = 0;
+        {
+            std::lock_guard lock(mtx_);
+            if (active_.empty()) {
+                break;
+            }
+            id = active_.front();
+            active_.pop_front();
+            // буфер никто кроме pump не удаляет, а deque::push_back не двигает элементы
+            Stream& st = streams_[id];
+            const std::vector<char>& buf = st.bufs.front();
+            data = buf.data() + st.offset;
+            size = std::min(chunk_size_, buf.size() - st.offset);
+            if (st.fin && st.bufs.size() == 1 && st.offset + size == buf.size()) {
+                flags |= STREAM_FLAG_FIN;
+            }
+        }
+
+        if (!parser.sendStreamChunk(out_, id, flags, data, size)) {
+            return false;
+        }
+        sent += StreamChunkMsg::head_size + size;
+
+        std::lock_guard lock(mtx_);
+        Stream& st = streams_[id];
+        st.offset += size;
+        queued_bytes_ -= size;
+        if (st.offset == st.bufs.front().size()) {
+            st.bufs.pop_front();
+            st.offset = 0;
+        }
+        if (!st.bufs.empty()) {
+            active_.push_back(id); // в конец круга
+        } else {
+            st.active = false;
+            if (flags & STREAM_FLAG_FIN) {
+                streams_.erase(id);
+            }
+        }
+    }
+    return true;
+}
+
+size_t StreamMux::queuedBytes(){
+    std::lock_guard lock(mtx_);
+    return queued_bytes_;
+}
+
+size_t StreamMux::activeStreams(){
+    std::lock_guard lock(mtx_);
+    return active_.size();
+}
+
+void StreamMux::clear(){
+    std::lock_guard pump_lock(pump_mtx_);
+    std::lock_guard lock(mtx_);
+    streams_.clear();
+    active_.clear();
+    queued_bytes_ = 0;
+}
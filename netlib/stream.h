@@ -0,0 +1,61 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "serialization.h"
+
+// кусок потока на приеме: conn - fd соединения, данные валидны только внутри вызова.
+// соединение закрылось - для каждого незавершенного потока fin с size 0
+using StreamHandler = std::function<void(int conn, uint32_t stream_id, const char* data, size_t size, bool fin)>;
+
+/*
+ * много логических потоков в одном tcp соединении, только клиент -> сервер.
+ * write только складывает данные, pump режет на куски по chunk_size
+ * и отправляет по кругу: один кусок от каждого потока с данными.
+ * так 100 мб в одном потоке не задерживают мелкие сообщения в других,
+ * а rpc и остальные кадры проходят между кусками.
+ * порядок внутри потока сохраняется.
+ */
+class StreamMux {
+public:
+    static constexpr size_t CHUNK_SIZE = 16 * 1024;
+
+    explicit StreamMux(size_t chunk_size = CHUNK_SIZE) : chunk_size_(chunk_size) {}
+
+    uint32_t open();
+    // данные копируются; fin - больше в поток не пишем
+    bool write(uint32_t stream_id, const char* data, size_t size, bool fin = false);
+
+    // отправляет до max_bytes (0 - все что есть), false - ошибка отправки
+    bool pump(MessageParser& parser, size_t max_bytes = 0);
+
+    size_t queuedBytes();
+    size_t activeStreams();
+    // обрыв соединения: все недоотправленное выкидываем
+    void clear();
+
+private:
+    struct Stream {
+        std::deque<std::vector<char>> bufs;
+        size_t offset = 0; // отправлено из bufs.front()
+        bool fin = false;  // fin после последнего буфера
+        bool closed = false;
+        bool active = false; // стоит в очереди active_
+    };
+
+    size_t chunk_size_;
+    std::mutex pump_mtx_; // один pump за раз, send без mtx_
+    std::mutex mtx_;
+    uint32_t next_id_ = 1;
+    std::unordered_map<uint32_t, Stream> streams_;
+    std::deque<uint32_t> active_; // круг потоков с данными
+    size_t queued_bytes_ = 0;
+    ParsedMessage out_;
+};
+
+#endif // STREAM_H
@@ -0,0 +1,137 @@
+#include "timerwheel.h"
+#include <algorithm>
+
+TimerWheel::Timer::~Timer(){
+    if (wheel_) {
+        wheel_->cancel(*this);
+    }
+}
+
+TimerWheel::TimerWheel() : now_tick_(nowMs() / TICK_MS) {}
+
+TimerWheel::~TimerWheel(){
+    // владельцы таймеров могут пережить колесо
+    for (auto& level : slots_) {
+        for (auto& slot : level) {
+            while (!slot.empty()) {
+                Timer* t = slot.head.next_;
+                unlink(*t);
+                t->wheel_ = nullptr;
+            }
+        }
+    }
+}
+
+uint64_t TimerWheel::nowMs(){
+    using namespace std::chrono;
+    return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+void TimerWheel::arm(Timer& t, uint32_t delay_ms){
+    if (t.wheel_) {
+        unlink(t);
+    } else {
+        ++count_;
+    }
+    t.wheel_ = this;
+    // от реального времени: now_tick_ мог отстать, если цикл долго не доходил до advance
+    // текущий тик уже обработан, поэтому не раньше следующего
+    t.expires_ = std::max((nowMs() + delay_ms + TICK_MS - 1) / TICK_MS, now_tick_ + 1);
+    link(t);
+}
+
+void TimerWheel::cancel(Timer& t){
+    if (t.wheel_ != this) {
+        return;
+    }
+    unlink(t);
+    t.wheel_ = nullptr;
+    --count_;
+}
+
+void TimerWheel::link(Timer& t){
+    uint64_t expires = std::max(t.expires_, now_tick_);
+    uint64_t delta = expires - now_tick_;
+    uint32_t level = 0;
+    while (level + 1 < LEVELS && delta >= (uint64_t(1) << ((level + 1) * SLOT_BITS))) {
+        ++level;
+    }
+    if (level == LEVELS - 1) {
+        // дальше колеса не заглядываем, дойдет - разложится еще раз
+        uint64_t max_delta = (uint64_t(1) << (LEVELS * SLOT_BITS)) - 1;
+        expires = now_tick_ + std::min(delta, max_delta);
+    }
+    Slot& slot = slots_[level][(expires >> (level * SLOT_BITS)) & (SLOTS - 1)];
+    t.prev_ = slot.head.prev_;
+    t.next_ = &slot.head;
+    slot.head.prev_->next_ = &t;
+    slot.head.prev_ = &t;
+}
+
+void TimerWheel::unlink(Timer& t){
+    t.prev_->next_ = t.next_;
+    t.next_->prev_ = t.prev_;
+    t.prev_ = t.next_ = nullptr;
+}
+
+void TimerWheel::cascade(uint32_t level){
+    Slot& slot = slots_[level][(now_tick_ >> (level * SLOT_BITS)) & (SLOTS - 1)];
+    // все из слота ближе, чем круг уровня ниже, поэтому назад сюда не попадут
+    while (!slot.empty()) {
+        Timer* t = slot.head.next_;
+        unlink(*t);
+        link(*t);
+    }
+}
+
+int TimerWheel::timeoutMs(int max_ms) const {
+    if (count_ == 0) {
+        return max_ms;
+    }
+    // ближайший непустой слот уровня 0, но не дальше раскладки верхних уровней
+    uint64_t tick = now_tick_ + 1;
+    while ((tick & (SLOTS - 1)) != 0 && slots_[0][tick & (SLOTS - 1)].empty()) {
+        ++tick;
+    }
+    int64_t wait = static_cast<int64_t>(tick * TICK_MS) - static_cast<int64_t>(nowMs());
+    if (wait < 0) {
+        return 0;
+    }
+    return static_cast<int>(std::min<int64_t>(wait, max_ms));
+}
+
+size_t TimerWheel::advance(uint64_t now_ms){
+    uint64_t target = now_ms / TICK_MS;
+    if (count_ == 0) {
+        now_tick_ = std::max(now_tick_, target);
+        return 0;
+    }
+    size_t fired = 0;
+    while (now_tick_ < target) {
+        ++now_tick_;
+        // сначала верхние уровни: они могут разложиться в слот уровня ниже, который раскладываем сейчас
+        uint32_t top = 0;
+        while (top + 1 < LEVELS && (now_tick_ & ((uint64_t(1) << ((top + 1) * SLOT_BITS)) - 1)) == 0) {
+            ++top;
+        }
+        for (uint32_t level = top; level > 0; --level) {
+            cascade(level);
+        }
+
+        Slot& slot = slots_[0][now_tick_ & (SLOTS - 1)];
+        while (!slot.empty()) {
+            Timer* t = slot.head.next_;
+            unlink(*t);
+            t->wheel_ = nullptr;
+            --count_;
+            ++fired;
+            // копия: cb может удалить владельца вместе с таймером,
+            // перевзвести этот таймер или удалить соседние
+            if (t->cb) {
+                auto cb = t->cb;
+                cb();
+            }
+        }
+    }
+    return fired;
+}
@@ -0,0 +1,81 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+
+/*
+ * иерархическое колесо таймеров для цикла epoll.
+ * LEVELS уровней по SLOTS слотов, тик TICK_MS:
+ * уровень 0 - ближайшие SLOTS тиков, каждый следующий в SLOTS раз грубее.
+ * когда уровень 0 проходит круг, слот уровня выше раскладывается вниз.
+ * arm/cancel - O(1): таймер это узел двусвязного списка внутри объекта владельца,
+ * своего fd и аллокаций нет, поэтому можно держать таймер на каждое соединение.
+ * не потокобезопасно: все вызовы из потока своего epoll.
+ */
+class TimerWheel {
+public:
+    static constexpr uint32_t TICK_MS = 10;
+    static constexpr uint32_t SLOT_BITS = 6;
+    static constexpr uint32_t SLOTS = 1u << SLOT_BITS;
+    static constexpr uint32_t LEVELS = 4; // 64^4 тиков по 10 мс ~ 46 часов
+
+    class Timer {
+    public:
+        Timer() = default;
+        explicit Timer(std::function<void()> cb) : cb(std::move(cb)) {}
+        ~Timer();
+        Timer(const Timer&) = delete;
+        Timer& operator=(const Timer&) = delete;
+
+        bool armed() const { return wheel_ != nullptr; }
+
+        // вызывается из advance, таймер уже снят - можно перевзвести
+        std::function<void()> cb;
+
+    private:
+        friend class TimerWheel;
+        Timer* prev_ = nullptr;
+        Timer* next_ = nullptr;
+        TimerWheel* wheel_ = nullptr;
+        uint64_t expires_ = 0; // в тиках
+    };
+
+    TimerWheel();
+    ~TimerWheel();
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    static uint64_t nowMs();
+
+    // взведенный таймер перевзводится
+    void arm(Timer& t, uint32_t delay_ms);
+    void cancel(Timer& t);
+
+    // сколько можно спать в epoll_wait: не больше max_ms
+    int timeoutMs(int max_ms) const;
+    // запускает все, что наступило к now_ms, возвращает сколько сработало
+    size_t advance(uint64_t now_ms = nowMs());
+
+    size_t size() const { return count_; }
+
+private:
+    // голова кольцевого списка слота
+    struct Slot {
+        Timer head;
+        Slot() { head.prev_ = head.next_ = &head; }
+        bool empty() const { return head.next_ == &head; }
+    };
+
+    void link(Timer& t);
+    static void unlink(Timer& t);
+    void cascade(uint32_t level);
+
+    std::array<std::array<Slot, SLOTS>, LEVELS> slots_;
+    uint64_t now_tick_;
+    size_t count_ = 0;
+};
+
+#endif // TIMERWHEEL_H
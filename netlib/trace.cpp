@@ -0,0 +1,292 @@
+#include "trace.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+/*
+ * файл:
+ *   TraceFileHeader
+ *   rings раз: TraceRingHeader, count записей TraceFileRecord (старые первыми)
+ */
+static constexpr char TRACE_MAGIC[8] = {'N', 'L', 'T', 'R', 'A', 'C', 'E', '1'};
+
+struct TraceFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t rings;
+    double ticks_per_ns; // для перевода traceClock в время
+    uint64_t ref_ticks;   // traceClock в момент ref_unix_ns
+    uint64_t ref_unix_ns;
+};
+struct TraceRingHeader {
+    uint32_t tid;
+    uint32_t count;
+    char name[16];
+};
+struct TraceFileRecord {
+    uint64_t ticks;
+    uint64_t ev_fd; // ev << 32 | fd
+    uint64_t a;
+    uint64_t b;
+};
+
+struct TraceRegistry {
+    std::mutex mtx;
+    std::vector<TraceRing*> all;
+    std::vector<TraceRing*> free; // потоки вышли, кольцо ждет нового хозяина
+
+    static TraceRegistry& get(){
+        static auto* r = new TraceRegistry(); // не разрушаем: потоки могут выходить после main
+        return *r;
+    }
+};
+
+namespace {
+struct LocalRing {
+    TraceRing* ring = nullptr;
+    ~LocalRing(){
+        if (ring) {
+            TraceRegistry& r = TraceRegistry::get();
+            std::lock_guard lock(r.mtx);
+            r.free.push_back(ring); // события остаются в дампе, пока кольцо не заберут
+        }
+    }
+};
+thread_local LocalRing local_ring;
+} // namespace
+
+TraceRing& TraceRing::local(){
+    if (!local_ring.ring) {
+        TraceRegistry& r = TraceRegistry::get();
+        std::lock_guard lock(r.mtx);
+        if (!r.free.empty()) {
+            local_ring.ring = r.free.back();
+            r.free.pop_back();
+        } else {
+            local_ring.ring = new TraceRing();
+            r.all.push_back(local_ring.ring);
+        }
+        local_ring.ring->tid_ = static_cast<uint32_t>(syscall(SYS_gettid));
+        pthread_getname_np(pthread_self(), local_ring.ring->name_, sizeof(local_ring.ring->name_));
+    }
+    return *local_ring.ring;
+}
+
+// тиков traceClock в наносекунде, меряем на месте
+static double calibrate(uint64_t& ref_ticks, uint64_t& ref_unix_ns){
+#if defined(__x86_64__) || defined(__i386__)
+    auto t0 = std::chrono::steady_clock::now();
+    uint64_t c0 = traceClock();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    auto t1 = std::chrono::steady_clock::now();
+    uint64_t c1 = traceClock();
+    double ns = std::chrono::duration<double, std::nano>(t1 - t0).count();
+    double ratio = ns > 0 ? double(c1 - c0) / ns : 1.0;
+#else
+    double ratio = 1.0;
+#endif
+    ref_ticks = traceClock();
+    ref_unix_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    return ratio;
+}
+
+bool traceDump(const std::string& path){
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f) {
+        return false;
+    }
+    TraceFileHeader fh{};
+    std::memcpy(fh.magic, TRACE_MAGIC, sizeof(fh.magic));
+    fh.version = 1;
+    fh.ticks_per_ns = calibrate(fh.ref_ticks, fh.ref_unix_ns);
+
+    std::vector<TraceRing*> rings;
+    {
+        TraceRegistry& r = TraceRegistry::get();
+        std::lock_guard lock(r.mtx);
+        rings = r.all; // кольца не удаляются, указатели живут дальше
+    }
+    fh.rings = static_cast<uint32_t>(rings.size());
+    bool ok = fwrite(&fh, sizeof(fh), 1, f) == 1;
+
+    std::vector<TraceFileRecord> recs;
+    for (TraceRing* ring : rings) {
+        uint64_t head = ring->head_.load(std::memory_order_acquire);
+        uint64_t from = head > TraceRing::CAPACITY ? head - TraceRing::CAPACITY : 0;
+        recs.clear();
+        for (uint64_t i = from; i < head; ++i) {
+            const TraceRing::Slot& s = ring->slots_[i & (TraceRing::CAPACITY - 1)];
+            recs.push_back(TraceFileRecord{s.w[0].load(std::memory_order_relaxed), s.w[1].load(std::memory_order_relaxed),
+                                           s.w[2].load(std::memory_order_relaxed), s.w[3].load(std::memory_order_relaxed)});
+        }
+        // пока копировали, писатель мог затереть начало - выкидываем его
+        uint64_t after = ring->head_.load(std::memory_order_acquire);
+        size_t skip = after > from + TraceRing::CAPACITY ? std::min<uint64_t>(after - from - TraceRing::CAPACITY, recs.size()) : 0;
+
+        TraceRingHeader rh{};
+        rh.tid = ring->tid_;
+        rh.count = static_cast<uint32_t>(recs.size() - skip);
+        std::memcpy(rh.name, ring->name_, sizeof(rh.name));
+        ok = ok && fwrite(&rh, sizeof(rh), 1, f) == 1;
+        ok = ok && (rh.count == 0 || fwrite(recs.data() + skip, sizeof(TraceFileRecord), rh.count, f) == rh.count);
+    }
+    return fclose(f) == 0 && ok;
+}
+
+static int dump_pipe[2] = {-1, -1};
+
+static void on_dump_signal(int){
+    char c = 1;
+    ssize_t r = write(dump_pipe[1], &c, 1); // async-signal-safe, остальное в потоке
+    (void)r;
+}
+
+bool traceDumpOnSignal(int sig, const std::string& dir){
+    if (dump_pipe[0] >= 0) {
+        return true;
+    }
+    if (pipe2(dump_pipe, O_CLOEXEC) != 0) {
+        return false;
+    }
+    std::thread([dir]{
+        pthread_setname_np(pthread_self(), "trace-dump");
+        int n = 0;
+        char c;
+        while (read(dump_pipe[0], &c, 1) > 0 || errno == EINTR) {
+            std::string path = dir + "/netlib-trace-" + std::to_string(getpid()) + "-" + std::to_string(n++) + ".bin";
+            bool ok = traceDump(path);
+            fprintf(stderr, "trace dump %s: %s\n", path.c_str(), ok ? "ok" : strerror(errno));
+        }
+    }).detach();
+
+    struct sigaction sa{};
+    sa.sa_handler = on_dump_signal;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    return sigaction(sig, &sa, nullptr) == 0;
+}
+
+static const char* ev_name(uint32_t ev){
+    switch (static_cast<TraceEv>(ev)) {
+    case TraceEv::ACCEPT: return "accept";
+    case TraceEv::HANDOFF: return "handoff";
+    case TraceEv::ADD_CLIENT: return "add_client";
+    case TraceEv::CLOSE: return "close";
+    case TraceEv::RECV: return "recv";
+    case TraceEv::FRAME: return "frame";
+    case TraceEv::SEND: return "send";
+    case TraceEv::WAKE: return "wake";
+    default: return nullptr;
+    }
+}
+
+static const char* close_reason(uint64_t r){
+    switch (r) {
+    case TRACE_CLOSE_HUP: return "hup";
+    case TRACE_CLOSE_EOF: return "eof";
+    case TRACE_CLOSE_DEADLINE: return "deadline";
+    case TRACE_CLOSE_HEARTBEAT: return "heartbeat";
+    case TRACE_CLOSE_STOP: return "stop";
+    case TRACE_CLOSE_TX: return "tx";
+    default: return "?";
+    }
+}
+
+bool traceDecode(const std::string& path, std::ostream& out){
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) {
+        return false;
+    }
+    TraceFileHeader fh{};
+    if (fread(&fh, sizeof(fh), 1, f) != 1 || std::memcmp(fh.magic, TRACE_MAGIC, sizeof(fh.magic)) != 0 || fh.version != 1) {
+        fclose(f);
+        return false;
+    }
+    struct Row {
+        TraceFileRecord r;
+        uint32_t ring;
+    };
+    std::vector<TraceRingHeader> rings(fh.rings);
+    std::vector<Row> rows;
+    bool ok = true;
+    for (uint32_t i = 0; i < fh.rings && ok; ++i) {
+        ok = fread(&rings[i], sizeof(TraceRingHeader), 1, f) == 1;
+        for (uint32_t k = 0; k < rings[i].count && ok; ++k) {
+            Row row{{}, i};
+            ok = fread(&row.r, sizeof(row.r), 1, f) == 1;
+            rows.push_back(row);
+        }
+    }
+    fclose(f);
+    if (!ok) {
+        return false;
+    }
+    std::stable_sort(rows.begin(), rows.end(), [](const Row& a, const Row& b) { return a.r.ticks < b.r.ticks; });
+
+    double tpn = fh.ticks_per_ns > 0 ? fh.ticks_per_ns : 1.0;
+    uint64_t first = rows.empty() ? 0 : rows.front().r.ticks;
+    char line[256];
+    for (const Row& row : rows) {
+        const TraceRingHeader& rh = rings[row.ring];
+        uint32_t ev = uint32_t(row.r.ev_fd >> 32);
+        int fd = int32_t(uint32_t(row.r.ev_fd));
+        double us = double(row.r.ticks - first) / tpn / 1000.0;
+        char name[17] = {};
+        std::memcpy(name, rh.name, sizeof(rh.name));
+        int n = snprintf(line, sizeof(line), "%14.3f %6u %-15s ", us, rh.tid, name);
+        const char* en = ev_name(ev);
+        if (en) {
+            n += snprintf(line + n, sizeof(line) - n, "%-10s", en);
+        } else if (ev >= uint32_t(TraceEv::USER)) {
+            n += snprintf(line + n, sizeof(line) - n, "user+%-5u", ev - uint32_t(TraceEv::USER));
+        } else {
+            n += snprintf(line + n, sizeof(line) - n, "ev%-8u", ev);
+        }
+        if (fd >= 0) {
+            n += snprintf(line + n, sizeof(line) - n, " fd=%d", fd);
+        }
+        switch (static_cast<TraceEv>(ev)) {
+        case TraceEv::ACCEPT: {
+            uint32_t ip = uint32_t(row.r.a); // сетевой порядок
+            const unsigned char* b = reinterpret_cast<const unsigned char*>(&ip);
+            snprintf(line + n, sizeof(line) - n, " %u.%u.%u.%u:%llu", b[0], b[1], b[2], b[3], (unsigned long long)row.r.b);
+            break;
+        }
+        case TraceEv::HANDOFF:
+            snprintf(line + n, sizeof(line) - n, " worker=%llu", (unsigned long long)row.r.a);
+            break;
+        case TraceEv::CLOSE:
+            snprintf(line + n, sizeof(line) - n, " %s", close_reason(row.r.a));
+            break;
+        case TraceEv::RECV:
+        case TraceEv::SEND:
+            snprintf(line + n, sizeof(line) - n, " bytes=%llu", (unsigned long long)row.r.a);
+            break;
+        case TraceEv::FRAME:
+            snprintf(line + n, sizeof(line) - n, " type=%llu header=%llu", (unsigned long long)row.r.a, (unsigned long long)row.r.b);
+            break;
+        case TraceEv::WAKE:
+            snprintf(line + n, sizeof(line) - n, " events=%llu", (unsigned long long)row.r.a);
+            break;
+        case TraceEv::ADD_CLIENT:
+            break;
+        default:
+            snprintf(line + n, sizeof(line) - n, " a=%llu b=%llu", (unsigned long long)row.r.a, (unsigned long long)row.r.b);
+            break;
+        }
+        out << line << '\n';
+    }
+    out << rows.size() << " events, " << fh.rings << " threads, " << fh.ticks_per_ns << " ticks/ns\n";
+    return true;
+}
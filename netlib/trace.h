@@ -0,0 +1,97 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// 0 - trace() пустой, вызовы вырезает компилятор
+#define NETLIB_TRACE 1
+
+/*
+ * кольцо бинарных событий на поток: rdtsc + id + fd + два аргумента, 32 байта.
+ * запись - четыре relaxed store без блокировок и без системных вызовов,
+ * старые события затираются. снаружи кольца только читают (traceDump),
+ * писатель никого не ждет. расшифровка в ленту по времени - tracedump <файл>.
+ */
+enum class TraceEv : uint16_t {
+    ACCEPT = 1,   // fd, a - ip (сетевой порядок), b - порт
+    HANDOFF,      // fd отдан воркеру a
+    ADD_CLIENT,   // fd добавлен в epoll потока
+    CLOSE,        // fd, a - TraceClose
+    RECV,         // fd, a - байт
+    FRAME,        // fd, a - MessageType, b - размер заголовка
+    SEND,         // fd, a - байт
+    WAKE,         // a - событий из epoll_wait
+    USER = 0x100, // свои события приложения: USER + n
+};
+
+enum TraceClose : uint64_t {
+    TRACE_CLOSE_HUP = 1,   // EPOLLHUP/RDHUP/ERR
+    TRACE_CLOSE_EOF,       // recv 0 или ошибка
+    TRACE_CLOSE_DEADLINE,  // handshake/idle, у сервера и потерянный heartbeat
+    TRACE_CLOSE_HEARTBEAT,
+    TRACE_CLOSE_STOP,
+    TRACE_CLOSE_TX,        // запись оборвалась или backlog отправки переполнен
+};
+
+inline uint64_t traceClock(){
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    // без TSC - монотонные наносекунды, tracedump это знает по ticks_per_ns = 1
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+class TraceRing {
+public:
+    static constexpr size_t CAPACITY = 8192; // 256 КБ на поток
+    static_assert((CAPACITY & (CAPACITY - 1)) == 0, "CAPACITY - степень двойки");
+
+    // кольцо этого потока; после выхода потока его забирает следующий новый
+    static TraceRing& local();
+
+    void push(TraceEv ev, int fd, uint64_t a, uint64_t b){
+        uint64_t h = head_.load(std::memory_order_relaxed);
+        Slot& s = slots_[h & (CAPACITY - 1)];
+        s.w[0].store(traceClock(), std::memory_order_relaxed);
+        s.w[1].store((uint64_t(ev) << 32) | uint32_t(fd), std::memory_order_relaxed);
+        s.w[2].store(a, std::memory_order_relaxed);
+        s.w[3].store(b, std::memory_order_relaxed);
+        head_.store(h + 1, std::memory_order_release);
+    }
+
+private:
+    friend bool traceDump(const std::string& path);
+    friend struct TraceRegistry;
+    struct Slot {
+        std::atomic<uint64_t> w[4];
+    };
+    std::atomic<uint64_t> head_{0};
+    uint32_t tid_ = 0;
+    char name_[16] = {};
+    Slot slots_[CAPACITY] = {};
+};
+
+inline void trace(TraceEv ev, int fd = -1, uint64_t a = 0, uint64_t b = 0){
+    if (NETLIB_TRACE) {
+        TraceRing::local().push(ev, fd, a, b);
+    }
+}
+
+// все кольца в файл (формат - trace.cpp), можно из любого потока
+bool traceDump(const std::string& path);
+// по сигналу sig пишет dir/netlib-trace-<pid>-<n>.bin из своего потока (в обработчике только write в pipe)
+bool traceDumpOnSignal(int sig, const std::string& dir = ".");
+// дамп в текст: все потоки одной лентой по времени, мкс от первого события
+bool traceDecode(const std::string& path, std::ostream& out);
+
+#endif // TRACE_H
@@ -0,0 +1,15 @@
+#include <iostream>
+#include "trace.h"
+
+// tracedump <файл> - дамп traceDump/traceDumpOnSignal в текст
+int main(int argc, char** argv){
+    if (argc < 2) {
+        std::cerr << "usage: " << argv[0] << " <netlib-trace.bin>" << std::endl;
+        return 1;
+    }
+    if (!traceDecode(argv[1], std::cout)) {
+        std::cerr << "bad trace file " << argv[1] << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -8,6 +8,7 @@
 #include <fstream>
 #include <filesystem>
 #include <array>
+#include <chrono>
 
 
 int getRandomNumber(int from, int to) {
@@ -16,6 +17,21 @@ int getRandomNumber(int from, int to) {
     return dis(gen);
 }
 
+uint64_t monotonicUs() {
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+uint64_t monotonicNs() {
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+uint64_t realtimeUs() {
+    using namespace std::chrono;
+    return duration_cast<microseconds>(system_clock::now().time_since_epoch()).count();
+}
+
 std::vector<uint8_t> generateRandomData(size_t size)
 {
     std::vector<uint8_t> data(size);
@@ -55,7 +71,7 @@ void write2file(string& sfilename, const char* data, ssize_t size) {
     while(write_size != size){
         int wr = write(fd, data+write_size, size-write_size);
         if (wr <= 0) {
-            std::cerr << "write to file failed" << std::endl;
+            LOG_ERROR("write to file failed");
             break;
         }
         write_size += wr;
@@ -5,12 +5,18 @@
 #include <unistd.h>
 #include <string>
 #include <vector>
+#include <array>
 
 int getRandomNumber(int from, int to);
 std::vector<uint8_t> generateRandomData(size_t size);
 void write2file(std::string& sfilename, const char* data, ssize_t size);
 
 std::array<uint8_t, 16> generateUuid();
+// монотонные микросекунды, для rtt и задержек
+uint64_t monotonicUs();
+uint64_t monotonicNs();
+// часы реального времени, микросекунды: метки в кадрах для задержки между хостами
+uint64_t realtimeUs();
 bool write_session_uuid(const std::array<uint8_t, 16>& client_session_uuid, const std::string &filename);
 bool read_session_uuid(const std::string& filename, std::array<uint8_t, 16>& result);
 
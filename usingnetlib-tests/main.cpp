@@ -1,6 +1,9 @@
 #include <netlib.h>
+#include <random>
 
 // __FILE__ __FUNCTION__ __PRETTY_FUNCTION__
+// d() из netlib идет в асинхронный лог, тестам нужен вывод сразу
+#undef d
 #define d(x) std::cout << x << " \t(" << __FUNCTION__ << " " << __LINE__ << ")" << std::endl;
 
 
@@ -117,11 +120,232 @@ void test3_handshake()
     cli->send(s.data(), s.size());
 
 }
+// проверка формата кадров: не сошлось - исключение, main вернет 1
+#define check(x) do { if (!(x)) throw std::runtime_error(std::string("check failed: ") + #x \
+    + " (" + __FUNCTION__ + " " + std::to_string(__LINE__) + ")"); } while (0)
+
+// два парсера на socketpair после handshake. прием с таймаутом:
+// отброшенный кадр не вешает тест, а дает false из next()
+struct Wire {
+    int fds[2] = {-1, -1};
+    std::unique_ptr<MessageParser> tx, rx;
+    ParsedMessage out, in;
+
+    Wire(bool lz, bool crc, uint8_t dict_log2 = LZ_DICT_LOG2){
+        check(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+        timeval tv{1, 0};
+        for (int fd : fds) {
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        }
+        tx = std::make_unique<MessageParser>(fds[0]);
+        rx = std::make_unique<MessageParser>(fds[1]);
+        for (MessageParser* p : {tx.get(), rx.get()}) {
+            p->setCompression(lz, dict_log2);
+            p->setChecksum(crc);
+        }
+        tx->sendAuthRequest(out, {});
+        check(rx->readMessage(in, false) && in.type == MessageType::AUTH_REQUEST);
+        rx->sendAuthResponce(out, {}, 0);
+        check(tx->readMessage(in, false) && in.type == MessageType::AUTH_RESPONSE);
+        check(tx->isCompressed() == lz && rx->isCompressed() == lz);
+        check(tx->isChecksummed() == crc && rx->isChecksummed() == crc);
+    }
+    ~Wire(){
+        close(fds[0]);
+        close(fds[1]);
+    }
+
+    // следующий целый кадр; false - за секунду не пришло
+    bool next(){
+        return rx->readMessage(in, false);
+    }
+    bool nextPkt(uint64_t seq, const std::string& data){
+        return next() && in.type == MessageType::DATA_PKT && in.packet_header.seq_num == seq
+            && std::string(in.payload.data(), in.payload.size()) == data;
+    }
+    void sendPkt(uint64_t seq, std::string data){
+        tx->sendDataPkt(out, seq, data.data(), static_cast<int>(data.size()));
+    }
+    // только что отправленное, сырыми байтами мимо rx - чтобы испортить и вставить заново
+    std::string grab(){
+        std::string raw(1 << 16, 0);
+        ssize_t n = recv(fds[1], raw.data(), raw.size(), MSG_DONTWAIT);
+        raw.resize(n > 0 ? n : 0);
+        return raw;
+    }
+    void inject(const std::string& raw){
+        check(send(fds[0], raw.data(), raw.size(), MSG_NOSIGNAL) == ssize_t(raw.size()));
+    }
+};
+
+static std::string telemetry(size_t size, uint32_t seed){
+    std::mt19937 rnd(seed);
+    static const char pattern[] = "sensor=temp id=42 value=21.5 unit=C;";
+    std::string s(size, 0);
+    for (size_t i = 0; i < size; ++i) {
+        s[i] = rnd() % 8 == 0 ? char('a' + rnd() % 26) : pattern[i % (sizeof(pattern) - 1)];
+    }
+    return s;
+}
+
+// user-026: пачка записей, varint длины
+void test4_batch_frames()
+{
+    d("--START batch frames TEST");
+    for (bool lz : {false, true}) {
+        Wire w(lz, false);
+        std::vector<std::string> recs = {"", "x", telemetry(32, 1), telemetry(127, 2), telemetry(128, 3), telemetry(20000, 4)};
+        std::vector<PktView> views;
+        for (auto& r : recs) {
+            views.push_back(PktView{0, r.data(), uint32_t(r.size())});
+        }
+        w.tx->sendDataBatch(w.out, 1000, views.data(), views.size());
+        check(w.next() && w.in.type == MessageType::DATA_BATCH);
+        check(bool(w.in.batch_header.flags & PKT_FLAG_LZ) == lz);
+        check(w.in.batch_records.size() == recs.size());
+        for (size_t i = 0; i < recs.size(); ++i) {
+            const PktView& r = w.in.batch_records[i];
+            check(r.seq_num == 1000 + i && std::string(r.data, r.size) == recs[i]);
+        }
+    }
+    // длина первой записи больше тела: пачка отбрасывается целиком, следующий кадр цел
+    Wire w(false, false);
+    std::string a = "a", b = telemetry(300, 5);
+    PktView views[] = {{0, a.data(), 1}, {0, b.data(), uint32_t(b.size())}};
+    w.tx->sendDataBatch(w.out, 1, views, 2);
+    std::string raw = w.grab();
+    check(raw.size() == DataBatchMsg::head_size + 1 + 2 + 301 && raw[DataBatchMsg::head_size] == 1);
+    raw[DataBatchMsg::head_size] = 0x7f;
+    w.inject(raw);
+    w.sendPkt(7, "after");
+    check(w.nextPkt(7, "after"));
+    // varint без конца
+    std::string endless = raw;
+    std::memset(endless.data() + DataBatchMsg::head_size, 0xff, 3 + 301);
+    w.inject(endless);
+    w.sendPkt(8, "after");
+    check(w.nextPkt(8, "after"));
+    d("--END batch frames TEST");
+}
+
+// user-027: LZ, потоковый словарь со сбросом, согласование на handshake
+void test5_lz_codec()
+{
+    d("--START lz codec TEST");
+    for (size_t dict : {size_t(0), size_t(4096), LZ_DICT_RESET_BYTES}) {
+        LzCodec enc(dict), dec(dict);
+        size_t total = 0, packed = 0;
+        for (uint32_t i = 0; total < 3 * 4096 + 100 || i < 50; ++i) {
+            std::string raw = telemetry(1 + i * 37 % 3000, i);
+            std::vector<char> block, back;
+            total += raw.size();
+            if (!enc.compress(raw.data(), raw.size(), block)) {
+                continue; // не выгодно - уходит как есть, история не меняется
+            }
+            packed += block.size();
+            check(dec.decompress(block.data(), block.size(), back));
+            check(std::string(back.begin(), back.end()) == raw);
+        }
+        check(packed > 0 && packed < total);
+    }
+    // битые блоки: false, а не мусор или выход за буфер
+    LzCodec enc(0);
+    std::string raw = telemetry(4000, 9);
+    std::vector<char> block, back;
+    check(enc.compress(raw.data(), raw.size(), block));
+    for (size_t cut : {size_t(0), size_t(1), block.size() / 2, block.size() - 1}) {
+        LzCodec dec(0);
+        check(!dec.decompress(block.data(), cut, back));
+    }
+    std::vector<char> huge = {0x01, char(0xff), char(0xff), char(0xff), char(0xff), 0x0f, 0x00};
+    check(!LzCodec(0).decompress(huge.data(), huge.size(), back));
+    // через парсеры: DATA_PKT и пачка сжаты и разжаты в том же порядке
+    Wire w(true, false, 12);
+    for (uint64_t i = 0; i < 20; ++i) {
+        std::string p = telemetry(500 + i * 97, i);
+        w.sendPkt(i, p);
+        check(w.nextPkt(i, p) && (w.in.packet_header.flags & PKT_FLAG_LZ));
+    }
+    // сжатие не предложено одной стороной - не включается
+    Wire plain(false, false);
+    plain.sendPkt(1, telemetry(2000, 1));
+    check(plain.nextPkt(1, telemetry(2000, 1)) && !(plain.in.packet_header.flags & PKT_FLAG_LZ));
+    d("--END lz codec TEST");
+}
+
+// user-028: crc32c, аппаратный против slice-by-8, порча DATA_PKT
+void test6_crc32c()
+{
+    d("--START crc32c TEST hw=" << crc32cHardware());
+    check(crc32c("123456789", 9) == 0xE3069283);
+    check(crc32cPortable("123456789", 9) == 0xE3069283);
+    std::string data = telemetry(5000, 3);
+    for (size_t off = 0; off < 16; ++off) {
+        for (size_t len : {size_t(0), size_t(1), size_t(7), size_t(8), size_t(9), size_t(63), size_t(4096)}) {
+            uint32_t hw = crc32c(data.data() + off, len);
+            check(hw == crc32cPortable(data.data() + off, len));
+            // по частям - то же, что целиком
+            check(crc32c(data.data() + off + len / 3, len - len / 3, crc32c(data.data() + off, len / 3)) == hw);
+        }
+    }
+
+    Wire w(false, true);
+    std::string payload = telemetry(700, 4);
+    w.sendPkt(1, payload);
+    check(w.nextPkt(1, payload) && (w.in.packet_header.flags & PKT_FLAG_CRC32C));
+    // байт данных и байт seq в заголовке: оба пакета отброшены и посчитаны
+    w.sendPkt(2, payload);
+    std::string bad_data = w.grab();
+    bad_data[bad_data.size() - 10] ^= 0x01;
+    w.sendPkt(3, payload);
+    std::string bad_seq = w.grab();
+    bad_seq[DataPktMsg::head_size - sizeof(uint32_t) - 1] ^= 0x40;
+    w.inject(bad_data + bad_seq);
+    w.sendPkt(4, payload);
+    check(w.nextPkt(4, payload));
+    check(w.rx->rxErrors().crc == 2);
+    d("--END crc32c TEST");
+}
+
+// user-029: мусор в потоке - прыжок к следующему magic, счетчики
+void test7_resync()
+{
+    d("--START resync TEST");
+    Wire w(false, false);
+    std::string junk(37, 'z');
+    w.inject(junk);
+    w.sendPkt(1, "one");
+    check(w.nextPkt(1, "one"));
+    RxErrors e = w.rx->rxErrors();
+    check(e.resyncs == 1 && e.resync_bytes == junk.size());
+    // magic без версии, чужая версия, неизвестный тип
+    std::string fake = {char(FRAME_MAGIC), 'x', char(FRAME_MAGIC), char(FRAME_VERSION + 1), 0, 0,
+                        char(FRAME_MAGIC), char(FRAME_VERSION), char(0xee), 0};
+    w.inject(fake);
+    w.sendPkt(2, "two");
+    check(w.nextPkt(2, "two"));
+    check(w.rx->rxErrors().resyncs > e.resyncs && w.rx->rxErrors().resync_bytes == junk.size() + fake.size());
+    // заголовок обещает больше FRAME_MAX_SIZE: не ждем его, ищем следующий кадр
+    DataPktHeader h;
+    h.seq_num = 3;
+    h.data_size = FRAME_MAX_SIZE;
+    std::string big(DataPktMsg::head_size, 0);
+    DataPktMsg::encode(h, big.data());
+    w.inject(big);
+    w.sendPkt(4, "four");
+    check(w.nextPkt(4, "four"));
+    d("--END resync TEST");
+}
+
 #include <assert.h>
 int main(int argc, char* argv[])
 {
     try {
         test1_connection_state<SinglethreadFactory>();
+        test4_batch_frames();
+        test5_lz_codec();
+        test6_crc32c();
+        test7_resync();
         // test1_connection_state<MultithreadFactory>();
         // test2_data_exchange_2var();
         // test3_handshake();